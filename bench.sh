@@ -0,0 +1,467 @@
+#!/bin/bash
+#
+# bench.sh - myshell 성능 측정 스크립트
+#
+# 사용법: ./bench.sh [--save-baseline]
+#
+# 측정 결과는 "이름<TAB>값<TAB>단위<TAB>방향" 형식으로 RESULTS 파일에 기록한다.
+# 방향(higher/lower)은 값이 클수록 좋은지, 작을수록 좋은지를 나타낸다.
+# BASELINE 파일이 있으면 결과를 비교하여 TOLERANCE(%) 이상 나빠진 항목이
+# 하나라도 있으면 1을 리턴한다.
+#
+# 환경 변수
+#   MYSHELL          측정할 셸 (기본값: ./myshell)
+#   BENCH_DIR        작업 디렉터리 (기본값: /tmp/myshell-bench.$$)
+#   BENCH_RESULTS    결과 파일 (기본값: bench_results.tsv)
+#   BENCH_BASELINE   기준 파일 (기본값: bench_baseline.tsv)
+#   BENCH_TOLERANCE  허용 오차 % (기본값: 25)
+#   BENCH_CMDS       명령어 처리량 측정 시 명령 개수 (기본값: 20000)
+#   BENCH_SPAWNS     외부 명령 측정 시 명령 개수 (기본값: 1000)
+#   BENCH_LL_SIZES   ll 측정용 디렉터리 엔트리 개수 (기본값: 10000 100000 1000000)
+#   BENCH_PAR_JOBS   parallel 측정 시 job 개수 (기본값: 20000)
+#   BENCH_SEARCH_MB  search 측정용 텍스트 크기 MB (기본값: 1024)
+#   BENCH_BULK_MB    cp -B 측정용 파일 크기 MB (기본값: 1024)
+#   BENCH_WC_MB      wc 측정용 텍스트 크기 MB (기본값: 2048)
+#   BENCH_DCP_FILES  dcp 작은 파일 측정용 1 KiB 파일 개수 (기본값: 1000000)
+#   BENCH_REPEAT     각 항목의 반복 측정 횟수, 가장 좋은 값을 사용 (기본값: 3)
+#
+
+set -u
+
+MYSHELL=${MYSHELL:-./myshell}
+BENCH_DIR=${BENCH_DIR:-/tmp/myshell-bench.$$}
+RESULTS=${BENCH_RESULTS:-bench_results.tsv}
+BASELINE=${BENCH_BASELINE:-bench_baseline.tsv}
+TOLERANCE=${BENCH_TOLERANCE:-25}
+NCMDS=${BENCH_CMDS:-20000}
+NSPAWNS=${BENCH_SPAWNS:-1000}
+LL_SIZES=${BENCH_LL_SIZES:-"10000 100000 1000000"}
+REPEAT=${BENCH_REPEAT:-3}
+PAR_JOBS=${BENCH_PAR_JOBS:-20000}
+SEARCH_MB=${BENCH_SEARCH_MB:-1024}
+BULK_MB=${BENCH_BULK_MB:-1024}
+WC_MB=${BENCH_WC_MB:-2048}
+DCP_FILES=${BENCH_DCP_FILES:-1000000}
+
+save_baseline=0
+if [ "${1:-}" = "--save-baseline" ]; then
+	save_baseline=1
+fi
+
+if [ ! -x "$MYSHELL" ]; then
+	echo "bench: $MYSHELL not found (run make first)" >&2
+	exit 1
+fi
+MYSHELL=$(cd "$(dirname "$MYSHELL")" && pwd)/$(basename "$MYSHELL")
+
+mkdir -p "$BENCH_DIR" || exit 1
+trap 'rm -rf "$BENCH_DIR"' EXIT
+: > "$RESULTS"
+
+
+# now - 현재 시간 (마이크로초)
+now() {
+	local t=${EPOCHREALTIME/./}
+	echo $((10#$t))
+}
+
+# record <이름> <값> <단위> <higher|lower>
+record() {
+	printf "%s\t%s\t%s\t%s\n" "$1" "$2" "$3" "$4" >> "$RESULTS"
+	printf "  %-32s %14s %s\n" "$1" "$2" "$3"
+}
+
+# run_script <스크립트 파일> [정리 명령]
+# myshell로 스크립트를 REPEAT 번 실행하고 가장 짧은 시간(us)을 출력한다.
+# 정리 명령은 매 실행 후 BENCH_DIR 에서 수행된다.
+run_script() {
+	local start end us best=0 r
+	for ((r = 0; r < REPEAT; r++)); do
+		start=$(now)
+		(cd "$BENCH_DIR" && "$MYSHELL" < "$1" > /dev/null 2>&1)
+		end=$(now)
+		us=$((end - start))
+		if [ $best -eq 0 ] || [ $us -lt $best ]; then
+			best=$us
+		fi
+		if [ -n "${2:-}" ]; then
+			(cd "$BENCH_DIR" && eval "$2")
+		fi
+	done
+	echo $best
+}
+
+# rate <개수> <시간(us)> - 초당 처리 개수
+rate() {
+	awk -v n="$1" -v us="$2" 'BEGIN { printf "%.1f", (us > 0) ? n * 1000000 / us : 0 }'
+}
+
+# mbps <바이트> <시간(us)> - 초당 처리 MB
+mbps() {
+	awk -v b="$1" -v us="$2" 'BEGIN { printf "%.1f", (us > 0) ? b / us : 0 }'
+}
+
+# make_files <디렉터리> <개수> <크기(KiB)>
+make_files() {
+	local i
+	mkdir -p "$1"
+	head -c $(($3 * 1024)) /dev/urandom > "$1/f0"
+	for ((i = 1; i < $2; i++)); do
+		cp "$1/f0" "$1/f$i"
+	done
+}
+
+
+echo "myshell benchmark ($MYSHELL)"
+
+#
+# 1. 명령어 처리량: 내장 명령만 있는 스크립트
+#
+script=$BENCH_DIR/builtin.msh
+mkdir -p "$BENCH_DIR/empty"
+for ((i = 0; i < NCMDS / 2; i++)); do
+	echo "cd empty"
+	echo "cd .."
+done > "$script"
+echo "quit" >> "$script"
+us=$(run_script "$script")
+record builtin_cmds_per_sec "$(rate "$NCMDS" "$us")" cmd/s higher
+
+#
+# 2. 명령어 처리량 / spawn 지연: 외부 명령 스크립트
+#
+script=$BENCH_DIR/external.msh
+for ((i = 0; i < NSPAWNS; i++)); do
+	echo "true"
+done > "$script"
+echo "quit" >> "$script"
+us=$(run_script "$script")
+record external_cmds_per_sec "$(rate "$NSPAWNS" "$us")" cmd/s higher
+record spawn_latency_us "$((us / NSPAWNS))" us lower
+
+#
+# 3. 파이프라인 처리량: ll | wc
+#
+make_files "$BENCH_DIR/pipe" 100 0
+script=$BENCH_DIR/pipe.msh
+npipes=$((NSPAWNS / 2))
+for ((i = 0; i < npipes; i++)); do
+	echo "ll pipe | wc"
+done > "$script"
+echo "quit" >> "$script"
+us=$(run_script "$script")
+record pipeline_per_sec "$(rate "$npipes" "$us")" pipe/s higher
+
+#
+# 4. cp / dcp 처리량: 파일 크기 분포별
+#    small: 4 KiB x 1000, medium: 1 MiB x 64, large: 256 MiB x 1
+#
+for dist in small:1000:4 medium:64:1024 large:1:262144; do
+	IFS=: read -r name count kib <<< "$dist"
+	src=$BENCH_DIR/src_$name
+	make_files "$src" "$count" "$kib"
+	bytes=$((count * kib * 1024))
+
+	script=$BENCH_DIR/cp_$name.msh
+	mkdir -p "$BENCH_DIR/cp_$name"
+	for ((i = 0; i < count; i++)); do
+		echo "cp src_$name/f$i cp_$name/f$i"
+	done > "$script"
+	echo "quit" >> "$script"
+	us=$(run_script "$script" "rm -f cp_$name/*")
+	record "cp_${name}_MBps" "$(mbps "$bytes" "$us")" MB/s higher
+	rm -rf "$BENCH_DIR/cp_$name"
+
+	script=$BENCH_DIR/dcp_$name.msh
+	printf "dcp src_%s dcp_%s\nquit\n" "$name" "$name" > "$script"
+	us=$(run_script "$script" "rm -rf dcp_$name")
+	record "dcp_${name}_MBps" "$(mbps "$bytes" "$us")" MB/s higher
+	rm -rf "$src"
+done
+
+#
+# 5. ll 시간: 엔트리 개수별 디렉터리
+#
+for n in $LL_SIZES; do
+	dir=$BENCH_DIR/ll_$n
+	mkdir -p "$dir"
+	(cd "$dir" && seq -f "entry%.0f" 1 "$n" | xargs touch)
+	script=$BENCH_DIR/ll_$n.msh
+	printf "ll ll_%s > ll_%s.out\nquit\n" "$n" "$n" > "$script"
+	us=$(run_script "$script" "rm -f ll_$n.out")
+	record "ll_${n}_ms" "$((us / 1000))" ms lower
+	rm -rf "$dir"
+done
+
+#
+# 6. rm -r 처리량: 100 디렉터리 x 1000 파일
+#
+script=$BENCH_DIR/rm.msh
+printf "rm -r rmtree\nquit\n" > "$script"
+best=0
+for ((r = 0; r < REPEAT; r++)); do
+	for ((i = 0; i < 100; i++)); do
+		mkdir -p "$BENCH_DIR/rmtree/d$i"
+		(cd "$BENCH_DIR/rmtree/d$i" && seq -f "f%.0f" 1 1000 | xargs touch)
+	done
+	us=$(REPEAT=1 run_script "$script")
+	if [ $best -eq 0 ] || [ $us -lt $best ]; then
+		best=$us
+	fi
+done
+record rm_tree_files_per_sec "$(rate 100000 "$best")" file/s higher
+
+#
+# 7. server mode: myshellc 로 명령 하나씩 보내기 vs 매번 myshell 실행
+#
+client=$(dirname "$MYSHELL")/myshellc
+if [ -x "$client" ]; then
+	sock=$BENCH_DIR/myshell.sock
+	(cd "$BENCH_DIR" && exec "$MYSHELL" -s "$sock" 2> /dev/null) &
+	server=$!
+	for ((i = 0; i < 50; i++)); do
+		[ -S "$sock" ] && break
+		sleep 0.1
+	done
+
+	for cmd in "cd ." true; do
+		name=${cmd%% *}
+		[ "$name" = "cd" ] && name=builtin || name=external
+
+		script=$BENCH_DIR/one_$name.msh
+		printf "%s\nquit\n" "$cmd" > "$script"
+		start=$(now)
+		for ((i = 0; i < NSPAWNS; i++)); do
+			"$MYSHELL" < "$script" > /dev/null 2>&1
+		done
+		end=$(now)
+		record "fresh_${name}_cmds_per_sec" "$(rate "$NSPAWNS" $((end - start)))" cmd/s higher
+
+		start=$(now)
+		for ((i = 0; i < NSPAWNS; i++)); do
+			"$client" -s "$sock" "$cmd" > /dev/null 2>&1
+		done
+		end=$(now)
+		record "server_${name}_cmds_per_sec" "$(rate "$NSPAWNS" $((end - start)))" cmd/s higher
+
+		# 한 연결로 모든 명령을 보내기
+		cmds=()
+		for ((i = 0; i < NSPAWNS; i++)); do
+			cmds+=("$cmd")
+		done
+		start=$(now)
+		"$client" -s "$sock" "${cmds[@]}" > /dev/null 2>&1
+		end=$(now)
+		record "session_${name}_cmds_per_sec" "$(rate "$NSPAWNS" $((end - start)))" cmd/s higher
+	done
+
+	kill $server 2> /dev/null
+	wait $server 2> /dev/null
+fi
+
+#
+# 8. parallel 처리량: 아주 작은 job (true) 을 PAR_JOBS 개
+#
+# 먼저 job 의 출력을 모두 모아 끝나는지 확인한다.
+out=$(cd "$BENCH_DIR" && printf "parallel -j 2 echo ::: a b c\nquit\n" |
+	timeout 10 "$MYSHELL" 2> /dev/null | sed "s/myshell> //g" | sort | tr -d "\n")
+if [ "$out" != "abc" ]; then
+	echo "bench: parallel -j 2 echo ::: a b c printed '$out'" >&2
+	exit 1
+fi
+
+seq 1 "$PAR_JOBS" > "$BENCH_DIR/par_args"
+script=$BENCH_DIR/par.msh
+printf "parallel -a par_args true\nquit\n" > "$script"
+us=$(run_script "$script")
+record parallel_jobs_per_sec "$(rate "$PAR_JOBS" "$us")" job/s higher
+
+#
+# 9. du 처리량: 100 디렉터리 x 1000 파일, 캐시 (-C) 를 사용한 재실행 시간
+#
+for ((i = 0; i < 100; i++)); do
+	mkdir -p "$BENCH_DIR/dutree/d$i"
+	(cd "$BENCH_DIR/dutree/d$i" && seq -f "f%.0f" 1 1000 | xargs touch)
+done
+# 캐시는 방금 변경된 디렉터리를 저장하지 않으므로 mtime 을 과거로 바꾼다.
+touch -d '1 hour ago' "$BENCH_DIR/dutree" "$BENCH_DIR"/dutree/d*
+script=$BENCH_DIR/du.msh
+printf "du dutree\nquit\n" > "$script"
+us=$(run_script "$script")
+record du_entries_per_sec "$(rate 100100 "$us")" entry/s higher
+script=$BENCH_DIR/du_cached.msh
+printf "du -C dutree\ndu -C dutree\nquit\n" > "$script"
+us=$(run_script "$script")
+record du_cached_ms "$((us / 1000))" ms lower
+rm -rf "$BENCH_DIR/dutree"
+
+#
+# 10. search 처리량: 16 파일로 나눈 SEARCH_MB 크기의 로그, grep 과 비교
+#     (문자열, 정규식. 파일은 page cache 에 있는 상태)
+#
+mkdir -p "$BENCH_DIR/corpus"
+awk 'BEGIN { for (i = 0; i < 16384; i++)
+	printf "2024-01-01 12:%02d:%02d INFO worker-%d request %d handled in %d ms\n",
+		i % 60, i % 59, i % 32, i * 7, i % 1000 }' > "$BENCH_DIR/corpus/base"
+echo "2024-01-01 12:00:00 ERROR worker-7 needle timeout" >> "$BENCH_DIR/corpus/base"
+for ((i = 0; i < 16; i++)); do
+	for ((j = 0; j < SEARCH_MB / 16; j++)); do
+		cat "$BENCH_DIR/corpus/base"
+	done > "$BENCH_DIR/corpus/log$i"
+done
+rm -f "$BENCH_DIR/corpus/base"
+bytes=$(cat "$BENCH_DIR"/corpus/log* | wc -c)
+for pat in literal:needle regex:'ERROR.*need+le'; do
+	IFS=: read -r name re <<< "$pat"
+	script=$BENCH_DIR/search_$name.msh
+	printf "search -c %s corpus/log*\nquit\n" "$re" > "$script"
+	us=$(run_script "$script")
+	record "search_${name}_MBps" "$(mbps "$bytes" "$us")" MB/s higher
+	best=0
+	for ((r = 0; r < REPEAT; r++)); do
+		start=$(now)
+		(cd "$BENCH_DIR" && grep -c "$re" corpus/log* > grep.out)
+		end=$(now)
+		if [ $best -eq 0 ] || [ $((end - start)) -lt $best ]; then
+			best=$((end - start))
+		fi
+	done
+	record "grep_${name}_MBps" "$(mbps "$bytes" "$best")" MB/s higher
+done
+rm -rf "$BENCH_DIR/corpus"
+
+#
+# 11. bulk 복사 (-B): cache 에 없는 BULK_MB 크기 파일을 cp / cp -B 로 복사
+#     (sync 포함). 복사 후 page cache 에 남은 src+dst 크기와, 복사 전에
+#     읽어 둔 64 MB hot 파일이 cache 에 남은 비율을 함께 기록한다.
+#
+if command -v fincore > /dev/null; then
+	head -c $((BULK_MB * 1048576)) /dev/urandom > "$BENCH_DIR/bulk_src"
+	head -c $((64 * 1048576)) /dev/urandom > "$BENCH_DIR/hot"
+	bytes=$((BULK_MB * 1048576))
+	for mode in buffered: bulk:-B; do
+		IFS=: read -r name opt <<< "$mode"
+		printf "cp %s bulk_src bulk_dst\nquit\n" "$opt" > "$BENCH_DIR/bulk_$name.msh"
+		best=0
+		for ((r = 0; r < REPEAT; r++)); do
+			rm -f "$BENCH_DIR/bulk_dst"
+			dd if="$BENCH_DIR/bulk_src" iflag=nocache count=0 status=none
+			cat "$BENCH_DIR/hot" > /dev/null
+			start=$(now)
+			(cd "$BENCH_DIR" && "$MYSHELL" < "bulk_$name.msh" > /dev/null 2>&1 && sync)
+			end=$(now)
+			if [ $best -eq 0 ] || [ $((end - start)) -lt $best ]; then
+				best=$((end - start))
+			fi
+		done
+		record "bulk_${name}_MBps" "$(mbps "$bytes" "$best")" MB/s higher
+		record "bulk_${name}_cache_MB" "$(fincore -b -n -o RES "$BENCH_DIR/bulk_src" \
+			"$BENCH_DIR/bulk_dst" | awk '{ s += $1 } END { printf "%.1f", s / 1048576 }')" MB lower
+		record "bulk_${name}_hot_pct" "$(fincore -b -n -o RES "$BENCH_DIR/hot" |
+			awk '{ printf "%.1f", $1 * 100 / (64 * 1048576) }')" % higher
+	done
+	rm -f "$BENCH_DIR/bulk_src" "$BENCH_DIR/bulk_dst" "$BENCH_DIR/hot"
+fi
+
+#
+# 12. cat: 작은 파일 NSPAWNS 번의 명령당 지연, 256 MB 파일의 파이프 처리량.
+#     내장 cat 과 외부 cat (/bin/cat) 비교
+#
+head -c 4096 /dev/urandom > "$BENCH_DIR/cat_small"
+head -c $((256 * 1048576)) /dev/urandom > "$BENCH_DIR/cat_large"
+for mode in builtin:cat external:$(command -v cat); do
+	IFS=: read -r name cmd <<< "$mode"
+	script=$BENCH_DIR/cat_$name.msh
+	for ((i = 0; i < NSPAWNS; i++)); do
+		echo "$cmd cat_small > cat.out"
+	done > "$script"
+	echo "quit" >> "$script"
+	us=$(run_script "$script")
+	record "cat_${name}_small_us" "$((us / NSPAWNS))" us lower
+
+	printf "%s cat_large | wc -c\nquit\n" "$cmd" > "$script"
+	us=$(run_script "$script")
+	record "cat_${name}_pipe_MBps" "$(mbps $((256 * 1048576)) "$us")" MB/s higher
+done
+rm -f "$BENCH_DIR"/cat_*
+
+#
+# 13. wc 처리량: 4 파일로 나눈 WC_MB 크기의 텍스트, coreutils wc 와 비교
+#     (줄/단어/바이트 모두, -l 만)
+#
+mkdir -p "$BENCH_DIR/wc"
+yes "2024-01-01 12:00:00 INFO worker-3 request served in 12 ms" |
+	head -c $((WC_MB * 1048576 / 4)) > "$BENCH_DIR/wc/t0"
+for i in 1 2 3; do
+	cp "$BENCH_DIR/wc/t0" "$BENCH_DIR/wc/t$i"
+done
+bytes=$((WC_MB * 1048576 / 4 * 4))
+cat "$BENCH_DIR"/wc/t* > /dev/null
+for mode in all: lines:-l; do
+	IFS=: read -r name opt <<< "$mode"
+	script=$BENCH_DIR/wc_$name.msh
+	printf "wc %s wc/t0 wc/t1 wc/t2 wc/t3\nquit\n" "$opt" > "$script"
+	us=$(run_script "$script")
+	record "wc_${name}_MBps" "$(mbps "$bytes" "$us")" MB/s higher
+	best=0
+	for ((r = 0; r < REPEAT; r++)); do
+		start=$(now)
+		(cd "$BENCH_DIR" && wc $opt wc/t0 wc/t1 wc/t2 wc/t3 > wc.out)
+		end=$(now)
+		if [ $best -eq 0 ] || [ $((end - start)) -lt $best ]; then
+			best=$((end - start))
+		fi
+	done
+	record "coreutils_wc_${name}_MBps" "$(mbps "$bytes" "$best")" MB/s higher
+done
+rm -rf "$BENCH_DIR/wc" "$BENCH_DIR/wc.out"
+
+#
+# 14. dcp 작은 파일 처리량: 1 KiB 파일 DCP_FILES 개 디렉터리
+#
+mkdir -p "$BENCH_DIR/dcp_tiny"
+head -c $((DCP_FILES * 1024)) /dev/urandom |
+	(cd "$BENCH_DIR/dcp_tiny" && split -b 1024 -a 7 - f)
+script=$BENCH_DIR/dcp_tiny.msh
+printf "dcp dcp_tiny dcp_tiny_out\nquit\n" > "$script"
+us=$(run_script "$script" "rm -rf dcp_tiny_out")
+record dcp_tiny_files_per_sec "$(rate "$DCP_FILES" "$us")" file/s higher
+rm -rf "$BENCH_DIR/dcp_tiny"
+
+
+#
+# 기준 결과 저장 또는 비교
+#
+if [ $save_baseline -eq 1 ]; then
+	cp "$RESULTS" "$BASELINE"
+	echo "baseline saved to $BASELINE"
+	exit 0
+fi
+
+if [ ! -f "$BASELINE" ]; then
+	echo "no baseline ($BASELINE); run 'make bench-baseline' to save one"
+	exit 0
+fi
+
+echo
+echo "comparison with $BASELINE (tolerance ${TOLERANCE}%)"
+awk -F'\t' -v tol="$TOLERANCE" '
+	NR == FNR { base[$1] = $2; next }
+	!($1 in base) { printf "  %-32s %14s   (new)\n", $1, $2; next }
+	{
+		b = base[$1]; v = $2
+		if (b == 0) { change = 0 }
+		else if ($4 == "higher") { change = (b - v) * 100 / b }
+		else { change = (v - b) * 100 / b }
+		status = (change > tol) ? "REGRESSION" : "ok"
+		if (change > tol) failed++
+		printf "  %-32s %14s -> %-14s %+7.1f%% %s\n", $1, b, v, -change, status
+	}
+	END { exit failed ? 1 : 0 }
+' "$BASELINE" "$RESULTS"
+ret=$?
+
+if [ $ret -ne 0 ]; then
+	echo "bench: performance regression detected" >&2
+fi
+exit $ret
@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -6,10 +8,33 @@
 #include <fcntl.h>
 #include <time.h>
 #include <errno.h>
+#include <signal.h>
+#include <spawn.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <termios.h>
+#include <poll.h>
+#include <linux/fs.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/file.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <sys/wait.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 
 /* 컴파일 옵션 매크로 정의 */
@@ -20,67 +45,945 @@
 #define MAXLINE		1024
 #define MAXARGS		128
 #define MAXPATH		1024
-#define MAXTHREAD	10
+#define MAXREDIR	8
+#define SUBST_MAX	64		// 명령 라인 하나의 명령 치환 최대 개수
+#define SUBST_MARK	'\001'	// 명령 치환 자리 표시
+#define MAXPOOL		64		// thread pool 최대 스레드 개수
 
 #define DEFAULT_FILE_MODE	0664
 #define DEFAULT_DIR_MODE	0775
 
 #define BUF_SIZE	4096
+#define DIRBUF_SIZE	(64 * 1024)		// getdents64 버퍼 크기
+#define COPY_BUF_SIZE	(128 * 1024)	// read/write 복사 버퍼 크기
+#define COPY_CHUNK_SIZE	(1 << 30)		// copy_file_range 한 번에 복사할 크기
+#define BULK_BUF_SIZE	(4 * 1024 * 1024)	// bulk 복사 (-B) 버퍼 크기
+#define BULK_ALIGN		4096			// O_DIRECT 버퍼/길이 정렬 단위
+#define CAT_PIPE_SIZE	(1024 * 1024)	// cat 출력 파이프 버퍼 크기
+#define MEM_BLOCK_SIZE	(64 * 1024)		// 명령 메모리 블록 크기
+
+#define GLOB_MAXCOMP	64		// 패턴의 최대 '/' 구분 개수
+#define GLOB_MAXOPS		256		// 패턴 한 부분의 최대 길이
+#define GLOB_CACHE_MAX	64		// 캐시할 디렉터리 scan 개수
+
+#define HIST_MAX_SIZE	(32 * 1024 * 1024)	// 기록 파일 최대 크기
+#define HIST_TRI_BITS	16
+#define HIST_TRI_BUCKETS	(1 << HIST_TRI_BITS)	// trigram 색인 크기
+
+#define TRIE_CHUNK		4096	// trie 노드 할당 단위
+#define EXEC_MAXDIRS	64		// 색인할 PATH 디렉터리 개수
+#define COMP_MAXCAND	10000	// 완성 후보 최대 개수
+#define COMP_MAXLIST	100		// 출력할 완성 후보 최대 개수
+
+#define SERVER_SOCKET	"/tmp/myshell.sock"	// server mode 기본 socket
+#define ZY_MAXMSG		(64 * 1024)		// zygote 실행 요청 최대 크기
+#define ZY_MAXFDS		8	// 요청과 함께 보내는 fd 최대 개수
+#define ZY_SPAWNED		1	// zygote 응답: 실행한 pid
+#define ZY_EXITED		2	// zygote 응답: 종료한 자식의 상태
+
+#define PAR_READ_SIZE	(64 * 1024)	// parallel job 출력 읽기 단위
+#define PAR_BUF_MAX		(1024 * 1024)	// job 출력 버퍼 최대 크기 (넘으면 임시 파일)
+
+#define PL_CPU		0x1		// placement: CPU 집합
+#define PL_NICE		0x2		// placement: nice 값
+#define PL_IO		0x4		// placement: I/O 스케줄링 클래스
+#define PL_MEM		0x8		// placement: NUMA 메모리 node
+
+#define IOPRIO_WHO_PROCESS	1	// <linux/ioprio.h>
+#define IOPRIO_CLASS_SHIFT	13
+#define MPOL_BIND_NODES		2	// <numaif.h> 의 MPOL_BIND
+#define PL_MAXNODE			64	// NUMA node 최대 개수
+
+#define DU_HASH_BUCKETS	4096	// du 캐시, hardlink 집합 hash 크기
+#define DCP_HASH_BUCKETS	1024	// dcp hardlink 집합 hash 크기
+#define DCP_MAXWORKERS		64		// dcp 복사 스레드 최대 개수
+#define DCP_ROT_MAXWORKERS	4		// 회전 디스크의 복사 스레드 최대 개수
+#define DCP_QUEUE_SIZE		1024	// dcp 복사 큐 크기
+#define DCP_INTERVAL_MS		250		// dcp 동시 복사 개수 조절 주기
+#define DCP_SMALL_SIZE		(64 * 1024)	// 한 번에 읽어 복사하는 작은 파일 크기
+#define DCP_BATCH_FILES		64		// 복사 작업 하나로 묶는 작은 파일 개수
+#define DCP_BATCH_NAMES		(8 * 1024)	// 묶음의 파일 이름 버퍼 크기
+
+#define SEARCH_CHUNK		(64 * 1024 * 1024)	// 큰 파일을 나누어 검색하는 단위
+#define SEARCH_READ_SIZE	(1024 * 1024)		// 파이프 검색 읽기 단위
+#define SEARCH_MAXOPS		256		// 정규식 최대 항목 개수
+#define SF_NUMBER	0x1		// search -n: 줄 번호
+#define SF_COUNT	0x2		// search -c: 일치한 줄 수
+#define SF_LIST		0x4		// search -l: 일치한 파일 이름
+#define SF_NAME		0x8		// 파일 이름 출력 (파일이 여러 개)
+#define SR_ONE		0		// 정규식 항목 반복: 한 번
+#define SR_OPT		1		// ?
+#define SR_STAR		2		// *
+#define SR_PLUS		3		// +
+
+#define WC_CHUNK		(64 * 1024 * 1024)	// 큰 파일을 나누어 세는 단위
+#define WC_READ_SIZE	(1024 * 1024)		// 파이프 읽기 단위
+#define WATCH_MAXPATHS		64		// watch -p 최대 개수
+#define WATCH_DEBOUNCE_MS	100		// 변경 후 다시 실행하기 전 조용한 시간
+#define WATCH_INTERVAL_MS	2000	// inotify 가 없을 때 실행 주기
+#define WATCH_MAXDIFF		1000	// diff 로 찾을 최대 변경 줄 수
+#define WATCH_EVBUF_SIZE	(64 * 1024)		// inotify 이벤트 읽기 버퍼
+#define WATCH_MASK	(IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | \
+					 IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE | \
+					 IN_DELETE_SELF | IN_MOVE_SELF)
+#define JOBLOG_RING_SIZE	(64 * 1024)	// job 별 출력 ring 기본 크기
+#define JOBLOG_READ_SIZE	(64 * 1024)	// job 출력 읽기 단위
+#define JOBLOG_MAXEVENTS	64		// epoll_wait 한 번에 받을 이벤트 개수
+#define JOBLOG_KEEP			64		// 보관할 끝난 job 출력 개수
+
+#define WF_LINES	0x1		// wc -l
+#define WF_WORDS	0x2		// wc -w
+#define WF_BYTES	0x4		// wc -c
+#define WC_SPACE	1		// wc 문자 종류: 공백
+#define WC_PRINT	2		// 인쇄 문자
+
+/* wildcard 패턴 연산 */
+#define GOP_CHAR	1	// 문자 하나
+#define GOP_ANY		2	// ?
+#define GOP_STAR	3	// *
+#define GOP_CLASS	4	// [...]
+
+/* redirection 종류 */
+#define RD_IN		1	// [n]< file
+#define RD_OUT		2	// [n]> file, &> file
+#define RD_APPEND	3	// [n]>> file
+#define RD_DUP		4	// [n]>&m
+#define RD_HERESTR	5	// <<< word
+
+
+/* 자료형 정의 */
+struct builtin {
+	char *name;
+	int (*func)(int argc, char **argv);
+};
+
+struct redirect {
+	int type;			// redirection 종류 (RD_*)
+	int fd;				// 대상 fd (0, 1, 2)
+	int src_fd;			// RD_DUP 의 복제할 fd
+	char *target;		// 파일 이름 혹은 here-string
+};
+
+
+// thread pool 작업
+struct pool_task {
+	void (*func)(void *arg);
+	void *arg;
+	struct pool_task *next;
+};
+
+struct thread_pool {
+	pthread_t tid[MAXPOOL];
+	int nthreads;
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;	// 작업 추가 / 종료 알림
+	pthread_cond_t done_cond;	// 모든 작업 완료 알림
+	struct pool_task *head;		// 작업 스택 (LIFO)
+	long pending;				// 대기 + 수행 중인 작업 개수
+	int shutdown;
+};
+
+// getdents64 디렉터리 읽기
+struct dir_reader {
+	int fd;
+	char *buf;
+	int pos, len;
+	int error;
+};
+
+// rm -r 에서 삭제 중인 디렉터리
+struct rm_dir {
+	int fd;					// 디렉터리 fd (scan 이 끝나도 하위 rmdir 에 사용)
+	struct rm_dir *parent;
+	atomic_int refs;		// scan 몫 1 + 삭제 중인 하위 디렉터리 개수
+	atomic_int failed;		// 하위 항목 삭제 실패
+	char *name;				// 부모 디렉터리 기준 이름 (path 의 마지막 부분)
+	char path[];			// 에러 메시지용 전체 경로
+};
+
+// 다른 파일 시스템으로 mv 중인 디렉터리
+struct mv_dir {
+	int src_fd, dst_fd;
+	struct mv_dir *parent;
+	atomic_int refs;		// scan 몫 1 + 복사 중인 하위 항목 개수
+	struct stat st;			// 원본 디렉터리 정보 (모드, 시간)
+	char *name;				// 원본 부모 기준 이름 (최상위는 경로)
+	char *dst_name;			// 목적 부모 기준 이름 (최상위는 경로)
+	char path[];			// 에러 메시지용 원본 경로
+};
+
+struct mv_file {
+	struct mv_dir *dir;
+	char name[];
+};
+
+// 명령 하나를 처리하는 동안 사용하는 메모리 블록
+struct mem_block {
+	struct mem_block *next;
+	size_t size, used;
+	char data[];
+};
+
+// 크기가 늘어나는 인자 목록 (cmd_alloc 사용)
+struct arglist {
+	char **argv;
+	int argc, cap;
+};
+
+// 컴파일된 wildcard 패턴 (경로의 한 부분)
+struct glob_op {
+	int type;					// GOP_*
+	unsigned char c;			// GOP_CHAR 문자
+	unsigned char cls[32];		// GOP_CLASS 256 bit 맵
+};
+
+struct glob_pat {
+	char *comp;					// 원래 패턴 문자열 (wildcard 가 없을 때 사용)
+	int len;
+	int magic;					// wildcard 포함 여부
+	int recursive;				// "**"
+	int dotok;					// '.' 으로 시작하는 이름과 일치 가능
+	int min_len;				// 일치하는 이름의 최소 길이
+	int prefix, suffix;			// 앞/뒤 고정 문자 개수
+	int nops;
+	struct glob_op ops[GLOB_MAXOPS];
+};
+
+// 캐시한 디렉터리 scan 결과 (이름 순 정렬)
+struct dir_scan {
+	struct dir_scan *next;		// LRU 목록
+	char *path;
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+	int racy;					// scan 직전에 변경됨: 재사용하지 않음
+	int busy;					// 확장에 사용 중
+	int count;
+	char **names;
+	int *lens;
+	unsigned char *types;
+};
+
+// 명령 기록 trigram 색인의 명령 번호 목록
+struct hist_posting {
+	int *ids;
+	int len, cap;
+};
+
+// 명령 기록
+struct history {
+	char path[MAXPATH];
+	int fd;						// O_APPEND 추가용
+	ino_t ino;					// 정리 (rename) 감지용
+	char *map;					// 파일 mmap
+	size_t map_len;
+	off_t *offs;				// 각 명령의 시작 위치 (lazy 색인)
+	int count, cap;
+	size_t indexed_len;
+	struct hist_posting *tri;	// trigram 색인 (처음 검색할 때 생성)
+	int tri_count;				// trigram 색인에 들어간 명령 개수
+	char last[MAXLINE];			// 이 셸에서 마지막으로 추가한 명령
+};
+
+// 줄 편집기 상태
+struct line_state {
+	char *buf;
+	int len, pos, size;
+	char *prompt;
+	int hist_id;				// 보고 있는 명령 기록 번호 (count 이면 편집 중인 줄)
+	char saved[MAXLINE];		// 기록을 보기 전에 편집 중이던 줄
+};
+
+// 완성 후보 목록
+struct comp_list {
+	char **items;
+	int n, cap;
+};
+
+// PATH 실행 파일 trie
+struct trie_node {
+	struct trie_node *child, *next;	// 첫 자식, 다음 형제 (글자 순)
+	unsigned char c;
+	unsigned char term;				// 단어의 끝
+};
+
+struct trie_chunk {
+	struct trie_chunk *next;
+	int used;
+	struct trie_node nodes[TRIE_CHUNK];
+};
+
+struct trie {
+	struct trie_node root;
+	struct trie_chunk *chunks;
+};
+
+struct exec_index {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct trie *trie;				// 사용 중인 trie (lock 으로 보호)
+	int refresh;					// 다시 색인 요청
+	int building;					// 색인 중 (path, dirs, mtimes 갱신 중)
+	int started;
+	time_t checked;					// 마지막으로 mtime 을 확인한 시간
+	char path[MAXLINE * 4];			// 색인한 PATH 값
+	char dirs[EXEC_MAXDIRS][MAXPATH];
+	struct timespec mtimes[EXEC_MAXDIRS];
+	int ndirs;
+};
+
+// 명령 실행 위치: CPU 집합, nice, ionice, NUMA 메모리 정책
+struct placement {
+	int set;				// 지정한 항목 (PL_*)
+	cpu_set_t cpus;
+	int nice;
+	int io_class, io_level;	// 1 rt, 2 be, 3 idle
+	unsigned long mems;		// NUMA node mask
+};
+
+// zygote 실행 요청 (뒤에 redirection 과 argv 문자열이 이어진다)
+struct zy_req {
+	int argc, nrd;
+	int has_in, has_out;	// 파이프 fd 를 함께 보냄
+	struct placement place;
+};
+
+struct zy_redirect {
+	int type, fd, src_fd;
+	int fd_idx;				// RD_DUP 의 src_fd 로 함께 보낸 fd 의 위치 (-1: 없음)
+	int tlen;				// target 길이 (-1 이면 NULL)
+};
+
+// zygote 응답
+struct zy_reply {
+	int type;				// ZY_SPAWNED, ZY_EXITED
+	pid_t pid;				// 실패하면 -1
+	int status;
+};
+
+// parallel job 의 출력 버퍼
+struct par_buf {
+	char *data;
+	size_t len, cap;
+	int spill_fd;			// PAR_BUF_MAX 를 넘은 앞부분을 옮긴 임시 파일
+};
+
+// parallel 의 job slot (출력 버퍼는 slot 마다 재사용)
+struct par_job {
+	pid_t pid;
+	long seq;				// job 번호 (1 부터)
+	char *arg;				// job 의 인자
+	struct par_buf buf[2];	// 모아 둔 stdout, stderr
+	int open;				// 아직 EOF 가 아닌 파이프 개수
+	struct timespec start;
+};
+
+// parallel 의 인자 목록: 명령 라인 (::: 뒤) 또는 파일 / stdin 의 줄
+struct par_src {
+	char **list;
+	int n, idx;
+	FILE *fp;
+	char *line;
+	size_t cap;
+};
+
+// du 에서 계산 중인 디렉터리
+struct du_dir {
+	int fd;					// 디렉터리 fd (하위 디렉터리의 openat 기준)
+	struct du_dir *parent;
+	atomic_int refs;		// scan 몫 1 + 계산 중인 하위 디렉터리 개수
+	int depth;
+	atomic_llong size, blocks;	// 하위 트리 합계 (자신 포함)
+	char *name;				// 부모 디렉터리 기준 이름 (path 의 마지막 부분)
+	char path[];
+};
+
+// du 의 hardlink 파일 (dev, ino 로 한번만 계산)
+struct du_link {
+	dev_t dev;
+	ino_t ino;
+	long long size, blocks;
+	struct du_link *next;
+};
+
+// dcp 복사 큐의 파일
+struct dcp_file {
+	char *src, *dst;
+	struct dcp_batch *batch;	// NULL 이 아니면 작은 파일 묶음
+};
+
+// dcp 작은 파일 묶음: source/destination 디렉터리 안의 이름만 보관한다.
+struct dcp_batch {
+	int n, used;
+	short name[DCP_BATCH_FILES];	// names 안의 위치
+	char names[DCP_BATCH_NAMES];
+};
+
+// dcp 복사 스레드별 통계: 자신만 갱신하고 (lock 없음) monitor 가 합산한다.
+// 스레드마다 다른 cache line 을 사용한다.
+struct dcp_stat {
+	atomic_long files, errors;
+	atomic_llong bytes, lat_ns;
+} __attribute__((aligned(64)));
+
+// dcp 에서 실패한 파일과 이유
+struct dcp_fail {
+	struct dcp_fail *next;
+	char msg[];
+};
+
+// dcp 하드링크 집합: (dev, ino) 와 처음 복사한 목적 경로
+struct dcp_link {
+	dev_t dev;
+	ino_t ino;
+	struct dcp_link *next;
+	char path[];
+};
+
+// du 캐시: 디렉터리 자신의 합계와 하위 디렉터리 이름 (mtime 으로 검증)
+struct du_cache {
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+	long long size, blocks;	// 디렉터리와 파일들 (hardlink 파일 제외)
+	struct du_link *links;	// hardlink 파일 목록
+	int nsubdirs;
+	char *subdirs;			// '\0' 으로 구분한 하위 디렉터리 이름들
+	struct du_cache *next;
+};
+
+// du 출력 항목
+struct du_result {
+	char *path;
+	long long size, blocks;
+};
+
+/* search 정규식 항목, 패턴, 검색 작업 (파일 또는 큰 파일의 한 구간) */
+struct search_op {
+	int type;					// GOP_CHAR, GOP_ANY, GOP_CLASS
+	int rep;					// SR_*
+	unsigned char c;
+	unsigned char cls[32];
+};
+struct search_pat {
+	char lit[MAXLINE];			// 일치하는 줄이 반드시 포함하는 문자열
+	int litlen;
+	int rare1, rare2;			// lit 에서 드문 두 글자의 위치 (SIMD 후보 검사)
+	int regex;					// 0 이면 lit 를 포함하는 줄이 일치
+	int bol, eol;				// ^, $
+	int nops;
+	struct search_op ops[SEARCH_MAXOPS];
+};
+struct search_task {
+	char *name;					// 파일 이름
+	int fd;						// 정규 파일이 아니면 읽으면서 검색할 fd
+	const char *data;			// 검색할 구간
+	size_t len;
+	char *map;					// 마지막 구간: munmap 할 mapping
+	size_t map_size;
+	int first, last;			// 파일의 첫/마지막 구간
+	int done;
+	long count;					// 일치한 줄 수
+	char *out;					// 출력 (인자 순서대로 출력하기 위해 모아둠)
+	size_t out_len, out_cap;
+};
+
+// wc 의 수, 구간별 작업, 파일
+struct wc_count {
+	long long lines, words, bytes;
+};
+
+struct wc_task {
+	const char *data;			// 셀 구간 (mmap)
+	size_t len;
+	int lead;					// 첫 공백/인쇄 문자가 인쇄 문자 (앞 단어에 이어짐)
+	int tail;					// 마지막이 공백 1, 인쇄 문자 0, 둘 다 없음 -1
+	struct wc_count cnt;
+};
+
+// watch 의 명령 출력 (줄 단위)
+struct watch_text {
+	char *buf;
+	size_t len;
+	char **line;				// 줄 시작 ('\n' 포함 길이 llen)
+	int *llen;
+	unsigned int *hash;			// 줄의 FNV-1a hash
+	int nlines;
+};
+
+struct wc_file {
+	char *name;					// NULL 이면 이름 없이 출력 (sh_in)
+	int fd;						// stream 이면 읽으면서 셀 fd
+	int stream, error;
+	char *map;					// 정규 파일 mapping
+	size_t size;
+	struct wc_task *tasks;		// 이 파일의 구간 작업
+	int ntasks;
+	struct wc_count cnt;
+};
+
+// 실행 위치를 적용한 스레드에서 실행할 명령
+struct spawn_args {
+	char **argv;
+	int in_fd, out_fd, nrd;
+	struct redirect *rd;
+	pid_t pid;
+};
+
+// background job
+struct job {
+	int id;
+	pid_t pid, pipe_pid;	// 파이프이면 두번째 명령의 pid
+	char cmd[MAXLINE];
+	struct placement place;
+	struct timespec start;
+	struct job *next;
+};
+
+// joblog: background job 의 capture 한 출력
+struct joblog {
+	int id;					// job 번호
+	pid_t pid;
+	char cmd[MAXLINE];
+	int fd;					// 출력 파이프 (읽기), 출력이 끝나면 -1
+	int spill_fd;			// -s: 전체 출력을 저장하는 파일
+	char *ring;				// 최근 출력 (처음 출력이 올 때 할당)
+	size_t size;
+	unsigned long long total;	// 받은 전체 바이트 (ring 의 쓸 위치는 total % size)
+	struct joblog *next;
+};
 
 
 /* 전역 변수 정의 */
 char prompt[] = "myshell> ";
 const char delim[] = " \t\n";
-int bg_flag, pipe_flag, rd_flag;
+int bg_flag, pipe_flag;
 char *pargv[MAXARGS];		// argv for pipe processing
-char *rd_filename;			// filename for redirection
-char src_path[MAXTHREAD][MAXPATH];	// pathname for directory copy
-char dst_path[MAXTHREAD][MAXPATH];	// pathname for directory copy
+struct redirect rd_list[2][MAXREDIR];	// redirection (첫번째/두번째 명령)
+int rd_count[2];
+char *subst_out[SUBST_MAX];	// 명령 치환 $(...) 의 출력 (cmd_alloc)
+int subst_n;
+// 셸의 상태를 바꾸므로 명령 치환에서는 자식 프로세스로 실행할 내장 명령
+const char *subst_fork_builtins[] = { "cd", "quit", "exit", "place", "joblog", NULL };
+
+// dcp 복사 큐, 복사 스레드, 동시 복사 개수 조절, 통계
+struct dcp_file dcp_queue[DCP_QUEUE_SIZE];
+long dcp_qhead, dcp_qtail;
+int dcp_eof, dcp_auto, dcp_rotational, dcp_progress;
+int dcp_limit, dcp_max, dcp_nworkers;
+pthread_t dcp_tid[DCP_MAXWORKERS];
+pthread_mutex_t dcp_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t dcp_cond = PTHREAD_COND_INITIALIZER;	// 큐, dcp_limit 변경
+struct dcp_stat dcp_stats[DCP_MAXWORKERS];
+atomic_long dcp_total_files;		// 큐에 넣은 파일 (읽는 쪽만 갱신)
+atomic_llong dcp_total_bytes;
+struct dcp_fail *dcp_fails, **dcp_fail_tail = &dcp_fails;
+char *dcp_src_name, *dcp_dst_name;	// 작은 파일 묶음의 디렉터리와 fd
+int dcp_src_fd = -1, dcp_dst_fd = -1;
+pthread_mutex_t dcp_fail_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// cp/dcp 검증 (-V): CRC32C 테이블, 하드웨어 명령 사용 여부, 통계
+// copy_verbose 이면 파일마다 출력한다.
+// copy_bulk (-B) 이면 page cache 를 밀어내지 않도록 복사한다.
+int copy_verify, copy_verbose, copy_bulk, crc32c_hw;
+unsigned int crc32c_table[256];
+atomic_long verify_files, verify_bad;
+atomic_llong verify_bytes;
+
+// 복사 도중의 바이트 수를 더할 카운터 (dcp 복사 스레드만 설정)
+__thread atomic_llong *copy_progress;
+
+// rm -r 통계 및 thread pool
+struct thread_pool rm_pool;
+atomic_long rm_files, rm_dirs, rm_errors;
+
+// 다른 파일 시스템으로 mv 통계 및 thread pool
+struct thread_pool mv_pool;
+atomic_long mv_files, mv_bytes, mv_errors;
+int mv_threads;
+
+// 명령 메모리와 디렉터리 scan 캐시
+struct mem_block *cmd_mem;
+struct dir_scan *glob_cache;
+int glob_cache_count;
+
+// 명령 기록
+struct history hist = { .fd = -1 };
+
+// 줄 편집기와 PATH 실행 파일 색인
+struct exec_index exec_idx = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+// server mode: 연결의 quit, zygote, 아직 wait 하지 않은 자식의 종료 상태
+int server_mode, server_quit;
+int zygote_fd = -1;
+int client_cwd = -1;
+struct zy_reply *zy_exits;
+int zy_nexits, zy_cap;
+
+// 마지막 foreground 명령의 종료 상태
+int last_status;
+
+// 실행 위치: 셸의 기본값과 현재 명령의 값 (place)
+struct placement sh_place, cmd_place;
+
+// background job 목록
+struct job *job_list;
+int job_next_id = 1;
+
+// du 의 thread pool, 옵션, 통계, hardlink 집합, 캐시, 출력 목록
+struct thread_pool du_pool;
+int du_max_depth, du_use_cache;
+time_t du_start;
+atomic_long du_entries, du_cached, du_errors;
+struct du_link *du_links[DU_HASH_BUCKETS];
+struct du_cache *du_cache[DU_HASH_BUCKETS];
+pthread_mutex_t du_lock = PTHREAD_MUTEX_INITIALIZER;		// 캐시
+pthread_mutex_t du_link_lock = PTHREAD_MUTEX_INITIALIZER;	// hardlink 집합, 출력 목록
+struct du_result *du_results;
+int du_nresults, du_results_cap;
+
+// search 의 thread pool, 패턴, 옵션, 작업 완료 알림
+struct thread_pool search_pool;
+struct search_pat search_pat;
+int search_flags, search_avx2;
+pthread_mutex_t search_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t search_cond = PTHREAD_COND_INITIALIZER;
+
+// wc 의 thread pool, AVX2 사용 여부, 단어를 셀지 (-w), 문자 종류 표 (C locale)
+// 공백 WC_SPACE, 인쇄 문자 WC_PRINT, 나머지 0 (단어를 시작하거나 끝내지 않음)
+struct thread_pool wc_pool;
+int wc_avx2, wc_words;
+const unsigned char wc_class[256] = {
+	['\t' ... '\r'] = WC_SPACE, [' '] = WC_SPACE, ['!' ... '~'] = WC_PRINT
+};
+
+// watch 의 inotify watch descriptor 별 경로
+char **watch_wd_paths;
+int watch_wd_cap, watch_nwds;
+
+// joblog: capture 사용 여부, ring 크기, spill 디렉터리, 출력 목록, 출력 스레드
+// (epoll), 따라가는 출력과 알림 eventfd
+int joblog_on, joblog_epfd = -1, joblog_evfd = -1;
+size_t joblog_size = JOBLOG_RING_SIZE;
+char *joblog_dir;
+struct joblog *joblog_list, *joblog_follow;
+pthread_mutex_t joblog_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_t joblog_tid;
+
+// 내장 명령의 입출력 스트림 (redirection / 파이프 적용)
+int sh_in = STDIN_FILENO;
+FILE *sh_out, *sh_err;
 
 
 /* 전역 변수 선언 */
+extern char **environ;
 
 
 /* 함수 선언 */
 void myshell_error(char *err_msg);
 void process_cmd(char *cmdline);
 int parse_line(char *cmdline, char **argv);
+int parse_redirect(char *tok, struct redirect *rd);
 int builtin_cmd(int argc, char **argv);
+struct builtin *find_builtin(char *cmd);
+pid_t spawn_cmd(char **argv, int in_fd, int out_fd,
+				struct redirect *rd, int nrd);
+int open_builtin_io(struct redirect *rd, int nrd, int in_fd, int out_fd);
+void close_builtin_io(void);
+pid_t fork_builtin(int argc, char **argv, int out_fd);
+void wait_background(void);
+pid_t wait_cmd(pid_t pid, int *status, int options);
+pid_t spawn_direct(char **argv, int in_fd, int out_fd,
+				   struct redirect *rd, int nrd);
+void *spawn_placed_thr_fn(void *arg);
+
+// 실행 위치 (placement), background job
+int place_parse(int argc, char **argv, struct placement *pl);
+int place_parse_list(char *str, int max, void (*set)(int, void *), void *arg);
+void place_set_cpu(int n, void *arg);
+void place_set_node(int n, void *arg);
+int place_apply(struct placement *pl);
+void place_print(FILE *fp, struct placement *pl, pid_t pid);
+void job_add(pid_t pid, pid_t pipe_pid, char *cmd);
+void job_remove(pid_t pid);
+
+// 명령 치환 $(...)
+char *subst_line(char *line);
+char *subst_run(char *cmd);
+int subst_exec(int argc, char **argv, struct redirect *rd, int nrd, int in_fd);
+char **subst_args(char **argv, int *argc);
+int subst_targets(struct redirect *rd, int nrd);
+
+// 명령 메모리, wildcard 확장
+void *cmd_alloc(size_t size);
+char *cmd_strdup(const char *str, size_t len);
+void cmd_mem_reset(void);
+void arglist_add(struct arglist *al, char *arg);
+char **expand_args(char **argv, int *argc);
+int expand_skip_arg(char **argv);
+int glob_compile(char *comp, int len, struct glob_pat *pat);
+int glob_class_end(char *comp, int start, int len);
+void glob_class_set(char *comp, int start, int end, unsigned char *cls);
+int glob_match(struct glob_pat *pat, const char *name, int len);
+int glob_expand(char *pattern, struct arglist *al);
+int glob_cmp(const void *a, const void *b);
+void glob_walk(char *path, int plen, struct glob_pat *pats, int npats,
+			   int idx, struct arglist *al);
+struct dir_scan *glob_scan_dir(char *path);
+void glob_cache_trim(void);
+
+// 명령 기록 (history)
+void hist_init(void);
+int hist_open(void);
+void hist_reset(void);
+void hist_add(char *cmdline);
+void hist_compact(void);
+int hist_sync(void);
+char *hist_get(int id, int *len);
+unsigned int hist_tri_hash(const unsigned char *p);
+void hist_tri_update(void);
+int hist_search(const char *query, int before);
+
+// 줄 편집기, 완성, PATH 실행 파일 색인
+char *read_line(char *prompt, char *buf, int size);
+int edit_line(char *prompt, char *buf, int size);
+void line_refresh(struct line_state *ls);
+void line_insert(struct line_state *ls, const char *str, int n);
+void line_delete(struct line_state *ls, int at, int n);
+int line_prev(struct line_state *ls, int pos);
+int line_next(struct line_state *ls, int pos);
+void line_set(struct line_state *ls, const char *str, int n);
+void line_history(struct line_state *ls, int dir);
+int line_search(struct line_state *ls);
+void line_complete(struct line_state *ls, int list);
+void comp_add(struct comp_list *cl, const char *str, int len);
+void comp_builtins(char *word, int wlen, struct comp_list *cl);
+void comp_files(char *word, char *slash, struct comp_list *cl);
+void exec_index_start(void);
+void *exec_index_thr_fn(void *arg);
+void exec_index_add_dir(struct trie *t, char *dir, int locked);
+void exec_index_complete(char *prefix, struct comp_list *cl);
+struct trie *trie_new(void);
+void trie_free(struct trie *t);
+struct trie_node *trie_node_new(struct trie *t, unsigned char c);
+void trie_insert(struct trie *t, const char *word);
+struct trie_node *trie_find(struct trie *t, const char *prefix);
+void trie_collect(struct trie_node *node, char *word, int len,
+				  struct comp_list *cl);
+
+// server mode, zygote
+int server_main(char *path);
+void server_conn(int cfd);
+int recv_fds(int sock, void *buf, int size, int *fds, int maxfds, int *nfds);
+int send_fds(int sock, void *buf, int size, int *fds, int nfds);
+void zygote_main(int sock);
+void zygote_request(int sock);
+pid_t zygote_spawn(char **argv, int in_fd, int out_fd,
+				   struct redirect *rd, int nrd);
+void zygote_save_exit(struct zy_reply *rep);
+
+// thread pool, 디렉터리 읽기
+int pool_init(struct thread_pool *pool, int nthreads);
+int pool_submit(struct thread_pool *pool, void (*func)(void *), void *arg);
+void pool_wait(struct thread_pool *pool);
+void pool_destroy(struct thread_pool *pool);
+void *pool_worker(void *arg);
+int pool_default_threads(void);
+void raise_nofile_limit(void);
+int dir_reader_init(struct dir_reader *dr, int fd);
+struct dirent64 *dir_reader_next(struct dir_reader *dr);
+void dir_reader_close(struct dir_reader *dr);
 
 // 내장 명령어 처리 함수
+int quit_shell(int argc, char **argv);
+int show_history(int argc, char **argv);
 int list_files(int argc, char **argv);
 void print_long_format(char *filename, struct stat *statbuf);
 int copy_file(int argc, char **argv);
+int copy_one_file(char *in_file, char *out_file);
 int remove_file(int argc, char **argv);
+int remove_tree(char *pathname, int nthreads, int quiet);
+struct rm_dir *rm_dir_new(struct rm_dir *parent, char *name);
+void rm_dir_release(struct rm_dir *dp);
+void rm_dir_task(void *arg);
 int move_file(int argc, char **argv);
+int move_cross_device(char *old_file, char *new_file, int nthreads);
+struct mv_dir *mv_dir_new(struct mv_dir *parent, char *name, char *dst_name);
+void mv_dir_release(struct mv_dir *dp);
+void mv_dir_task(void *arg);
+void mv_file_task(void *arg);
+void mv_copy_entry(int src_dirfd, char *src_name, int dst_dirfd,
+				   char *dst_name, char *path);
+int mv_sync_parent(char *path);
 int change_directory(int argc, char **argv);
-int print_working_directory(void);
+int print_working_directory(int argc, char **argv);
 int make_directory(int argc, char **argv);
 int remove_directory(int argc, char **argv);
 int copy_directory(int argc, char **argv);
-void *dcp_thr_fn(void *thr_num);
+int dcp_link_entry(char *src, char *dst, struct stat *st,
+				   struct dcp_link **links);
+int dcp_enqueue(char *src, char *dst);
+void dcp_queue_put(struct dcp_file *f);
+void dcp_add_workers(void);
+void *dcp_worker(void *arg);
+off_t dcp_copy_file(char *in_file, char *out_file);
+long long dcp_copy_batch(struct dcp_batch *b, char *buf, int id, long *errors);
+void dcp_batch_fail(char *dir, char *name, const char *what, int err);
+void *dcp_monitor(void *arg);
+void dcp_sum(long *files, long long *bytes, long *errors, long long *lat);
+void dcp_fail_add(const char *path, const char *what, int err);
+int dev_rotational(char *path);
+off_t copy_fd_data(int in_fd, int out_fd);
+void copy_report(off_t n);
+off_t copy_fd_bulk(int in_fd, int out_fd);
+char *bulk_hot_map(int fd, off_t size);
+int bulk_set_direct(int fd, int on);
+int bulk_resident(int fd, off_t off, size_t len);
+void bulk_drop_out(int fd, off_t off, off_t len);
+int copy_fd_verify(char *in_file, int in_fd, int out_fd);
+int verify_read_back(int out_fd, unsigned int *crc, off_t *size);
+void verify_report(FILE *fp, int cmd_ret);
+void crc32c_init(void);
+unsigned int crc32c(unsigned int crc, const void *buf, size_t len);
+unsigned int crc32c_sse42(unsigned int crc, const void *buf, size_t len);
+int place_cmd(int argc, char **argv);
+int list_jobs(int argc, char **argv);
+int disk_usage(int argc, char **argv);
+struct du_dir *du_dir_new(struct du_dir *parent, char *name);
+void du_dir_release(struct du_dir *dp);
+void du_dir_task(void *arg);
+int du_dir_cached(struct du_dir *dp, struct statx *stx);
+int du_link_add(dev_t dev, ino_t ino, long long size, long long blocks);
+void du_cache_store(struct statx *stx, long long size, long long blocks,
+					struct du_link *links, char *subdirs, int nsubdirs);
+void du_result_add(char *path, long long size, long long blocks);
+int du_result_cmp(const void *a, const void *b);
+char *du_format(long long bytes, int unit, char *buf);
+int run_parallel(int argc, char **argv);
+char *par_next_arg(struct par_src *src);
+pid_t par_launch(char **tmpl, int ntmpl, char *arg, int null_fd, int *out_fd,
+				 int *err_fd);
+int par_read(struct par_buf *buf, int fd);
+int par_spill(struct par_buf *buf);
+void par_flush(struct par_buf *buf, FILE *fp);
+void par_finish(struct par_job *job, int status, int verbose, long *failed);
+int search_cmd(int argc, char **argv);
+void search_task(void *arg);
+long search_stream(int fd, char *name);
+long search_buf(const char *buf, size_t len, long *lineno, char *name,
+				struct search_task *t);
+void search_out(struct search_task *t, const char *data, size_t len);
+long search_count_lines(const char *p, const char *end);
+const char *search_mem(const char *s, size_t n, const char *needle, size_t m);
+const char *search_mem_avx2(const char *s, size_t n, const char *needle,
+							size_t m, int r1, int r2);
+int search_byte_rank(unsigned char c);
+int search_compile(char *pattern, int literal);
+void search_rare_bytes(void);
+int search_regex(const char *s, const char *end);
+int search_match(struct search_op *op, int nops, const char *s,
+				 const char *end);
+int search_op_match(struct search_op *op, unsigned char c);
+int cat_cmd(int argc, char **argv);
+int cat_fd(int in_fd, int out_fd);
+int wc_cmd(int argc, char **argv);
+void wc_task(void *arg);
+int wc_stream(int fd, struct wc_count *cnt);
+int wc_scan(const unsigned char *p, size_t n, int prev_space,
+			struct wc_count *cnt);
+size_t wc_scan_avx2(const unsigned char *p, size_t n, int *prev_space,
+					struct wc_count *cnt);
+size_t wc_lines_avx2(const unsigned char *p, size_t n, long long *lines);
+void wc_print(struct wc_count *cnt, int flags, int width, char *name);
+int watch_cmd(int argc, char **argv);
+int watch_add(int ifd, char *path);
+void watch_drain(int ifd);
+void watch_release(int ifd);
+int watch_run(int argc, char **argv, int mfd, struct watch_text *text,
+			  int *status);
+int watch_text_split(struct watch_text *text);
+void watch_text_free(struct watch_text *text);
+void watch_diff(struct watch_text *a, struct watch_text *b, char *name);
+int watch_line_eq(struct watch_text *a, int i, struct watch_text *b, int j);
+void watch_put_line(struct watch_text *text, int i);
+int joblog_cmd(int argc, char **argv);
+int joblog_start(void);
+void joblog_attach(int id, pid_t pid, char *cmd, int fd);
+void joblog_close(int *fds);
+void *joblog_thr_fn(void *arg);
+void joblog_put(struct joblog *jl, const char *data, size_t len);
+size_t joblog_copy(struct joblog *jl, unsigned long long from, char *buf,
+				   size_t max);
+int joblog_show(struct joblog *jl, int follow);
+
+
+/* 내장 명령어 목록 */
+struct builtin builtin_table[] = {
+	{ "quit",	quit_shell },
+	{ "exit",	quit_shell },
+	{ "ls",		list_files },
+	{ "ll",		list_files },
+	{ "cp",		copy_file },
+	{ "rm",		remove_file },
+	{ "mv",		move_file },
+	{ "cd",		change_directory },
+	{ "pwd",	print_working_directory },
+	{ "mkdir",	make_directory },
+	{ "rmdir",	remove_directory },
+	{ "dcp",	copy_directory },
+	{ "history",	show_history },
+	{ "parallel",	run_parallel },
+	{ "place",	place_cmd },
+	{ "jobs",	list_jobs },
+	{ "du",		disk_usage },
+	{ "search",	search_cmd },
+	{ "cat",	cat_cmd },
+	{ "wc",		wc_cmd },
+	{ "watch",	watch_cmd },
+	{ "joblog",	joblog_cmd },
+	{ NULL,		NULL }
+};
 
 
 
 /*
  * main - MyShell's main routine
  */
-int main()
+int main(int argc, char **argv)
 {
 	char cmdline[MAXLINE];
 
+	sh_out = stdout;
+	sh_err = stderr;
+
+	// 내장 명령이 닫힌 파이프에 쓸 때 셸이 종료되지 않도록 한다.
+	signal(SIGPIPE, SIG_IGN);
+
+	// myshell -s [socket]: server mode
+	if (argc > 1 && !strcmp(argv[1], "-s")) {
+		return server_main((argc > 2) ? argv[2] : SERVER_SOCKET);
+	}
+
+	// 명령 기록 파일을 연다. (색인은 처음 사용할 때 만든다)
+	hist_init();
+
+	// 터미널이면 PATH 실행 파일 색인을 background 에서 만든다.
+	if (isatty(STDIN_FILENO)) {
+		exec_index_start();
+	}
+
 	/* 명령어 처리 루프: 셸 명령어를 읽고 처리한다. */
 	while (1) {
-		// 프롬프트 출력
-		printf("%s", prompt);
-		fflush(stdout);
-
-		// 명령 라인 읽기
-		if (fgets(cmdline, MAXLINE, stdin) == NULL) {
+		// 프롬프트 출력 후 명령 라인 읽기
+		if (read_line(prompt, cmdline, MAXLINE) == NULL) {
 			myshell_error("command line read error");
 		}
 
-		// 명령 라인 처리
+		// 명령 기록에 추가하고 명령 라인 처리
+		hist_add(cmdline);
 		process_cmd(cmdline);
 
 		fflush(stdout);
@@ -99,28 +1002,80 @@ int main()
  * 내장 명령 처리 함수를 수행한다.
  * 내장 명령이 아니면 자식 프로세스를 생성하여 지정된 프로그램을 실행한다.
  * 파이프(|)를 사용하는 경우에는 두 개의 자식 프로세스를 생성한다.
+ *
+ * 셸 자신의 stdin/stdout/stderr 는 변경하지 않는다.
+ * 외부 명령의 redirection 과 파이프는 spawn file action 으로,
+ * 내장 명령은 sh_in/sh_out/sh_err 스트림으로 적용한다.
  */
 void process_cmd(char *cmdline)
 {
-	int argc, status, ret;
-	char *argv[MAXARGS];
+	int argc, pipe_argc = 0, status, ret = 0, i;
+	char *targv[MAXARGS], **argv, **pipe_argv = NULL;
+	char cmd_copy[MAXLINE];
 #ifndef HW_STAGE1
-	pid_t pid, pipe_pid;
-	int pipefd[2], rd_fd, saved_stdout;
+	pid_t pid = -1, pipe_pid = -1;
+	int pipefd[2], pipe_builtin = 0;
+	struct redirect log_rd[2][MAXREDIR + 1], *rd[2];
+	int nrd[2], logfd[2] = { -1, -1 };
 #endif
 
+	// 이전 명령의 인자 메모리를 해제한다.
+	cmd_mem_reset();
+
+	// job 목록에 보관할 명령 라인 (parse_line 이 변경하므로 복사)
+	snprintf(cmd_copy, sizeof(cmd_copy), "%s", cmdline);
+	cmd_copy[strcspn(cmd_copy, "\n")] = '\0';
+
+	// 명령 치환 $(...) 을 실행하고 자리 표시로 바꾼다.
+	// (치환의 명령은 이전 명령의 place 가 아닌 셸의 기본 실행 위치 사용)
+	cmd_place = sh_place;
+	subst_n = 0;
+	cmdline = subst_line(cmdline);
+	if (cmdline == NULL) {
+		last_status = 1;
+		wait_background();
+		return;
+	}
+
 	// 명령 라인을 해석하여 인자 (argument) 배열로 변환한다.
-	argc = parse_line(cmdline, argv);
+	argc = parse_line(cmdline, targv);
 	if (argc == 0) {
 		// 종료된 background 프로세스를 wait하고 리턴한다.
-		do {
-			ret = waitpid(-1, &status, WNOHANG);
-			if (ret > 0) {
-				printf("PID %d is terminated.\n", ret);
-			}
-		} while (ret > 0);
+		wait_background();
+		return;
+	}
+
+	// 명령 치환의 출력을 인자로 나누고, wildcard (*, ?, [...], **) 를 확장한다.
+	argv = subst_args(targv, &argc);
+	if (pipe_flag) {
+		pipe_argv = subst_args(pargv, &pipe_argc);
+	}
+	if (argc == 0 || (pipe_flag && pipe_argc == 0) ||
+		subst_targets(rd_list[0], rd_count[0]) < 0 ||
+		subst_targets(rd_list[1], rd_count[1]) < 0) {
+		wait_background();
 		return;
 	}
+	argv = expand_args(argv, &argc);
+	if (pipe_flag) {
+		pipe_argv = expand_args(pipe_argv, NULL);
+		for (pipe_argc = 0; pipe_argv[pipe_argc] != NULL; pipe_argc++)
+			;
+	}
+
+	// place [옵션] command: 이 명령 (파이프 포함) 의 실행 위치
+	cmd_place = sh_place;
+	if (!strcmp(argv[0], "place")) {
+		i = place_parse(argc, argv, &cmd_place);
+		if (i < 0) {
+			wait_background();
+			return;
+		}
+		if (i < argc) {
+			argv += i;
+			argc -= i;
+		}
+	}
 
 #ifdef HW_STAGE1
 	/* 명령 라인 처리 결과를 출력한다. */
@@ -134,196 +1089,551 @@ void process_cmd(char *cmdline)
 	}
 #else
 
+	// joblog on: background job 의 stdout, stderr 를 출력 스레드로 보낸다.
+	// stderr 는 앞에 추가한 2>&fd 로 연결하므로 명령의 redirection 이 우선한다.
+	for (i = 0; i < 2; i++) {
+		rd[i] = rd_list[i];
+		nrd[i] = rd_count[i];
+	}
+	if (bg_flag && joblog_on && pipe2(logfd, O_CLOEXEC) == 0) {
+		for (i = 0; i < 2; i++) {
+			log_rd[i][0] = (struct redirect){ RD_DUP, STDERR_FILENO, logfd[1], NULL };
+			memcpy(&log_rd[i][1], rd_list[i], rd_count[i] * sizeof(rd_list[i][0]));
+			rd[i] = log_rd[i];
+			nrd[i]++;
+		}
+	}
+
 	// pipe flag가 설정되어 있으면 파이프 생성
 	if (pipe_flag) {
-		if (pipe(pipefd) == -1) {
+		if (pipe2(pipefd, O_CLOEXEC) == -1) {
 			fprintf(stderr,"pipe error\n");
+			joblog_close(logfd);
 			return;
 		}
 
-		// stdout fd를 저장
-		saved_stdout = dup(STDOUT_FILENO);
+		// 파이프의 두번째 프로그램을 먼저 실행한다.
+		// 첫번째 명령이 내장 명령이어도 파이프가 가득 차서 멈추지 않는다.
+		// 두번째 명령이 내장 명령이면 첫번째 명령을 실행한 뒤 셸에서 수행한다.
+		pipe_builtin = (find_builtin(pipe_argv[0]) != NULL);
+		if (!pipe_builtin) {
+			pipe_pid = spawn_cmd(pipe_argv, pipefd[0], logfd[1], rd[1], nrd[1]);
+			close(pipefd[0]);
+			if (pipe_pid < 0) {
+				close(pipefd[1]);
+				joblog_close(logfd);
+				return;
+			}
+		}
+	}
 
-		// 파이프 출력을 stdout으로 복제
-		if (dup2(pipefd[1], STDOUT_FILENO) < 0) {
-			fprintf(stderr, "pipefd duplication error\n");
-			return;
+	/* 내장 명령 처리 함수를 수행한다. */
+	last_status = 0;
+	if (find_builtin(argv[0]) != NULL && (pipe_builtin || (pipe_flag && bg_flag))) {
+		// 두 명령이 모두 내장 명령이거나 background 파이프이면
+		// 첫번째는 자식 프로세스에서 수행한다. (셸이 파이프에 막히지 않음)
+		pid = fork_builtin(argc, argv, pipefd[1]);
+		close(pipefd[1]);
+	} else if (find_builtin(argv[0]) != NULL) {
+		// redirection 실패하면 명령을 실행하지 않는다. (파이프는 닫힘)
+		if (open_builtin_io(rd_list[0], rd_count[0], -1,
+					pipe_flag ? pipefd[1] : -1) == 0) {
+			builtin_cmd(argc, argv);
+			close_builtin_io();
+		}
+	} else {
+		// 내장 명령이 아니면 자식 프로세스를 생성하여 프로그램을 실행한다.
+		pid = spawn_cmd(argv, -1, pipe_flag ? pipefd[1] : logfd[1],
+						rd[0], nrd[0]);
+		if (pipe_flag) {
+			close(pipefd[1]);
 		}
 	}
 
-	// redirection flag (stdout) 처리를 위한 파일 열기
-	if (rd_flag) {
-		if (!rd_filename || 
-			((rd_fd = creat(rd_filename, DEFAULT_FILE_MODE)) < 0)) {
-			fprintf(stderr,"redirection file creation error\n");
-			return;
+	// 파이프의 두번째 내장 명령은 파이프를 sh_in 으로 셸에서 수행한다.
+	if (pipe_builtin) {
+		last_status = 0;
+		if (open_builtin_io(rd_list[1], rd_count[1], pipefd[0], -1) == 0) {
+			builtin_cmd(pipe_argc, pipe_argv);
+			close_builtin_io();
 		}
+	}
 
-		// stdout fd를 저장
-		saved_stdout = dup(STDOUT_FILENO);
+	// capture 파이프의 쓰기 쪽은 자식만 가진다.
+	if (logfd[1] >= 0) {
+		close(logfd[1]);
+		logfd[1] = -1;
+	}
 
-		// stdout 으로 복제 (duplication)
-		if (dup2(rd_fd, STDOUT_FILENO) < 0) {
-			fprintf(stderr, "redirection fd duplication error\n");
-			return;
+	// foreground 실행이면 자식 프로세스가 종료할 때까지 기다린다.
+	if (!bg_flag) {
+		if (pid > 0) {
+			ret = wait_cmd(pid, &status, 0);
+			if (ret < 0) {
+				fprintf(stderr, "wait error\n");
+			}
 		}
-		close(rd_fd);
-	}
 
-	/* 내장 명령 처리 함수를 수행한다. */
-	if (builtin_cmd(argc, argv) == 0) {
-		if (pipe_flag) {
-			pipe_flag = 2;	// 내장 명령 파이프 flag
-		} else {
-			// redirection 되었던 stdout fd를 복구
-			if (rd_flag) {
-				dup2(saved_stdout, STDOUT_FILENO);
+		// 파이프 실행이면 두번째 자식 프로세스를 기다린다.
+		if (pipe_pid > 0) {
+			ret = wait_cmd(pipe_pid, &status, 0);
+			if (ret < 0) {
+				fprintf(stderr, "wait error (pipe)\n");
 			}
+		}
 
-			// 종료된 background 프로세스를 wait하고 리턴한다.
-			do {
-				ret = waitpid(-1, &status, WNOHANG);
-				if (ret > 0) {
-					printf("PID %d is terminated.\n", ret);
-				}
-			} while (ret > 0);
-			return;
+		// 파이프이면 마지막 명령의 종료 상태
+		if (pipe_builtin) {
+			// 내장 명령이 이미 last_status 를 설정함
+		} else if ((pid > 0 || pipe_pid > 0) && ret > 0) {
+			last_status = WIFEXITED(status) ? WEXITSTATUS(status) :
+				128 + WTERMSIG(status);
+		} else if (pid < 0 && find_builtin(argv[0]) == NULL) {
+			last_status = 127;
+		}
+	} else if (pid > 0) {
+		printf("[bg] %d : %s\n", pid, cmdline);
+		job_add(pid, pipe_pid, cmd_copy);
+		if (logfd[0] >= 0) {
+			joblog_attach(job_next_id - 1, pid, cmd_copy, logfd[0]);
+			logfd[0] = -1;
 		}
 	}
+	joblog_close(logfd);
+#endif	// HW_STAGE1
+
+	// 종료된 background 프로세스를 wait하고 리턴한다.
+	wait_background();
 
+	return;
+}
 
-	/*
-	 * 자식 프로세스를 생성하여 프로그램을 실행한다.
-	 */
 
-	// 자식 프로세스 생성
-	if ((pid = fork()) < 0) {
-		fprintf(stderr, "fork error\n");
-		return;
-	}	
-	
-	/*
-	 * 자식 프로세스 (Child  process)
-	 */
+/*
+ * fork_builtin
+ *
+ * 파이프의 두 명령이 모두 내장 명령일 때 첫번째 명령을 자식 프로세스에서
+ * 수행한다. 출력은 out_fd (파이프) 로 보내며, 자식의 pid 를 리턴한다.
+ */
+pid_t fork_builtin(int argc, char **argv, int out_fd)
+{
+	pid_t pid;
+
+	fflush(stdout);
+	fflush(stderr);
+
+	pid = fork();
 	if (pid == 0) {
-		// 내장 명령 파이프 처리를 위한 두번째 명령어 파이프 설정
-		if (pipe_flag == 2) {
-			// 부모에서 duplication 한 stdout fd를 복구
-			dup2(saved_stdout, STDOUT_FILENO);
+		signal(SIGPIPE, SIG_DFL);
+		if (open_builtin_io(rd_list[0], rd_count[0], -1, out_fd) != 0) {
+			_exit(1);
+		}
+		builtin_cmd(argc, argv);
+		close_builtin_io();
+		_exit(last_status);
+	}
+	if (pid < 0) {
+		perror("fork");
+	}
 
-			// 파이프의 write를 닫는다.
-			close(pipefd[1]);
+	return pid;
+}
 
-			// 파이프 입력을 stdin으로 복제
-			if (dup2(pipefd[0], STDIN_FILENO) < 0) {
-				fprintf(stderr, "pipefd duplication error\n");
-				exit(1);
-			}
 
-			// 파이프의 두번째 프로그램 실행
-			if (execvp(pargv[0], pargv) < 0) {
-				fprintf(stderr, "%s: Command not found\n", pargv[0]);
-				exit(1);
-			}
+/*
+ * wait_background
+ *
+ * 종료된 background 프로세스를 모두 wait 한다.
+ */
+void wait_background(void)
+{
+	int status, ret;
+
+	do {
+		ret = wait_cmd(-1, &status, WNOHANG);
+		if (ret > 0) {
+			printf("PID %d is terminated.\n", ret);
+			job_remove(ret);
 		}
+	} while (ret > 0);
+}
 
-		// 파이프의 첫번째 프로그램을 위한 파이프 설정
-		if (pipe_flag == 1) {
-			// 파이프의 read를 닫는다.
-			close(pipefd[0]);
 
-			// 파이프 출력을 stdout으로 복제
-			if (dup2(pipefd[1], STDOUT_FILENO) < 0) {
-				fprintf(stderr, "pipefd duplication error\n");
-				exit(1);
+/*
+ * wait_cmd
+ *
+ * waitpid 와 같다. server mode 에서는 자식이 zygote 의 자식이므로
+ * zygote 가 보낸 종료 상태를 기다린다.
+ */
+pid_t wait_cmd(pid_t pid, int *status, int options)
+{
+	struct zy_reply rep;
+	int i, n;
+
+	if (zygote_fd < 0) {
+		return waitpid(pid, status, options);
+	}
+
+	// fork_builtin 으로 만든 자식은 셸의 자식이다.
+	i = waitpid(pid, status, options | WNOHANG);
+	if (i > 0) {
+		return i;
+	}
+	if (i == 0 && pid > 0) {
+		return waitpid(pid, status, options);
+	}
+
+	while (1) {
+		for (i = 0; i < zy_nexits; i++) {
+			if (pid == -1 || zy_exits[i].pid == pid) {
+				*status = zy_exits[i].status;
+				pid = zy_exits[i].pid;
+				zy_exits[i] = zy_exits[--zy_nexits];
+				return pid;
 			}
 		}
 
-		// 프로그램 실행
-		if (execvp(argv[0], argv) < 0) {
-			fprintf(stderr, "%s: Command not found\n", argv[0]);
-			exit(1);
+		n = recv(zygote_fd, &rep, sizeof(rep),
+				 (options & WNOHANG) ? MSG_DONTWAIT : 0);
+		if (n < 0 && errno == EINTR) {
+			continue;
 		}
+		if (n < 0 && errno == EAGAIN) {
+			return 0;
+		}
+		if (n != sizeof(rep)) {
+			// zygote 가 종료됨: 이후에는 직접 실행한다.
+			fprintf(stderr, "zygote lost\n");
+			close(zygote_fd);
+			zygote_fd = -1;
+			errno = ECHILD;
+			return -1;
+		}
+		if (rep.type == ZY_EXITED) {
+			zygote_save_exit(&rep);
+		}
+	}
+}
+
+
+/*
+ * spawn_cmd
+ *
+ * posix_spawn 으로 argv 프로그램을 실행하고 pid 를 리턴한다.
+ * in_fd/out_fd 가 -1 이 아니면 자식의 stdin/stdout 으로 연결한다. (파이프)
+ * redirection 은 file action 으로 자식에서만 적용되므로
+ * 셸의 fd 는 변경되지 않는다.
+ * 실패하면 에러 메시지를 출력하고 -1 을 리턴한다.
+ */
+pid_t spawn_cmd(char **argv, int in_fd, int out_fd,
+				struct redirect *rd, int nrd)
+{
+	struct spawn_args sa = { argv, in_fd, out_fd, nrd, rd, -1 };
+	pthread_t tid;
+
+	// server mode 에서는 zygote 가 실행한다.
+	if (zygote_fd >= 0) {
+		return zygote_spawn(argv, in_fd, out_fd, rd, nrd);
 	}
 
+	if (!cmd_place.set) {
+		return spawn_direct(argv, in_fd, out_fd, rd, nrd);
+	}
 
-	/*
-	 * 부모 프로세스 (Parent process)
-	 */
-	// 외부 명령 pipe_flag가 설정되어 있으면, 
-	// 새로운 자식 프로세스를 하나 더 생성하여 파이프로 연결한다.
-	if (pipe_flag == 1) {
-		// 부모에서 duplication 한 stdout fd를 복구
-		dup2(saved_stdout, STDOUT_FILENO);
+	// 실행 위치를 지정하면 그 위치를 적용한 스레드에서 실행한다.
+	// 자식은 스레드의 CPU 집합, nice, ionice, 메모리 정책을 물려받으며
+	// 셸 자신의 설정은 바뀌지 않는다.
+	if (pthread_create(&tid, NULL, spawn_placed_thr_fn, &sa) != 0) {
+		fprintf(stderr, "%s: thread creation error\n", argv[0]);
+		return -1;
+	}
+	pthread_join(tid, NULL);
 
-		// 새로운 자식 프로세스 생성
-		if ((pipe_pid = fork()) < 0) {
-			fprintf(stderr, "fork error\n");
-			exit(1);
-		}	
+	return sa.pid;
+}
 
-		// 자식 프로세스
-		// 파이프의 파이프의 두번째 프로그램
-		if (pipe_pid == 0) {
-			// 파이프의 write를 닫는다.
-			close(pipefd[1]);
 
-			// 파이프 입력을 stdin으로 복제
-			if (dup2(pipefd[0], STDIN_FILENO) < 0) {
-				fprintf(stderr, "pipefd duplication error\n");
-				exit(1);
-			}	
+void *spawn_placed_thr_fn(void *arg)
+{
+	struct spawn_args *sa = arg;
+
+	if (place_apply(&cmd_place) == 0) {
+		sa->pid = spawn_direct(sa->argv, sa->in_fd, sa->out_fd,
+							   sa->rd, sa->nrd);
+	}
+	return NULL;
+}
+
+
+/*
+ * spawn_direct
+ *
+ * spawn_cmd 의 실제 실행 부분. (현재 스레드에서 posix_spawn)
+ */
+pid_t spawn_direct(char **argv, int in_fd, int out_fd,
+				   struct redirect *rd, int nrd)
+{
+	posix_spawn_file_actions_t fa;
+	posix_spawnattr_t attr;
+	sigset_t sigdef;
+	sigset_t sigmask;
+	int herefd[2] = { -1, -1 };
+	int i, len, ret, flags;
+	pid_t pid;
+
+	posix_spawn_file_actions_init(&fa);
+	posix_spawnattr_init(&attr);
+
+	// 셸이 무시하는 SIGPIPE, SIGINT (watch 실행 중) 를 자식에서는 기본 동작으로
+	// 되돌리고, (zygote 가 막아 둔 SIGCHLD 등) signal mask 를 비운다.
+	sigemptyset(&sigdef);
+	sigaddset(&sigdef, SIGPIPE);
+	sigaddset(&sigdef, SIGINT);
+	sigemptyset(&sigmask);
+	posix_spawnattr_setsigdefault(&attr, &sigdef);
+	posix_spawnattr_setsigmask(&attr, &sigmask);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+
+	// 파이프 연결
+	if (in_fd >= 0) {
+		posix_spawn_file_actions_adddup2(&fa, in_fd, STDIN_FILENO);
+	}
+	if (out_fd >= 0) {
+		posix_spawn_file_actions_adddup2(&fa, out_fd, STDOUT_FILENO);
+	}
+
+	// redirection 을 순서대로 적용
+	for (i = 0; i < nrd; i++) {
+		if (rd[i].type != RD_DUP && rd[i].target == NULL) {
+			fprintf(stderr, "redirection target missing\n");
+			ret = -1;
+			goto out;
+		}
 
-			// 파이프의 두번째 프로그램 실행
-			if (execvp(pargv[0], pargv) < 0) {
-				fprintf(stderr, "%s: Command not found\n", pargv[0]);
-				exit(1);
+		switch (rd[i].type) {
+		case RD_IN:
+			// 파일이 없으면 "Command not found" 와 구분하기 위해 미리 검사
+			if (access(rd[i].target, R_OK) < 0) {
+				fprintf(stderr, "%s: %s\n", rd[i].target, strerror(errno));
+				ret = -1;
+				goto out;
+			}
+			posix_spawn_file_actions_addopen(&fa, rd[i].fd, rd[i].target,
+					O_RDONLY, 0);
+			break;
+		case RD_OUT:
+		case RD_APPEND:
+			flags = O_WRONLY | O_CREAT |
+				((rd[i].type == RD_APPEND) ? O_APPEND : O_TRUNC);
+			posix_spawn_file_actions_addopen(&fa, rd[i].fd, rd[i].target,
+					flags, DEFAULT_FILE_MODE);
+			break;
+		case RD_DUP:
+			posix_spawn_file_actions_adddup2(&fa, rd[i].src_fd, rd[i].fd);
+			break;
+		case RD_HERESTR:
+			// here-string 은 MAXLINE 보다 짧으므로 파이프 버퍼에 모두 들어간다.
+			if (herefd[0] >= 0) {
+				close(herefd[0]);
+			}
+			if (pipe2(herefd, O_CLOEXEC) < 0) {
+				fprintf(stderr, "pipe error\n");
+				ret = -1;
+				goto out;
 			}
-		}	// 두번째 자식 프로세스 (파이프)
+			len = strlen(rd[i].target);
+			if (write(herefd[1], rd[i].target, len) != len ||
+				write(herefd[1], "\n", 1) != 1) {
+				fprintf(stderr, "here-string write error\n");
+			}
+			close(herefd[1]);
+			posix_spawn_file_actions_adddup2(&fa, herefd[0], rd[i].fd);
+			break;
+		}
 	}
 
+	ret = posix_spawnp(&pid, argv[0], &fa, &attr, argv, environ);
+	if (ret == ENOENT) {
+		fprintf(stderr, "%s: Command not found\n", argv[0]);
+	} else if (ret != 0) {
+		fprintf(stderr, "%s: %s\n", argv[0], strerror(ret));
+	}
 
-	// myshell 부모 프로세스는 파이프를 닫는다.
-	if (pipe_flag) {
-		close(pipefd[0]);
-		close(pipefd[1]);
+out:
+	if (herefd[0] >= 0) {
+		close(herefd[0]);
 	}
+	posix_spawn_file_actions_destroy(&fa);
+	posix_spawnattr_destroy(&attr);
+
+	return (ret == 0) ? pid : -1;
+}
+
+
+/*
+ * open_builtin_io
+ *
+ * 내장 명령을 위한 sh_in/sh_out/sh_err 스트림을 준비한다.
+ * in_fd/out_fd 가 -1 이 아니면 파이프로 사용하며, 소유권을 넘겨받는다.
+ * redirection 파일은 O_CLOEXEC 로 열어 이후 실행되는 자식에 상속되지 않는다.
+ * 실패하면 열었던 fd 를 모두 닫고 1 을 리턴한다.
+ */
+int open_builtin_io(struct redirect *rd, int nrd, int in_fd, int out_fd)
+{
+	int fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+	int owned[MAXREDIR + 5], nowned = 0;
+	int i, j, k, fd, flags, herefd[2], closed = -1;
+	FILE *out, *err;
 
-	// redirection 되었던 stdout fd를 복구
-	if (rd_flag || pipe_flag) {
-		dup2(saved_stdout, STDOUT_FILENO);
+	if (in_fd >= 0) {
+		fds[0] = owned[nowned++] = in_fd;
+	}
+	if (out_fd >= 0) {
+		fds[1] = owned[nowned++] = out_fd;
 	}
 
-	// foreground 실행이면 자식 프로세스가 종료할 때까지 기다린다.
-	if (!bg_flag) {
-		ret = waitpid(pid, &status, 0);
-		if (ret < 0) {
-			fprintf(stderr, "wait error\n");
-			return;
+	for (i = 0; i < nrd; i++) {
+		if (rd[i].type != RD_DUP && rd[i].target == NULL) {
+			fprintf(stderr, "redirection target missing\n");
+			goto error;
 		}
 
-		// 외부 명령 파이프 실행이면 두번째 자식 프로세스를 기다린다.
-		if (pipe_flag == 1) {
-			ret = waitpid(pipe_pid, &status, 0);
-			if (ret < 0) {
-				fprintf(stderr, "wait error (pipe)\n");
-				return;
+		switch (rd[i].type) {
+		case RD_IN:
+			fd = open(rd[i].target, O_RDONLY | O_CLOEXEC);
+			break;
+		case RD_OUT:
+		case RD_APPEND:
+			flags = O_WRONLY | O_CREAT | O_CLOEXEC |
+				((rd[i].type == RD_APPEND) ? O_APPEND : O_TRUNC);
+			fd = open(rd[i].target, flags, DEFAULT_FILE_MODE);
+			break;
+		case RD_DUP:
+			fds[rd[i].fd] = fds[rd[i].src_fd];
+			continue;
+		case RD_HERESTR:
+			if (pipe2(herefd, O_CLOEXEC) < 0) {
+				fd = -1;
+				break;
 			}
+			dprintf(herefd[1], "%s\n", rd[i].target);
+			close(herefd[1]);
+			fd = herefd[0];
+			break;
+		default:
+			continue;
 		}
-	} else {
-		printf("[bg] %d : %s\n", pid, cmdline);
-    }
-#endif	// HW_STAGE1
 
-	// 종료된 background 프로세스를 wait하고 리턴한다.
-	do {
-		ret = waitpid(-1, &status, WNOHANG);
-		if (ret > 0) {
-			printf("PID %d is terminated.\n", ret);
+		if (fd < 0) {
+			fprintf(stderr, "%s: %s\n", rd[i].target, strerror(errno));
+			goto error;
 		}
-	} while (ret > 0);
+		fds[rd[i].fd] = owned[nowned++] = fd;
+	}
 
-	return;
+	// 스트림과 sh_in 은 끝날 때 fd 를 닫으므로, 셸의 다른 표준 fd 를
+	// 가리키면 (1>&0, 0>&1 등) 복제해서 사용한다. sh_in 이 출력 스트림과
+	// 같은 fd 이어도 복제한다.
+	for (j = 2; j >= 0; j--) {
+		for (i = 0; i < nowned && owned[i] != fds[j]; i++)
+			;
+		if (j > 0 ? (fds[j] == STDOUT_FILENO || fds[j] == STDERR_FILENO ||
+					 i < nowned) :
+			(fds[0] == STDIN_FILENO ||
+			 (i < nowned && fds[0] != fds[1] && fds[0] != fds[2]))) {
+			continue;
+		}
+		fd = fcntl(fds[j], F_DUPFD_CLOEXEC, 3);
+		if (fd < 0) {
+			fprintf(stderr, "dup: %s\n", strerror(errno));
+			goto error;
+		}
+		owned[nowned++] = fd;
+		// 2>&1 처럼 같은 fd 인 stdout 은 같은 복제본을 공유한다.
+		for (k = 1; k < j; k++) {
+			if (fds[k] == fds[j]) {
+				fds[k] = fd;
+			}
+		}
+		fds[j] = fd;
+	}
+
+	// fd 를 스트림으로 변환 (같은 fd 는 같은 스트림을 공유)
+	out = (fds[1] == STDOUT_FILENO) ? stdout :
+		  (fds[1] == STDERR_FILENO) ? stderr : fdopen(fds[1], "w");
+	if (fds[2] == fds[1]) {
+		err = out;
+	} else {
+		err = (fds[2] == STDERR_FILENO) ? stderr :
+			  (fds[2] == STDOUT_FILENO) ? stdout : fdopen(fds[2], "w");
+	}
+	if (out == NULL || err == NULL) {
+		fprintf(stderr, "fdopen: %s\n", strerror(errno));
+		// 이미 만든 스트림은 fclose 가 fd 를 닫는다.
+		if (out != NULL && out != stdout && out != stderr) {
+			fclose(out);
+			closed = fds[1];
+		}
+		if (err != NULL && err != stdout && err != stderr) {
+			fclose(err);
+			closed = fds[2];
+		}
+		for (i = 0; i < nowned; i++) {
+			if (owned[i] != closed) {
+				close(owned[i]);
+			}
+		}
+		return 1;
+	}
+	sh_in = fds[0];
+	sh_out = out;
+	sh_err = err;
+
+	// 스트림이 소유하지 않는 fd 는 닫는다. (덮어쓴 redirection 등)
+	for (i = 0; i < nowned; i++) {
+		for (j = 0; j < 3; j++) {
+			if (owned[i] == fds[j]) {
+				break;
+			}
+		}
+		if (j == 3) {
+			close(owned[i]);
+		}
+	}
+
+	return 0;
+
+error:
+	for (i = 0; i < nowned; i++) {
+		close(owned[i]);
+	}
+	return 1;
+}
+
+
+/*
+ * close_builtin_io
+ *
+ * open_builtin_io 로 준비한 스트림을 닫고 기본 스트림으로 되돌린다.
+ */
+void close_builtin_io(void)
+{
+	fflush(sh_out);
+	fflush(sh_err);
+
+	if (sh_err != stdout && sh_err != stderr && sh_err != sh_out) {
+		fclose(sh_err);
+	}
+	if (sh_out != stdout && sh_out != stderr) {
+		fclose(sh_out);
+	}
+	if (sh_in != STDIN_FILENO) {
+		close(sh_in);
+	}
+
+	sh_in = STDIN_FILENO;
+	sh_out = stdout;
+	sh_err = stderr;
 }
 
 
@@ -333,20 +1643,26 @@ void process_cmd(char *cmdline)
  * 명령 라인을 인자(argument) 배열로 변환한다.
  * 인자의 개수(argc)를 리턴한다.
  * 파이프와 백그라운드 실행을 해석하고 flag와 관련 변수를 설정한다.
+ * redirection 은 명령별로 rd_list 에 순서대로 기록한다.
+ * redirection 이 너무 많으면 에러 메시지를 출력하고 0 을 리턴한다.
  */
 int parse_line(char *cmdline, char **argv)
 {
-	int argc, targc = 0;
+	int argc, targc = 0, cmd = 0;
 	char *tok, **targv;
+	struct redirect *rd;
 
-	// background, pipe, redirection flag를 초기화
-	bg_flag = pipe_flag = rd_flag = 0;
+	// background, pipe flag와 redirection 목록을 초기화
+	bg_flag = pipe_flag = 0;
+	rd_count[0] = rd_count[1] = 0;
 
 	targv = argv;	// 인자 배열 임시 포인터
 	tok = strtok(cmdline, delim);
 	targv[targc] = tok;
 
 	while (tok) {
+		rd = &rd_list[cmd][rd_count[cmd]];
+
 		// pipe flag 검사 (중복된 파이프 허용 안됨)
 		if (!pipe_flag && (!strcmp(targv[targc], "|"))) {
 			targv[targc] = NULL;
@@ -354,13 +1670,33 @@ int parse_line(char *cmdline, char **argv)
 			argc = targc;		// 첫번째 명령의 인자 개수 결정
 			targc = -1;
 			targv = pargv;		// 두번째 명령을 위한 인자 배열
-		} 
-		// redirection flag 검사, 파일 이름 획득하고 종료
-		else if (!strcmp(targv[targc], ">")) {
-			rd_flag = 1;
-			rd_filename = strtok(NULL, delim);
-			if (!rd_filename) {
-				return targc;
+			cmd = 1;
+		}
+		// redirection 검사, 파일 이름 획득 (&> 를 위해 한 칸을 남겨 둔다)
+		else if (parse_redirect(targv[targc], rd)) {
+			if (rd_count[cmd] >= MAXREDIR - 1) {
+				fprintf(stderr, "too many redirections\n");
+				last_status = 1;
+				pipe_flag = 0;
+				argv[0] = NULL;
+				return 0;
+			}
+			if (rd->type != RD_DUP && rd->target == NULL) {
+				rd->target = strtok(NULL, delim);
+			}
+			// &> 는 stdout 과 stderr 두 개의 redirection 으로 기록
+			if (rd->fd == -1) {
+				rd->fd = STDOUT_FILENO;
+				rd[1].type = RD_DUP;
+				rd[1].fd = STDERR_FILENO;
+				rd[1].src_fd = STDOUT_FILENO;
+				rd[1].target = NULL;
+				rd_count[cmd]++;
+			}
+			rd_count[cmd]++;
+			if (rd->type != RD_DUP && !rd->target) {
+				targv[targc] = NULL;
+				break;
 			}
 			targv[targc--] = NULL;
 		}
@@ -372,6 +1708,10 @@ int parse_line(char *cmdline, char **argv)
 		}
 
 		tok = strtok(NULL, delim);
+		if (targc >= MAXARGS - 2) {
+			fprintf(stderr, "too many arguments\n");
+			tok = NULL;
+		}
 		targv[++targc] = tok;
 	}
 
@@ -389,582 +1729,9163 @@ int parse_line(char *cmdline, char **argv)
 
 
 /*
- * builtin_cmd
+ * parse_redirect
  *
- * 내장 명령을 수행한다.
- * 내장 명령이 아니면 1을 리턴한다.
+ * 토큰이 redirection 연산자이면 rd 를 채우고 1 을 리턴한다.
+ * "2>err" 처럼 대상이 붙어 있으면 target 에 설정하고,
+ * 아니면 target 은 NULL 이며 호출한 쪽이 다음 토큰을 사용한다.
+ * "&>" 는 fd 를 -1 로 표시한다.
  */
-int builtin_cmd(int argc, char **argv)
+int parse_redirect(char *tok, struct redirect *rd)
 {
-	char *cmd = argv[0];
+	char *p = tok;
+	int fd = -1;
 
-	if ((!strcmp(cmd, "quit") || (!strcmp(cmd, "exit")))) {
-		exit(0);
-	}
+	rd->target = NULL;
+	rd->src_fd = -1;
 
-	if (!strcmp(cmd, "ls")) {
-		list_files(argc, argv);
-		return 0;
+	// here-string
+	if (!strncmp(p, "<<<", 3)) {
+		rd->type = RD_HERESTR;
+		rd->fd = STDIN_FILENO;
+		rd->target = (p[3] != '\0') ? p + 3 : NULL;
+		return 1;
 	}
 
-	if (!strcmp(cmd, "ll")) {
-		list_files(argc, argv);
-		return 0;
+	// &> file
+	if (!strncmp(p, "&>", 2)) {
+		rd->type = RD_OUT;
+		rd->fd = -1;
+		rd->target = (p[2] != '\0') ? p + 2 : NULL;
+		return 1;
 	}
 
-	if (!strcmp(cmd, "cp")) {
-		copy_file(argc, argv);
-		return 0;
+	// 선택적인 fd 번호 (0, 1, 2)
+	if (p[0] >= '0' && p[0] <= '2' && (p[1] == '<' || p[1] == '>')) {
+		fd = p[0] - '0';
+		p++;
 	}
 
-	if (!strcmp(cmd, "rm")) {
-		remove_file(argc, argv);
+	if (p[0] == '<') {
+		rd->type = RD_IN;
+		rd->fd = (fd < 0) ? STDIN_FILENO : fd;
+		p++;
+	} else if (p[0] == '>' && p[1] == '>') {
+		rd->type = RD_APPEND;
+		rd->fd = (fd < 0) ? STDOUT_FILENO : fd;
+		p += 2;
+	} else if (p[0] == '>') {
+		rd->type = RD_OUT;
+		rd->fd = (fd < 0) ? STDOUT_FILENO : fd;
+		p++;
+	} else {
 		return 0;
 	}
 
-	if (!strcmp(cmd, "mv")) {
-		move_file(argc, argv);
-		return 0;
+	// [n]>&m
+	if (rd->type == RD_OUT && p[0] == '&' &&
+		p[1] >= '0' && p[1] <= '2' && p[2] == '\0') {
+		rd->type = RD_DUP;
+		rd->src_fd = p[1] - '0';
+		return 1;
 	}
 
-	if (!strcmp(cmd, "cd")) {
-		change_directory(argc, argv);
-		return 0;
-	}
+	rd->target = (p[0] != '\0') ? p : NULL;
+	return 1;
+}
 
-	if (!strcmp(cmd, "pwd")) {
-		print_working_directory();
-		return 0;
-	}
 
-	if (!strcmp(cmd, "mkdir")) {
-		make_directory(argc, argv);
-		return 0;
-	}
+/*
+ * subst_line
+ *
+ * 명령 라인의 명령 치환 $(...) 을 차례로 실행하고, 출력을 subst_out 에
+ * 저장한 뒤 그 자리를 표시 (SUBST_MARK 번호 SUBST_MARK) 로 바꾼 새 라인을
+ * 리턴한다. 표시는 공백이 없으므로 한 토큰으로 남고, 인자와 redirection
+ * 대상을 만들 때 subst_args 가 출력으로 바꾼다. (출력은 파이프, & 등으로
+ * 다시 해석하지 않음) 치환이 없으면 line 을 그대로 리턴하고,
+ * 에러이면 NULL 을 리턴한다.
+ */
+char *subst_line(char *line)
+{
+	char *new, *out, *p, *q, *s;
+	int depth, n;
 
-	if (!strcmp(cmd, "rmdir")) {
-		remove_directory(argc, argv);
-		return 0;
+	if (strstr(line, "$(") == NULL) {
+		return line;
 	}
 
-	if (!strcmp(cmd, "dcp")) {
-		copy_directory(argc, argv);
-		return 0;
+	// 안쪽 치환까지 모두 세어서, 하나라도 실행하기 전에 개수를 검사한다.
+	for (p = line, n = 0; (p = strstr(p, "$(")) != NULL; p += 2) {
+		n++;
+	}
+	if (subst_n + n > SUBST_MAX) {
+		fprintf(stderr, "command substitution: too many\n");
+		return NULL;
 	}
 
-	// 내장 명령어가 아님.
-	return 1;
-}
-
+	// 표시 (최대 4 글자) 는 가장 짧은 치환 "$()" 보다 한 글자만 길다.
+	new = cmd_alloc(strlen(line) * 2 + 1);
+	for (p = line, q = new; *p != '\0'; ) {
+		if (p[0] != '$' || p[1] != '(') {
+			*q++ = *p++;
+			continue;
+		}
+
+		// 짝이 맞는 ')' 를 찾는다. (안쪽의 $(...) 은 실행할 때 치환)
+		for (s = p + 2, depth = 1; *s != '\0'; s++) {
+			if (*s == '(') {
+				depth++;
+			} else if (*s == ')' && --depth == 0) {
+				break;
+			}
+		}
+		if (*s == '\0') {
+			fprintf(stderr, "command substitution: missing ')'\n");
+			return NULL;
+		}
+
+		// 안쪽 치환이 subst_n 을 먼저 사용하므로 실행한 뒤에 번호를 정한다.
+		out = subst_run(cmd_strdup(p + 2, s - p - 2));
+		if (out == NULL) {
+			return NULL;
+		}
+		subst_out[subst_n] = out;
+		q += sprintf(q, "%c%d%c", SUBST_MARK, subst_n++, SUBST_MARK);
+		p = s + 1;
+	}
+	*q = '\0';
+
+	return new;
+}
+
+
+/*
+ * subst_run
+ *
+ * 명령 치환 하나를 실행하고 출력 (끝의 '\n' 은 제거) 을 리턴한다.
+ * 파이프와 redirection 을 사용할 수 있으며, 각 명령의 출력을 memfd 에 받아
+ * 다음 명령의 입력으로 넘긴다. 내장 명령은 fork 없이 셸에서 실행한다.
+ * 바깥 명령 라인의 해석 결과 (파이프, redirection) 는 보관했다가 되돌린다.
+ */
+char *subst_run(char *cmd)
+{
+	struct redirect saved_rd[2][MAXREDIR];
+	char *saved_pargv[MAXARGS], *targv[MAXARGS], **argv, **pipe_argv;
+	char *line, *out = NULL;
+	int saved_count[2], saved_bg = bg_flag, saved_pipe = pipe_flag;
+	int argc, mfd, in_fd;
+	struct stat st;
+
+	memcpy(saved_rd, rd_list, sizeof(rd_list));
+	memcpy(saved_count, rd_count, sizeof(rd_count));
+	memcpy(saved_pargv, pargv, sizeof(pargv));
+
+	// 안쪽의 치환을 먼저 실행한다.
+	line = subst_line(cmd);
+	if (line == NULL) {
+		goto out;
+	}
+	argc = parse_line(line, targv);
+	if (argc == 0) {
+		out = cmd_strdup("", 0);
+		goto out;
+	}
+	argv = subst_args(targv, &argc);
+	if (argc == 0 || subst_targets(rd_list[0], rd_count[0]) < 0 ||
+		subst_targets(rd_list[1], rd_count[1]) < 0) {
+		out = (argc == 0) ? cmd_strdup("", 0) : NULL;
+		goto out;
+	}
+	argv = expand_args(argv, &argc);
+
+	mfd = subst_exec(argc, argv, rd_list[0], rd_count[0], -1);
+	if (pipe_flag && mfd >= 0) {
+		pipe_argv = expand_args(subst_args(pargv, &argc), &argc);
+		in_fd = mfd;
+		mfd = (argc > 0) ? subst_exec(argc, pipe_argv, rd_list[1],
+									  rd_count[1], in_fd) : -1;
+		close(in_fd);
+	}
+	if (mfd < 0) {
+		goto out;
+	}
+
+	// 출력을 읽어 끝의 '\n' 을 지운다.
+	if (fstat(mfd, &st) == 0) {
+		out = cmd_alloc(st.st_size + 1);
+		st.st_size = pread(mfd, out, st.st_size, 0);
+		if (st.st_size < 0) {
+			st.st_size = 0;
+		}
+		while (st.st_size > 0 && out[st.st_size - 1] == '\n') {
+			st.st_size--;
+		}
+		out[st.st_size] = '\0';
+	}
+	close(mfd);
+
+out:
+	memcpy(rd_list, saved_rd, sizeof(rd_list));
+	memcpy(rd_count, saved_count, sizeof(rd_count));
+	memcpy(pargv, saved_pargv, sizeof(pargv));
+	bg_flag = saved_bg;
+	pipe_flag = saved_pipe;
+
+	return out;
+}
+
+
+/*
+ * subst_exec
+ *
+ * 명령 하나를 실행하여 표준 출력을 새 memfd 에 받고 memfd 를 리턴한다.
+ * in_fd 가 -1 이 아니면 처음부터 표준 입력으로 사용한다. (닫지 않음)
+ * 내장 명령은 셸에서 sh_in/sh_out 을 바꾸어 실행하고 (fork 없음),
+ * 외부 명령은 spawn_cmd 로 실행하여 끝날 때까지 기다린다.
+ * cd, quit 처럼 셸의 상태를 바꾸는 내장 명령 (subst_fork_builtins) 은
+ * 셸에 영향이 없도록 fork 한 자식에서 실행한다.
+ * memfd 는 일반 파일처럼 쓰기가 막히지 않으므로 출력 크기에 제한이 없다.
+ * 명령을 실행하지 못하면 에러를 출력하고 -1 을 리턴한다.
+ */
+int subst_exec(int argc, char **argv, struct redirect *rd, int nrd, int in_fd)
+{
+	FILE *saved_out = sh_out, *saved_err = sh_err;
+	int saved_in = sh_in, mfd, fd, in = -1, status, i;
+	pid_t pid;
+
+	for (i = 0; subst_fork_builtins[i] != NULL; i++) {
+		if (!strcmp(argv[0], subst_fork_builtins[i])) {
+			break;
+		}
+	}
+
+	mfd = memfd_create("subst", MFD_CLOEXEC);
+	if (mfd < 0 || (in_fd >= 0 && lseek(in_fd, 0, SEEK_SET) < 0)) {
+		fprintf(stderr, "command substitution: %s\n", strerror(errno));
+		if (mfd >= 0) {
+			close(mfd);
+		}
+		return -1;
+	}
+
+	if (subst_fork_builtins[i] != NULL) {
+		fflush(stdout);
+		fflush(stderr);
+		pid = fork();
+		if (pid == 0) {
+			signal(SIGPIPE, SIG_DFL);
+			if (open_builtin_io(rd, nrd, (in_fd >= 0) ? dup(in_fd) : -1,
+								dup(mfd)) != 0) {
+				_exit(1);
+			}
+			builtin_cmd(argc, argv);
+			close_builtin_io();
+			_exit(last_status);
+		}
+		if (pid < 0) {
+			perror("fork");
+			close(mfd);
+			return -1;
+		}
+		wait_cmd(pid, &status, 0);
+	} else if (find_builtin(argv[0]) != NULL) {
+		fd = dup(mfd);
+		if (in_fd >= 0) {
+			in = dup(in_fd);
+		}
+		if (fd < 0 || (in_fd >= 0 && in < 0)) {
+			fprintf(stderr, "command substitution: %s\n", strerror(errno));
+			if (fd >= 0) {
+				close(fd);
+			}
+			if (in >= 0) {
+				close(in);
+			}
+			close(mfd);
+			return -1;
+		}
+		if (open_builtin_io(rd, nrd, in, fd) == 0) {
+			builtin_cmd(argc, argv);
+			close_builtin_io();
+		}
+		sh_in = saved_in;
+		sh_out = saved_out;
+		sh_err = saved_err;
+	} else {
+		// spawn_cmd 가 실패 이유를 출력한다.
+		pid = spawn_cmd(argv, in_fd, mfd, rd, nrd);
+		if (pid <= 0) {
+			close(mfd);
+			return -1;
+		}
+		wait_cmd(pid, &status, 0);
+	}
+
+	return mfd;
+}
+
+
+/*
+ * subst_args
+ *
+ * 인자의 치환 표시를 출력으로 바꾼다. 출력은 공백 문자 (delim) 로 나누어
+ * 여러 인자가 되며, 앞뒤의 글자는 첫/마지막 단어에 붙는다. 출력이 비고
+ * 다른 글자도 없으면 인자가 없어진다.
+ * 표시가 없으면 argv 를 그대로 리턴하고, 있으면 새 인자 배열을 리턴한다.
+ * argc 가 NULL 이 아니면 새 인자 개수를 설정한다.
+ */
+char **subst_args(char **argv, int *argc)
+{
+	struct arglist al = { NULL, 0, 0 };
+	char *p, *o, *word, *w;
+	size_t len;
+	int i, n, in_word;
+
+	for (i = 0; argv[i] != NULL; i++) {
+		if (strchr(argv[i], SUBST_MARK) != NULL) {
+			break;
+		}
+	}
+	if (argv[i] == NULL) {
+		if (argc != NULL) {
+			*argc = i;
+		}
+		return argv;
+	}
+
+	for (i = 0; argv[i] != NULL; i++) {
+		if (strchr(argv[i], SUBST_MARK) == NULL) {
+			arglist_add(&al, argv[i]);
+			continue;
+		}
+
+		// 단어들을 한 버퍼에 이어서 만든다. (단어마다 '\0' 이 하나씩)
+		len = strlen(argv[i]) + 1;
+		for (p = argv[i]; (p = strchr(p, SUBST_MARK)) != NULL; p++) {
+			n = atoi(++p);
+			p = strchr(p, SUBST_MARK);
+			len += strlen(subst_out[n]) + 1;
+		}
+		word = w = cmd_alloc(len);
+		in_word = 0;
+		for (p = argv[i]; *p != '\0'; p++) {
+			if (*p != SUBST_MARK) {
+				*w++ = *p;
+				in_word = 1;
+				continue;
+			}
+			n = atoi(++p);
+			p = strchr(p, SUBST_MARK);
+			for (o = subst_out[n]; *o != '\0'; o++) {
+				if (strchr(delim, *o) == NULL) {
+					*w++ = *o;
+					in_word = 1;
+				} else if (in_word) {
+					*w++ = '\0';
+					arglist_add(&al, word);
+					word = w;
+					in_word = 0;
+				}
+			}
+		}
+		if (in_word) {
+			*w = '\0';
+			arglist_add(&al, word);
+		}
+	}
+
+	if (argc != NULL) {
+		*argc = al.argc;
+	}
+	if (al.argv == NULL) {
+		// 모든 인자가 없어짐
+		al.argv = cmd_alloc(sizeof(char *));
+		al.argv[0] = NULL;
+	}
+	return al.argv;
+}
+
+
+/*
+ * subst_targets
+ *
+ * redirection 대상의 치환 표시를 출력으로 바꾼다.
+ * 출력이 한 단어가 아니면 에러를 출력하고 -1 을 리턴한다.
+ */
+int subst_targets(struct redirect *rd, int nrd)
+{
+	char *targv[2], **words;
+	int i, n;
+
+	for (i = 0; i < nrd; i++) {
+		if (rd[i].target == NULL || strchr(rd[i].target, SUBST_MARK) == NULL) {
+			continue;
+		}
+		targv[0] = rd[i].target;
+		targv[1] = NULL;
+		words = subst_args(targv, &n);
+		if (n != 1) {
+			fprintf(stderr, "command substitution: ambiguous redirect\n");
+			return -1;
+		}
+		rd[i].target = words[0];
+	}
+
+	return 0;
+}
+
+
+/*
+ * cmd_alloc
+ *
+ * 명령 하나를 처리하는 동안 사용하는 메모리를 할당한다. (wildcard 확장 결과 등)
+ * 블록 단위로 할당하여 다음 명령을 시작할 때 cmd_mem_reset 으로 한번에 해제한다.
+ */
+void *cmd_alloc(size_t size)
+{
+	struct mem_block *bp;
+	size_t bsize;
+	void *ptr;
+
+	size = (size + 15) & ~(size_t)15;
+
+	if (cmd_mem == NULL || cmd_mem->used + size > cmd_mem->size) {
+		bsize = (size > MEM_BLOCK_SIZE) ? size : MEM_BLOCK_SIZE;
+		bp = malloc(sizeof(*bp) + bsize);
+		if (bp == NULL) {
+			myshell_error("out of memory");
+		}
+		bp->size = bsize;
+		bp->used = 0;
+		bp->next = cmd_mem;
+		cmd_mem = bp;
+	}
+
+	ptr = cmd_mem->data + cmd_mem->used;
+	cmd_mem->used += size;
+
+	return ptr;
+}
+
+
+char *cmd_strdup(const char *str, size_t len)
+{
+	char *p = cmd_alloc(len + 1);
+
+	memcpy(p, str, len);
+	p[len] = '\0';
+	return p;
+}
+
+
+void cmd_mem_reset(void)
+{
+	struct mem_block *bp;
+
+	while (cmd_mem != NULL) {
+		bp = cmd_mem;
+		cmd_mem = bp->next;
+		free(bp);
+	}
+}
+
+
+/*
+ * arglist_add
+ *
+ * 인자 목록 끝에 문자열을 추가한다. 배열이 가득 차면 두 배 크기로 늘린다.
+ */
+void arglist_add(struct arglist *al, char *arg)
+{
+	char **nv;
+
+	if (al->argc + 1 >= al->cap) {
+		al->cap = (al->cap == 0) ? MAXARGS : al->cap * 2;
+		nv = cmd_alloc(sizeof(char *) * al->cap);
+		if (al->argc > 0) {
+			memcpy(nv, al->argv, sizeof(char *) * al->argc);
+		}
+		al->argv = nv;
+	}
+	al->argv[al->argc++] = arg;
+	al->argv[al->argc] = NULL;
+}
+
+
+/*
+ * expand_args
+ *
+ * argv 의 각 인자에 wildcard 가 있으면 일치하는 경로 목록으로 바꾼다.
+ * 일치하는 경로가 없으면 인자를 그대로 둔다.
+ * wildcard 가 없으면 argv 를 그대로 리턴하고, 있으면 새 인자 배열을 리턴한다.
+ * argc 가 NULL 이 아니면 새 인자 개수를 설정한다.
+ * 명령 이름과 search 의 패턴 (expand_skip_arg) 은 확장하지 않는다.
+ */
+char **expand_args(char **argv, int *argc)
+{
+	struct arglist al = { NULL, 0, 0 };
+	int i, n, skip;
+
+	for (i = 0; argv[i] != NULL; i++) {
+		if (strpbrk(argv[i], "*?[") != NULL) {
+			break;
+		}
+	}
+	if (argv[i] == NULL) {
+		return argv;
+	}
+
+	skip = expand_skip_arg(argv);
+	for (i = 0; argv[i] != NULL; i++) {
+		n = al.argc;
+		if (i > 0 && i != skip && strpbrk(argv[i], "*?[") != NULL) {
+			glob_expand(argv[i], &al);
+		}
+		if (al.argc == n) {
+			arglist_add(&al, argv[i]);
+		}
+	}
+
+	if (argc != NULL) {
+		*argc = al.argc;
+	}
+	return al.argv;
+}
+
+
+/*
+ * expand_skip_arg
+ *
+ * wildcard 확장을 하지 않을 인자의 위치를 리턴한다. (없으면 -1)
+ * search 의 패턴은 정규식이므로 (a[bx]c, fo*) 파일 이름으로 바꾸지 않는다.
+ * 옵션은 search_cmd 와 같이 건너뛴다.
+ */
+int expand_skip_arg(char **argv)
+{
+	int i;
+
+	if (strcmp(argv[0], "search")) {
+		return -1;
+	}
+	for (i = 1; argv[i] != NULL && argv[i][0] == '-' && argv[i][1] != '\0';
+		 i++) {
+		if (!strcmp(argv[i], "-j") && argv[i + 1] != NULL) {
+			i++;
+		} else if (strcmp(argv[i], "-F") && strcmp(argv[i], "-n") &&
+				   strcmp(argv[i], "-c") && strcmp(argv[i], "-l")) {
+			break;
+		}
+	}
+	return (argv[i] != NULL) ? i : -1;
+}
+
+
+/*
+ * glob_compile
+ *
+ * 경로 이름의 한 부분 (component) 을 연산 배열로 변환한다.
+ * 일치 검사를 할 때마다 패턴을 해석하지 않도록 [...] 는 256 bit 맵으로 만든다.
+ * 빠른 제외를 위해 앞/뒤의 고정 문자열과 최소 길이를 계산한다.
+ * wildcard 가 없으면 0 을 리턴한다.
+ */
+int glob_compile(char *comp, int len, struct glob_pat *pat)
+{
+	struct glob_op *op;
+	int i, j, k, magic = 0, last_star = -1;
+	unsigned char c;
+
+	pat->nops = 0;
+	pat->min_len = 0;
+	pat->dotok = (comp[0] == '.');
+	pat->recursive = (len == 2 && comp[0] == '*' && comp[1] == '*');
+
+	for (i = 0; i < len && pat->nops < GLOB_MAXOPS; i++) {
+		op = &pat->ops[pat->nops];
+		c = comp[i];
+
+		if (c == '\\' && i + 1 < len) {
+			op->type = GOP_CHAR;
+			op->c = comp[++i];
+		} else if (c == '?') {
+			op->type = GOP_ANY;
+			magic = 1;
+		} else if (c == '*') {
+			// 연속된 * 는 하나로 처리
+			if (pat->nops > 0 && op[-1].type == GOP_STAR) {
+				continue;
+			}
+			op->type = GOP_STAR;
+			last_star = pat->nops;
+			magic = 1;
+		} else if (c == '[' && (j = glob_class_end(comp, i, len)) > 0) {
+			op->type = GOP_CLASS;
+			glob_class_set(comp, i, j, op->cls);
+			i = j;
+			magic = 1;
+		} else {
+			op->type = GOP_CHAR;
+			op->c = c;
+		}
+
+		if (op->type != GOP_STAR) {
+			pat->min_len++;
+		}
+		pat->nops++;
+	}
+
+	// 앞의 고정 문자 개수와 마지막 * 뒤의 고정 문자 개수
+	for (pat->prefix = 0; pat->prefix < pat->nops &&
+		 pat->ops[pat->prefix].type == GOP_CHAR; pat->prefix++)
+		;
+	pat->suffix = 0;
+	if (last_star >= 0) {
+		for (k = pat->nops - 1; k > last_star &&
+			 pat->ops[k].type == GOP_CHAR; k--) {
+			pat->suffix++;
+		}
+		if (k != last_star) {
+			pat->suffix = 0;
+		}
+	}
+
+	return magic;
+}
+
+
+/*
+ * glob_class_end
+ *
+ * comp[start] 의 '[' 에 대응하는 ']' 위치를 리턴한다. 없으면 -1.
+ * "[]...]" 처럼 처음 나오는 ']' 는 문자로 취급한다.
+ */
+int glob_class_end(char *comp, int start, int len)
+{
+	int i = start + 1;
+
+	if (i < len && (comp[i] == '!' || comp[i] == '^')) {
+		i++;
+	}
+	if (i < len && comp[i] == ']') {
+		i++;
+	}
+	for (; i < len; i++) {
+		if (comp[i] == ']') {
+			return i;
+		}
+	}
+	return -1;
+}
+
+
+/*
+ * glob_class_set
+ *
+ * comp[start] 의 '[' 부터 comp[end] 의 ']' 까지의 문자 집합을
+ * 256 bit 맵 cls 로 만든다. '!' 또는 '^' 로 시작하면 여집합이다.
+ */
+void glob_class_set(char *comp, int start, int end, unsigned char *cls)
+{
+	unsigned char c, c2;
+	int k = start + 1, neg;
+
+	memset(cls, 0, 32);
+	neg = (comp[k] == '!' || comp[k] == '^');
+	if (neg) {
+		k++;
+	}
+	for (; k < end; k++) {
+		c = comp[k];
+		if (k + 2 < end && comp[k + 1] == '-') {
+			for (c2 = comp[k + 2]; c <= c2; c++) {
+				cls[c >> 3] |= 1 << (c & 7);
+				if (c == 255) {
+					break;
+				}
+			}
+			k += 2;
+		} else {
+			cls[c >> 3] |= 1 << (c & 7);
+		}
+	}
+	if (neg) {
+		for (k = 0; k < 32; k++) {
+			cls[k] = ~cls[k];
+		}
+	}
+}
+
+
+/*
+ * glob_match
+ *
+ * 컴파일된 패턴과 이름을 비교한다.
+ * 고정 prefix/suffix 와 길이로 먼저 걸러내고, 나머지는 마지막 * 위치로
+ * 되돌아가는 방식으로 비교하므로 백트래킹이 폭발하지 않는다.
+ */
+int glob_match(struct glob_pat *pat, const char *name, int len)
+{
+	struct glob_op *op;
+	int i, j, k, star_i = -1, star_j = 0;
+	unsigned char c;
+
+	// '.' 으로 시작하는 이름은 패턴도 '.' 으로 시작해야 일치
+	if (name[0] == '.' && !pat->dotok) {
+		return 0;
+	}
+	if (len < pat->min_len) {
+		return 0;
+	}
+	for (k = 0; k < pat->prefix; k++) {
+		if ((unsigned char)name[k] != pat->ops[k].c) {
+			return 0;
+		}
+	}
+	for (k = 1; k <= pat->suffix; k++) {
+		if ((unsigned char)name[len - k] != pat->ops[pat->nops - k].c) {
+			return 0;
+		}
+	}
+
+	i = j = 0;
+	while (j < len) {
+		if (i < pat->nops) {
+			op = &pat->ops[i];
+			c = name[j];
+			if (op->type == GOP_STAR) {
+				star_i = i++;
+				star_j = j;
+				continue;
+			}
+			if ((op->type == GOP_CHAR && op->c == c) ||
+				(op->type == GOP_ANY && c != '/') ||
+				(op->type == GOP_CLASS && (op->cls[c >> 3] & (1 << (c & 7))))) {
+				i++;
+				j++;
+				continue;
+			}
+		}
+		if (star_i < 0) {
+			return 0;
+		}
+		i = star_i + 1;
+		j = ++star_j;
+	}
+
+	while (i < pat->nops && pat->ops[i].type == GOP_STAR) {
+		i++;
+	}
+	return (i == pat->nops);
+}
+
+
+/*
+ * glob_expand
+ *
+ * 패턴을 '/' 단위로 나누어 컴파일하고, 일치하는 경로를 정렬하여
+ * al 에 추가한다. 추가한 개수를 리턴한다.
+ */
+int glob_expand(char *pattern, struct arglist *al)
+{
+	struct glob_pat pats[GLOB_MAXCOMP];
+	char *comps[GLOB_MAXCOMP], *p, *slash;
+	int lens[GLOB_MAXCOMP], ncomp = 0, n0 = al->argc;
+	char base[MAXPATH];
+
+	// 절대 경로이면 "/" 부터 시작
+	p = pattern;
+	base[0] = '\0';
+	if (*p == '/') {
+		strcpy(base, "/");
+		while (*p == '/') {
+			p++;
+		}
+	}
+
+	while (*p != '\0') {
+		if (ncomp == GLOB_MAXCOMP) {
+			return 0;
+		}
+		slash = strchr(p, '/');
+		comps[ncomp] = p;
+		lens[ncomp] = slash ? slash - p : (int)strlen(p);
+		if (lens[ncomp] >= GLOB_MAXOPS) {
+			return 0;
+		}
+		pats[ncomp].magic = glob_compile(p, lens[ncomp], &pats[ncomp]);
+		pats[ncomp].comp = comps[ncomp];
+		pats[ncomp].len = lens[ncomp];
+		ncomp++;
+		if (!slash) {
+			break;
+		}
+		for (p = slash; *p == '/'; p++)
+			;
+	}
+	if (ncomp == 0) {
+		return 0;
+	}
+
+	glob_walk(base, strlen(base), pats, ncomp, 0, al);
+
+	// 여러 디렉터리에서 모은 결과는 다시 정렬 (디렉터리 scan 은 이미 정렬됨)
+	if (al->argc - n0 > 1) {
+		qsort(al->argv + n0, al->argc - n0, sizeof(char *), glob_cmp);
+	}
+
+	return al->argc - n0;
+}
+
+
+int glob_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+
+/*
+ * glob_walk
+ *
+ * path (길이 plen) 디렉터리에서 pats[idx] 이후의 패턴과 일치하는 경로를 찾는다.
+ * wildcard 가 없는 부분은 디렉터리를 읽지 않고 경로에 붙이며,
+ * 마지막에 lstat 으로 존재를 확인한다.
+ * "**" 는 0 개 이상의 디렉터리와 일치한다. (심볼릭 링크는 따라가지 않음)
+ */
+void glob_walk(char *path, int plen, struct glob_pat *pats, int npats,
+			   int idx, struct arglist *al)
+{
+	struct glob_pat *pat;
+	struct dir_scan *ds;
+	struct stat statbuf;
+	int i, nlen, is_dir;
+	char *name;
+
+	// 모든 부분을 처리: 경로가 존재하면 결과에 추가
+	if (idx == npats) {
+		if (lstat(path, &statbuf) == 0) {
+			arglist_add(al, cmd_strdup(path, plen));
+		}
+		return;
+	}
+
+	pat = &pats[idx];
+
+	// 고정된 이름: 디렉터리를 읽지 않는다.
+	if (!pat->magic) {
+		if (plen + pat->len + 2 >= MAXPATH) {
+			return;
+		}
+		if (plen > 0 && path[plen - 1] != '/') {
+			path[plen++] = '/';
+		}
+		memcpy(path + plen, pat->comp, pat->len);
+		path[plen + pat->len] = '\0';
+		glob_walk(path, plen + pat->len, pats, npats, idx + 1, al);
+		path[plen] = '\0';
+		return;
+	}
+
+	// "**": 0 개의 디렉터리와 일치 (다음 패턴을 현재 디렉터리에서 찾음)
+	// 마지막 부분이면 "*" 처럼 모든 항목과 일치한다.
+	if (pat->recursive && idx + 1 < npats) {
+		glob_walk(path, plen, pats, npats, idx + 1, al);
+	}
+
+	ds = glob_scan_dir(plen ? path : ".");
+	if (ds == NULL) {
+		return;
+	}
+	ds->busy++;
+
+	if (plen > 0 && path[plen - 1] != '/') {
+		path[plen++] = '/';
+	}
+
+	for (i = 0; i < ds->count; i++) {
+		name = ds->names[i];
+		nlen = ds->lens[i];
+
+		if (!glob_match(pat, name, nlen) || plen + nlen + 2 >= MAXPATH) {
+			continue;
+		}
+		memcpy(path + plen, name, nlen + 1);
+
+		if (idx + 1 == npats) {
+			arglist_add(al, cmd_strdup(path, plen + nlen));
+			if (!pat->recursive) {
+				continue;
+			}
+		}
+
+		// 다음 부분이 있으면 디렉터리만 따라간다.
+		is_dir = (ds->types[i] == DT_DIR);
+		if (ds->types[i] == DT_UNKNOWN ||
+			(ds->types[i] == DT_LNK && !pat->recursive)) {
+			is_dir = (stat(path, &statbuf) == 0 && S_ISDIR(statbuf.st_mode));
+		}
+		if (!is_dir) {
+			continue;
+		}
+
+		if (pat->recursive) {
+			glob_walk(path, plen + nlen, pats, npats, idx, al);
+		} else if (idx + 1 < npats) {
+			glob_walk(path, plen + nlen, pats, npats, idx + 1, al);
+		}
+	}
+
+	path[plen] = '\0';
+	ds->busy--;
+}
+
+
+/*
+ * glob_scan_dir
+ *
+ * 디렉터리의 이름 목록을 getdents64 한번으로 읽어 정렬하고 캐시한다.
+ * 같은 디렉터리에 대한 반복된 패턴은 mtime 이 바뀌지 않았으면
+ * 캐시를 다시 사용한다. scan 직전에 변경된 디렉터리는 같은 mtime 으로
+ * 다시 바뀔 수 있으므로 캐시를 재사용하지 않는다.
+ */
+struct dir_scan *glob_scan_dir(char *path)
+{
+	struct dir_scan *ds, **pp;
+	struct dir_reader dr;
+	struct dirent64 *d_entry;
+	struct stat statbuf;
+	struct timespec now;
+	size_t used = 0, cap = 0, len, off;
+	int i, fd, ncap = 0;
+	char *pool = NULL, *strs;
+
+	if (stat(path, &statbuf) < 0 || !S_ISDIR(statbuf.st_mode)) {
+		return NULL;
+	}
+
+	// 캐시 검색
+	for (pp = &glob_cache; (ds = *pp) != NULL; pp = &ds->next) {
+		if (!strcmp(ds->path, path)) {
+			if (ds->dev == statbuf.st_dev && ds->ino == statbuf.st_ino &&
+				!ds->racy &&
+				ds->mtime.tv_sec == statbuf.st_mtim.tv_sec &&
+				ds->mtime.tv_nsec == statbuf.st_mtim.tv_nsec) {
+				// 가장 최근에 사용한 항목을 앞으로
+				*pp = ds->next;
+				ds->next = glob_cache;
+				glob_cache = ds;
+				return ds;
+			}
+			if (ds->busy == 0) {
+				*pp = ds->next;
+				glob_cache_count--;
+				free(ds);
+			}
+			break;
+		}
+	}
+
+	fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) {
+		return NULL;
+	}
+	clock_gettime(CLOCK_REALTIME, &now);
+	if (dir_reader_init(&dr, fd) < 0) {
+		close(fd);
+		return NULL;
+	}
+
+	// 이름과 d_type 을 하나의 버퍼에 모은다.
+	while ((d_entry = dir_reader_next(&dr)) != NULL) {
+		len = strlen(d_entry->d_name) + 2;	// type + 이름 + '\0'
+		if (used + len > cap) {
+			cap = (cap == 0) ? 64 * 1024 : cap * 2;
+			strs = realloc(pool, cap);
+			if (strs == NULL) {
+				free(pool);
+				dir_reader_close(&dr);
+				close(fd);
+				return NULL;
+			}
+			pool = strs;
+		}
+		pool[used] = d_entry->d_type;
+		memcpy(pool + used + 1, d_entry->d_name, len - 1);
+		used += len;
+		ncap++;
+	}
+	dir_reader_close(&dr);
+	close(fd);
+
+	// 구조체 하나에 이름 배열, 길이, 타입, 경로, 문자열을 모두 담는다.
+	ds = malloc(sizeof(*ds) + ncap * (sizeof(char *) + sizeof(int) + 1) +
+				strlen(path) + 1 + used);
+	if (ds == NULL) {
+		free(pool);
+		return NULL;
+	}
+	ds->names = (char **)(ds + 1);
+	ds->lens = (int *)(ds->names + ncap);
+	ds->types = (unsigned char *)(ds->lens + ncap);
+	ds->path = (char *)(ds->types + ncap);
+	strcpy(ds->path, path);
+
+	// 각 이름 앞의 1 byte 에 d_type 이 있다.
+	strs = ds->path + strlen(path) + 1;
+	if (used > 0) {
+		memcpy(strs, pool, used);
+	}
+	for (i = 0, off = 0; i < ncap; i++) {
+		ds->names[i] = strs + off + 1;
+		off += strlen(strs + off + 1) + 2;
+	}
+	free(pool);
+
+	// 이름 순으로 정렬한 후 길이와 d_type 을 채운다.
+	qsort(ds->names, ncap, sizeof(char *), glob_cmp);
+	for (i = 0; i < ncap; i++) {
+		ds->lens[i] = strlen(ds->names[i]);
+		ds->types[i] = ds->names[i][-1];
+	}
+
+	ds->count = ncap;
+	ds->dev = statbuf.st_dev;
+	ds->ino = statbuf.st_ino;
+	ds->mtime = statbuf.st_mtim;
+	ds->racy = (now.tv_sec - statbuf.st_mtim.tv_sec) < 2;
+	ds->busy = 0;
+	ds->next = glob_cache;
+	glob_cache = ds;
+	glob_cache_count++;
+
+	glob_cache_trim();
+
+	return ds;
+}
+
+
+/*
+ * glob_cache_trim
+ *
+ * 캐시한 디렉터리가 GLOB_CACHE_MAX 개를 넘으면 오래된 항목부터 버린다.
+ * 확장에 사용 중인 (busy) 항목은 버리지 않는다.
+ */
+void glob_cache_trim(void)
+{
+	struct dir_scan *ds, **pp, **victim;
+
+	while (glob_cache_count > GLOB_CACHE_MAX) {
+		victim = NULL;
+		for (pp = &glob_cache; (ds = *pp) != NULL; pp = &ds->next) {
+			if (ds->busy == 0) {
+				victim = pp;
+			}
+		}
+		if (victim == NULL) {
+			return;
+		}
+		ds = *victim;
+		*victim = ds->next;
+		glob_cache_count--;
+		free(ds);
+	}
+}
+
+
+/*
+ * history
+ *
+ * 명령 기록은 여러 셸이 함께 사용하는 append-only 파일 (~/.myshell_history) 에
+ * 한 줄에 하나씩 저장한다.
+ *   - 추가: O_APPEND 로 한 번의 write 를 하므로 lock 이 필요 없다.
+ *   - 읽기: 파일을 mmap 하여 사용하며, 다른 셸이 추가한 내용은
+ *     크기가 바뀌었을 때 다시 mmap 한다.
+ *   - 색인: 셸 시작 시에는 파일을 열기만 하고, 줄 위치 색인과
+ *     trigram (3 글자) 색인은 처음 사용할 때 만든 후 추가된 부분만 갱신한다.
+ *   - 정리: 파일이 HIST_MAX_SIZE 를 넘으면 최근 절반만 남긴 새 파일로
+ *     rename 한다. 이 때만 flock 을 사용하며, 다른 셸은 inode 가 바뀐 것을
+ *     보고 파일을 다시 연다.
+ */
+void hist_init(void)
+{
+	char *home, *file;
+
+	// 스크립트 실행 (stdin 이 터미널이 아님) 은 MYSHELL_HISTFILE 이
+	// 지정된 경우에만 기록한다.
+	file = getenv("MYSHELL_HISTFILE");
+	if (file == NULL && !isatty(STDIN_FILENO)) {
+		return;
+	}
+	if (file != NULL) {
+		snprintf(hist.path, MAXPATH, "%s", file);
+	} else {
+		home = getenv("HOME");
+		if (home == NULL) {
+			return;
+		}
+		snprintf(hist.path, MAXPATH, "%s/.myshell_history", home);
+	}
+
+	hist.fd = -1;
+	hist_open();
+}
+
+
+int hist_open(void)
+{
+	struct stat statbuf;
+
+	hist.fd = open(hist.path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+	if (hist.fd < 0 || fstat(hist.fd, &statbuf) < 0) {
+		return -1;
+	}
+	hist.ino = statbuf.st_ino;
+
+	return 0;
+}
+
+
+/*
+ * hist_reset
+ *
+ * mmap 과 색인을 모두 버린다. (파일이 정리되어 inode 가 바뀐 경우)
+ */
+void hist_reset(void)
+{
+	int i;
+
+	if (hist.map != NULL) {
+		munmap(hist.map, hist.map_len);
+	}
+	hist.map = NULL;
+	hist.map_len = 0;
+	hist.count = 0;
+	hist.indexed_len = 0;
+
+	if (hist.tri != NULL) {
+		for (i = 0; i < HIST_TRI_BUCKETS; i++) {
+			free(hist.tri[i].ids);
+		}
+		free(hist.tri);
+		hist.tri = NULL;
+	}
+	hist.tri_count = 0;
+}
+
+
+/*
+ * hist_add
+ *
+ * 명령 라인을 기록 파일에 추가한다. 빈 줄과 바로 앞의 명령과 같은 줄은 제외.
+ */
+void hist_add(char *cmdline)
+{
+	struct stat statbuf;
+	char line[MAXLINE + 1];
+	int len;
+	off_t size;
+
+	len = strcspn(cmdline, "\n");
+	if (hist.fd < 0 || len == 0 || strspn(cmdline, delim) >= (size_t)len) {
+		return;
+	}
+	if (!strncmp(hist.last, cmdline, len) && hist.last[len] == '\0') {
+		return;
+	}
+	memcpy(hist.last, cmdline, len);
+	hist.last[len] = '\0';
+
+	memcpy(line, cmdline, len);
+	line[len] = '\n';
+
+	// 다른 셸이 정리하여 파일이 바뀌었으면 다시 연다.
+	if (stat(hist.path, &statbuf) == 0 && statbuf.st_ino != hist.ino) {
+		close(hist.fd);
+		hist_open();
+	}
+
+	if (write(hist.fd, line, len + 1) != len + 1) {
+		return;
+	}
+
+	// write 도중 정리되었으면 새 파일에도 추가 (중복은 허용, 유실은 방지)
+	if (stat(hist.path, &statbuf) == 0 && statbuf.st_ino != hist.ino) {
+		close(hist.fd);
+		if (hist_open() == 0 && write(hist.fd, line, len + 1) < 0) {
+			return;
+		}
+	}
+
+	size = lseek(hist.fd, 0, SEEK_END);
+	if (size > HIST_MAX_SIZE) {
+		hist_compact();
+	}
+}
+
+
+/*
+ * hist_compact
+ *
+ * 최근 HIST_MAX_SIZE / 2 byte 의 명령만 남긴 새 파일을 만들어 교체한다.
+ * 다른 셸이 정리 중이면 (flock 실패) 아무것도 하지 않는다.
+ */
+void hist_compact(void)
+{
+	char tmp_path[MAXPATH + 16], *map, *start;
+	struct stat statbuf;
+	int fd, tmp_fd;
+	size_t keep;
+
+	fd = open(hist.path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return;
+	}
+	if (flock(fd, LOCK_EX | LOCK_NB) < 0 || fstat(fd, &statbuf) < 0 ||
+		statbuf.st_size <= HIST_MAX_SIZE) {
+		close(fd);
+		return;
+	}
+
+	map = mmap(NULL, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		close(fd);
+		return;
+	}
+
+	// 줄의 시작에서 자른다.
+	keep = HIST_MAX_SIZE / 2;
+	start = map + statbuf.st_size - keep;
+	start = memchr(start, '\n', keep);
+	start = start ? start + 1 : map + statbuf.st_size;
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", hist.path);
+	tmp_fd = mkostemp(tmp_path, O_CLOEXEC);
+	if (tmp_fd >= 0) {
+		if (write(tmp_fd, start, map + statbuf.st_size - start) ==
+				map + statbuf.st_size - start &&
+			fsync(tmp_fd) == 0 && rename(tmp_path, hist.path) == 0) {
+			// 새 파일을 사용
+			close(hist.fd);
+			hist_open();
+			hist_reset();
+		} else {
+			unlink(tmp_path);
+		}
+		close(tmp_fd);
+	}
+
+	munmap(map, statbuf.st_size);
+	close(fd);		// flock 도 해제된다.
+}
+
+
+/*
+ * hist_sync
+ *
+ * 파일의 현재 내용을 mmap 하고, 새로 추가된 줄의 시작 위치를 색인에 더한다.
+ * 기록된 명령 개수를 리턴한다.
+ */
+int hist_sync(void)
+{
+	struct stat statbuf;
+	char *p, *end, *nl;
+	off_t *noffs;
+	int fd;
+
+	if (hist.fd < 0) {
+		return 0;
+	}
+
+	if (stat(hist.path, &statbuf) < 0) {
+		return hist.count;
+	}
+	if (statbuf.st_ino != hist.ino) {
+		close(hist.fd);
+		hist_open();
+		hist_reset();
+	}
+
+	// 크기가 바뀌었으면 다시 mmap
+	if ((size_t)statbuf.st_size != hist.map_len) {
+		if (hist.map != NULL) {
+			munmap(hist.map, hist.map_len);
+			hist.map = NULL;
+			hist.map_len = 0;
+		}
+		if (statbuf.st_size == 0) {
+			return hist.count;
+		}
+		fd = open(hist.path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			return hist.count;
+		}
+		p = mmap(NULL, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (p == MAP_FAILED) {
+			return hist.count;
+		}
+		hist.map = p;
+		hist.map_len = statbuf.st_size;
+	}
+
+	// 완성된 줄 ('\n' 으로 끝남) 만 색인
+	p = hist.map + hist.indexed_len;
+	end = hist.map + hist.map_len;
+	while (p < end && (nl = memchr(p, '\n', end - p)) != NULL) {
+		if (hist.count == hist.cap) {
+			hist.cap = hist.cap ? hist.cap * 2 : 4096;
+			noffs = realloc(hist.offs, sizeof(off_t) * (hist.cap + 1));
+			if (noffs == NULL) {
+				break;
+			}
+			hist.offs = noffs;
+		}
+		hist.offs[hist.count++] = p - hist.map;
+		p = nl + 1;
+	}
+	hist.indexed_len = p - hist.map;
+	if (hist.offs != NULL) {
+		hist.offs[hist.count] = hist.indexed_len;	// 마지막 줄의 끝
+	}
+
+	return hist.count;
+}
+
+
+/*
+ * hist_get
+ *
+ * id 번째 명령의 시작 위치를 리턴하고 len 에 길이 ('\n' 제외) 를 설정한다.
+ * hist_sync 이후에만 사용한다.
+ */
+char *hist_get(int id, int *len)
+{
+	if (id < 0 || id >= hist.count) {
+		return NULL;
+	}
+	*len = hist.offs[id + 1] - hist.offs[id] - 1;
+	return hist.map + hist.offs[id];
+}
+
+
+unsigned int hist_tri_hash(const unsigned char *p)
+{
+	unsigned int x = (p[0] << 16) | (p[1] << 8) | p[2];
+
+	return (x * 2654435761u) >> (32 - HIST_TRI_BITS);
+}
+
+
+/*
+ * hist_tri_update
+ *
+ * 아직 trigram 색인에 없는 명령을 추가한다.
+ * 각 trigram 의 목록에는 명령 번호가 오름차순으로 들어간다.
+ */
+void hist_tri_update(void)
+{
+	struct hist_posting *pl;
+	unsigned char *text;
+	unsigned int h;
+	int id, i, len, *nids;
+
+	if (hist.tri == NULL) {
+		hist.tri = calloc(HIST_TRI_BUCKETS, sizeof(struct hist_posting));
+		if (hist.tri == NULL) {
+			return;
+		}
+	}
+
+	for (id = hist.tri_count; id < hist.count; id++) {
+		text = (unsigned char *)hist_get(id, &len);
+		for (i = 0; i + 3 <= len; i++) {
+			h = hist_tri_hash(text + i);
+			pl = &hist.tri[h];
+			// 같은 명령 안의 중복된 trigram 은 한 번만
+			if (pl->len > 0 && pl->ids[pl->len - 1] == id) {
+				continue;
+			}
+			if (pl->len == pl->cap) {
+				pl->cap = pl->cap ? pl->cap * 2 : 8;
+				nids = realloc(pl->ids, sizeof(int) * pl->cap);
+				if (nids == NULL) {
+					return;
+				}
+				pl->ids = nids;
+			}
+			pl->ids[pl->len++] = id;
+		}
+	}
+	hist.tri_count = hist.count;
+}
+
+
+/*
+ * hist_search
+ *
+ * before 번 보다 앞의 명령 중 query 를 포함하는 가장 최근 명령 번호를 리턴한다.
+ * 없으면 -1. query 가 3 글자 이상이면 trigram 중 가장 짧은 목록의 후보만
+ * 검사하고, 짧으면 뒤에서부터 차례로 검사한다.
+ */
+int hist_search(const char *query, int before)
+{
+	struct hist_posting *pl, *best = NULL;
+	int qlen = strlen(query), i, lo, hi, mid, len;
+	char *text;
+
+	hist_sync();
+	if (before > hist.count) {
+		before = hist.count;
+	}
+	if (qlen == 0) {
+		return before - 1;
+	}
+
+	if (qlen >= 3) {
+		hist_tri_update();
+	}
+	if (qlen < 3 || hist.tri == NULL || hist.tri_count < before) {
+		for (i = before - 1; i >= 0; i--) {
+			text = hist_get(i, &len);
+			if (memmem(text, len, query, qlen) != NULL) {
+				return i;
+			}
+		}
+		return -1;
+	}
+
+	for (i = 0; i + 3 <= qlen; i++) {
+		pl = &hist.tri[hist_tri_hash((const unsigned char *)query + i)];
+		if (best == NULL || pl->len < best->len) {
+			best = pl;
+		}
+	}
+
+	// 목록에서 before 보다 작은 마지막 위치를 찾아 뒤로 검사
+	lo = 0;
+	hi = best->len;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (best->ids[mid] < before) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	for (i = lo - 1; i >= 0; i--) {
+		text = hist_get(best->ids[i], &len);
+		if (memmem(text, len, query, qlen) != NULL) {
+			return best->ids[i];
+		}
+	}
+
+	return -1;
+}
+
+
+/*
+ * read_line
+ *
+ * 프롬프트를 출력하고 명령 라인을 읽는다. (fgets 와 같이 '\n' 포함)
+ * stdin 이 터미널이면 raw mode 줄 편집기를 사용한다.
+ *   ←/→, Ctrl-A/E/B/F   커서 이동        ↑/↓, Ctrl-P/N   명령 기록
+ *   Backspace, Del, Ctrl-D/K/U/W   삭제   Ctrl-R   기록 역방향 검색
+ *   Tab   명령어/파일 이름 완성         Ctrl-C   줄 취소, Ctrl-L   화면 지움
+ * EOF 이면 NULL 을 리턴한다.
+ */
+char *read_line(char *prompt, char *buf, int size)
+{
+	struct termios orig, raw;
+	int ret;
+
+	if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &orig) < 0) {
+		printf("%s", prompt);
+		fflush(stdout);
+		return fgets(buf, size, stdin);
+	}
+
+	raw = orig;
+	raw.c_iflag &= ~(IXON | ICRNL | INLCR | ISTRIP);
+	raw.c_lflag &= ~(ICANON | ECHO | IEXTEN | ISIG);
+	raw.c_cc[VMIN] = 1;
+	raw.c_cc[VTIME] = 0;
+	if (tcsetattr(STDIN_FILENO, TCSADRAIN, &raw) < 0) {
+		printf("%s", prompt);
+		fflush(stdout);
+		return fgets(buf, size, stdin);
+	}
+
+	ret = edit_line(prompt, buf, size);
+
+	tcsetattr(STDIN_FILENO, TCSADRAIN, &orig);
+
+	return (ret < 0) ? NULL : buf;
+}
+
+
+/*
+ * edit_line
+ *
+ * raw mode 에서 키를 하나씩 읽어 줄을 편집한다.
+ * Enter 이면 줄 끝에 '\n' 을 붙이고 길이를 리턴하며, EOF 이면 -1 을 리턴한다.
+ */
+int edit_line(char *prompt, char *buf, int size)
+{
+	struct line_state ls;
+	char c, seq[3], mb[4];
+	int last_tab = 0, tab, n, want;
+
+	ls.buf = buf;
+	ls.size = size - 1;		// '\n' 자리
+	ls.len = ls.pos = 0;
+	ls.prompt = prompt;
+	ls.hist_id = hist_sync();
+	ls.saved[0] = '\0';
+	buf[0] = '\0';
+
+	line_refresh(&ls);
+
+	while (1) {
+		if (read(STDIN_FILENO, &c, 1) <= 0) {
+			return -1;
+		}
+		tab = 0;
+
+		switch (c) {
+		case 18:	// Ctrl-R: Enter 로 끝나면 바로 실행
+			c = line_search(&ls);
+			if (c != '\r' && c != '\n') {
+				break;
+			}
+			/* fall through */
+		case '\r':
+		case '\n':
+			ls.pos = ls.len;
+			line_refresh(&ls);
+			write(STDOUT_FILENO, "\r\n", 2);
+			buf[ls.len] = '\n';
+			buf[ls.len + 1] = '\0';
+			return ls.len + 1;
+		case 3:		// Ctrl-C: 줄 취소
+			write(STDOUT_FILENO, "^C\r\n", 4);
+			ls.len = ls.pos = 0;
+			buf[0] = '\0';
+			ls.hist_id = hist_sync();
+			break;
+		case 4:		// Ctrl-D: 빈 줄이면 EOF, 아니면 문자 삭제
+			if (ls.len == 0) {
+				write(STDOUT_FILENO, "\r\n", 2);
+				return -1;
+			}
+			line_delete(&ls, ls.pos, line_next(&ls, ls.pos) - ls.pos);
+			break;
+		case 127:	// Backspace
+		case 8:
+			n = line_prev(&ls, ls.pos);
+			line_delete(&ls, n, ls.pos - n);
+			ls.pos = n;
+			break;
+		case 1:		// Ctrl-A
+			ls.pos = 0;
+			break;
+		case 5:		// Ctrl-E
+			ls.pos = ls.len;
+			break;
+		case 2:		// Ctrl-B
+			ls.pos = line_prev(&ls, ls.pos);
+			break;
+		case 6:		// Ctrl-F
+			ls.pos = line_next(&ls, ls.pos);
+			break;
+		case 11:	// Ctrl-K: 커서 뒤 삭제
+			line_delete(&ls, ls.pos, ls.len - ls.pos);
+			break;
+		case 21:	// Ctrl-U: 커서 앞 삭제
+			line_delete(&ls, 0, ls.pos);
+			ls.pos = 0;
+			break;
+		case 23:	// Ctrl-W: 앞 단어 삭제
+			{
+				int start = ls.pos;
+
+				while (start > 0 && buf[start - 1] == ' ') {
+					start--;
+				}
+				while (start > 0 && buf[start - 1] != ' ') {
+					start--;
+				}
+				line_delete(&ls, start, ls.pos - start);
+				ls.pos = start;
+			}
+			break;
+		case 12:	// Ctrl-L
+			write(STDOUT_FILENO, "\x1b[H\x1b[2J", 7);
+			break;
+		case 16:	// Ctrl-P
+			line_history(&ls, -1);
+			break;
+		case 14:	// Ctrl-N
+			line_history(&ls, 1);
+			break;
+		case '\t':
+			line_complete(&ls, last_tab);
+			tab = 1;
+			break;
+		case 27:	// escape sequence
+			if (read(STDIN_FILENO, seq, 1) <= 0 ||
+				read(STDIN_FILENO, seq + 1, 1) <= 0) {
+				break;
+			}
+			if (seq[0] != '[' && seq[0] != 'O') {
+				break;
+			}
+			if (seq[1] >= '0' && seq[1] <= '9') {
+				if (read(STDIN_FILENO, seq + 2, 1) <= 0 || seq[2] != '~') {
+					break;
+				}
+				if (seq[1] == '3') {			// Del
+					line_delete(&ls, ls.pos, line_next(&ls, ls.pos) - ls.pos);
+				} else if (seq[1] == '1' || seq[1] == '7') {	// Home
+					ls.pos = 0;
+				} else if (seq[1] == '4' || seq[1] == '8') {	// End
+					ls.pos = ls.len;
+				}
+				break;
+			}
+			switch (seq[1]) {
+			case 'A':
+				line_history(&ls, -1);
+				break;
+			case 'B':
+				line_history(&ls, 1);
+				break;
+			case 'C':
+				ls.pos = line_next(&ls, ls.pos);
+				break;
+			case 'D':
+				ls.pos = line_prev(&ls, ls.pos);
+				break;
+			case 'H':
+				ls.pos = 0;
+				break;
+			case 'F':
+				ls.pos = ls.len;
+				break;
+			}
+			break;
+		default:
+			if ((unsigned char)c < 32) {
+				break;
+			}
+			// UTF-8 글자는 나머지 바이트까지 읽어 한 번에 넣는다.
+			want = ((unsigned char)c >= 0xF0) ? 4 :
+				   ((unsigned char)c >= 0xE0) ? 3 :
+				   ((unsigned char)c >= 0xC0) ? 2 : 1;
+			mb[0] = c;
+			for (n = 1; n < want && read(STDIN_FILENO, mb + n, 1) == 1; n++)
+				;
+			line_insert(&ls, mb, n);
+			break;
+		}
+
+		last_tab = tab;
+		line_refresh(&ls);
+	}
+}
+
+
+/*
+ * line_refresh
+ *
+ * 줄의 처음으로 가서 프롬프트와 버퍼를 다시 출력하고 커서를 옮긴다.
+ * 커서는 바이트나 글자 수로 옮기지 않고 커서 앞부분을 다시 출력하여
+ * 맞춘다. (여러 바이트 글자, 두 칸 폭의 한글)
+ */
+void line_refresh(struct line_state *ls)
+{
+	char out[MAXLINE * 2 + 64];
+	int n;
+
+	n = snprintf(out, sizeof(out), "\r%s%.*s\x1b[K", ls->prompt,
+				 ls->len, ls->buf);
+	if (ls->len > ls->pos && n < (int)sizeof(out)) {
+		n += snprintf(out + n, sizeof(out) - n, "\r%s%.*s", ls->prompt,
+					  ls->pos, ls->buf);
+	}
+	if (n >= (int)sizeof(out)) {
+		n = sizeof(out) - 1;
+	}
+	write(STDOUT_FILENO, out, n);
+}
+
+
+void line_insert(struct line_state *ls, const char *str, int n)
+{
+	if (ls->len + n > ls->size - 1) {
+		// 잘라야 하면 UTF-8 글자의 중간에서 자르지 않는다.
+		n = ls->size - 1 - ls->len;
+		while (n > 0 && (str[n] & 0xC0) == 0x80) {
+			n--;
+		}
+	}
+	if (n <= 0) {
+		return;
+	}
+	memmove(ls->buf + ls->pos + n, ls->buf + ls->pos, ls->len - ls->pos);
+	memcpy(ls->buf + ls->pos, str, n);
+	ls->len += n;
+	ls->pos += n;
+	ls->buf[ls->len] = '\0';
+}
+
+
+void line_delete(struct line_state *ls, int at, int n)
+{
+	if (at < 0 || at >= ls->len || n <= 0) {
+		return;
+	}
+	if (at + n > ls->len) {
+		n = ls->len - at;
+	}
+	memmove(ls->buf + at, ls->buf + at + n, ls->len - at - n);
+	ls->len -= n;
+	ls->buf[ls->len] = '\0';
+}
+
+
+/*
+ * line_prev, line_next
+ *
+ * pos 앞 / 뒤 글자의 경계를 리턴한다. UTF-8 의 이어지는 바이트 (10xxxxxx)
+ * 를 건너뛰어 여러 바이트 글자를 한 글자로 다룬다.
+ */
+int line_prev(struct line_state *ls, int pos)
+{
+	while (pos > 0 && (ls->buf[--pos] & 0xC0) == 0x80)
+		;
+	return pos;
+}
+
+
+int line_next(struct line_state *ls, int pos)
+{
+	if (pos < ls->len) {
+		pos++;
+	}
+	while (pos < ls->len && (ls->buf[pos] & 0xC0) == 0x80) {
+		pos++;
+	}
+	return pos;
+}
+
+
+void line_set(struct line_state *ls, const char *str, int n)
+{
+	ls->len = ls->pos = 0;
+	line_insert(ls, str, n);
+}
+
+
+/*
+ * line_history
+ *
+ * 명령 기록에서 이전 (dir = -1) / 다음 (dir = 1) 명령으로 바꾼다.
+ * 기록의 끝은 편집 중이던 줄이다.
+ */
+void line_history(struct line_state *ls, int dir)
+{
+	int count = hist_sync(), len;
+	char *text;
+
+	if (ls->hist_id == count && dir < 0) {
+		memcpy(ls->saved, ls->buf, ls->len + 1);
+	}
+	if (ls->hist_id + dir < 0 || ls->hist_id + dir > count) {
+		return;
+	}
+	ls->hist_id += dir;
+
+	if (ls->hist_id == count) {
+		line_set(ls, ls->saved, strlen(ls->saved));
+	} else {
+		text = hist_get(ls->hist_id, &len);
+		line_set(ls, text, len);
+	}
+}
+
+
+/*
+ * line_search
+ *
+ * Ctrl-R: 입력한 문자열을 포함하는 명령을 기록에서 역방향으로 찾는다.
+ * Ctrl-R 을 다시 누르면 더 이전의 명령을 찾는다.
+ * Enter 는 실행, Ctrl-G 는 취소, 다른 편집 키는 찾은 줄을 편집한다.
+ * 검색을 끝낸 키를 리턴한다.
+ */
+int line_search(struct line_state *ls)
+{
+	char query[MAXLINE], out[MAXLINE * 2 + 64], c = 0;
+	int qlen = 0, id, found, len = 0, n;
+	char *text = NULL;
+
+	query[0] = '\0';
+	found = hist_sync();
+
+	while (1) {
+		n = snprintf(out, sizeof(out), "\r(reverse-i-search)`%s': %.*s\x1b[K",
+					 query, text ? len : 0, text ? text : "");
+		write(STDOUT_FILENO, out, n);
+
+		if (read(STDIN_FILENO, &c, 1) <= 0) {
+			break;
+		}
+
+		if (c == 18) {				// Ctrl-R: 이전 결과
+			id = hist_search(query, found);
+		} else if (c == 127 || c == 8) {
+			// UTF-8 글자 하나를 지운다.
+			if (qlen > 0) {
+				while (--qlen > 0 && (query[qlen] & 0xC0) == 0x80)
+					;
+				query[qlen] = '\0';
+			}
+			id = hist_search(query, hist.count);
+		} else if (c == 7 || c == 3) {	// Ctrl-G, Ctrl-C: 취소
+			line_set(ls, "", 0);
+			break;
+		} else if ((unsigned char)c >= 32 && qlen < MAXLINE - 1) {
+			query[qlen++] = c;
+			query[qlen] = '\0';
+			// 현재 결과부터 다시 검사 (incremental)
+			id = hist_search(query, (text ? found + 1 : hist.count));
+		} else {
+			// 다른 키: 찾은 줄로 편집 (Enter 면 바로 실행)
+			if (text) {
+				line_set(ls, text, len);
+				ls->hist_id = found;
+			}
+			break;
+		}
+
+		if (id >= 0) {
+			found = id;
+			text = hist_get(id, &len);
+		}
+	}
+
+	line_refresh(ls);
+
+	return c;
+}
+
+
+/*
+ * line_complete
+ *
+ * Tab: 커서 앞 단어를 완성한다.
+ * 첫 단어이면 내장 명령어와 PATH 의 실행 파일에서, 아니면 파일 이름에서 찾는다.
+ * 공통 부분까지 채우고, 후보가 여러 개이면 Tab 을 두 번 눌렀을 때 목록을 출력한다.
+ */
+void line_complete(struct line_state *ls, int list)
+{
+	struct comp_list cl = { NULL, 0, 0 };
+	char word[MAXLINE], *slash, out[MAXPATH + 8];
+	int start, wlen, i, j, common, cmd_pos, dir_only;
+
+	// 현재 단어의 시작
+	for (start = ls->pos; start > 0 && ls->buf[start - 1] != ' '; start--)
+		;
+	wlen = ls->pos - start;
+	memcpy(word, ls->buf + start, wlen);
+	word[wlen] = '\0';
+
+	// 명령어 위치: 앞에 공백이 아닌 글자가 없거나 파이프 바로 뒤
+	for (i = start - 1; i >= 0 && ls->buf[i] == ' '; i--)
+		;
+	cmd_pos = (i < 0 || ls->buf[i] == '|');
+	slash = strrchr(word, '/');
+
+	if (cmd_pos && slash == NULL) {
+		comp_builtins(word, wlen, &cl);
+		exec_index_complete(word, &cl);
+	} else {
+		comp_files(word, slash, &cl);
+	}
+
+	if (cl.n == 0) {
+		goto out;
+	}
+
+	// 중복 제거 (내장 명령과 실행 파일의 같은 이름)
+	qsort(cl.items, cl.n, sizeof(char *), glob_cmp);
+	for (i = j = 1; i < cl.n; i++) {
+		if (strcmp(cl.items[i], cl.items[j - 1])) {
+			cl.items[j++] = cl.items[i];
+		} else {
+			free(cl.items[i]);
+		}
+	}
+	cl.n = j;
+
+	// 후보들의 공통 부분 (UTF-8 글자의 중간에서 끊지 않는다)
+	common = strlen(cl.items[0]);
+	for (i = 1; i < cl.n; i++) {
+		for (j = 0; j < common && cl.items[i][j] == cl.items[0][j]; j++)
+			;
+		common = j;
+	}
+	while (common > 0 && (cl.items[0][common] & 0xC0) == 0x80) {
+		common--;
+	}
+
+	// 완성 문자열은 단어 전체 (파일은 디렉터리 부분 제외) 기준
+	j = slash ? (int)(slash - word + 1) : 0;
+	if (common > wlen - j) {
+		line_insert(ls, cl.items[0] + (wlen - j), common - (wlen - j));
+		if (cl.n == 1) {
+			dir_only = (cl.items[0][common - 1] == '/');
+			if (!dir_only) {
+				line_insert(ls, " ", 1);
+			}
+		}
+	} else if (cl.n == 1) {
+		if (cl.items[0][common - 1] != '/') {
+			line_insert(ls, " ", 1);
+		}
+	} else if (list) {
+		// 두 번째 Tab: 후보 목록 출력
+		write(STDOUT_FILENO, "\r\n", 2);
+		for (i = 0; i < cl.n && i < COMP_MAXLIST; i++) {
+			j = snprintf(out, sizeof(out), "%s%s", cl.items[i],
+						 (i % 4 == 3 || i == cl.n - 1) ? "\r\n" : "\t");
+			write(STDOUT_FILENO, out, j);
+		}
+		if (cl.n > COMP_MAXLIST) {
+			j = snprintf(out, sizeof(out), "... (%d more)\r\n",
+						 cl.n - COMP_MAXLIST);
+			write(STDOUT_FILENO, out, j);
+		}
+	} else {
+		write(STDOUT_FILENO, "\a", 1);
+	}
+
+out:
+	for (i = 0; i < cl.n; i++) {
+		free(cl.items[i]);
+	}
+	free(cl.items);
+}
+
+
+void comp_add(struct comp_list *cl, const char *str, int len)
+{
+	char **ni;
+
+	if (cl->n == cl->cap) {
+		cl->cap = cl->cap ? cl->cap * 2 : 64;
+		ni = realloc(cl->items, sizeof(char *) * cl->cap);
+		if (ni == NULL) {
+			return;
+		}
+		cl->items = ni;
+	}
+	cl->items[cl->n] = malloc(len + 1);
+	if (cl->items[cl->n] != NULL) {
+		memcpy(cl->items[cl->n], str, len);
+		cl->items[cl->n][len] = '\0';
+		cl->n++;
+	}
+}
+
+
+void comp_builtins(char *word, int wlen, struct comp_list *cl)
+{
+	struct builtin *bp;
+
+	for (bp = builtin_table; bp->name != NULL; bp++) {
+		if (!strncmp(bp->name, word, wlen)) {
+			comp_add(cl, bp->name, strlen(bp->name));
+		}
+	}
+}
+
+
+/*
+ * comp_files
+ *
+ * 파일 이름 완성: 디렉터리 scan 캐시 (glob_scan_dir) 의 정렬된 이름에서
+ * 이진 검색으로 prefix 범위를 찾는다. 디렉터리는 '/' 를 붙인다.
+ */
+void comp_files(char *word, char *slash, struct comp_list *cl)
+{
+	struct dir_scan *ds;
+	struct stat statbuf;
+	char dir[MAXPATH], path[MAXPATH * 2], name[MAXPATH + 1], *prefix;
+	int plen, lo, hi, mid, i, nlen, is_dir;
+
+	if (slash) {
+		if (slash == word) {
+			strcpy(dir, "/");
+		} else {
+			snprintf(dir, MAXPATH, "%.*s", (int)(slash - word), word);
+		}
+		prefix = slash + 1;
+	} else {
+		strcpy(dir, ".");
+		prefix = word;
+	}
+	plen = strlen(prefix);
+
+	ds = glob_scan_dir(dir);
+	if (ds == NULL) {
+		return;
+	}
+
+	lo = 0;
+	hi = ds->count;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (strncmp(ds->names[mid], prefix, plen) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	for (i = lo; i < ds->count && !strncmp(ds->names[i], prefix, plen); i++) {
+		if (ds->names[i][0] == '.' && prefix[0] != '.') {
+			continue;
+		}
+		is_dir = (ds->types[i] == DT_DIR);
+		if (ds->types[i] == DT_LNK || ds->types[i] == DT_UNKNOWN) {
+			snprintf(path, sizeof(path), "%s/%s", dir, ds->names[i]);
+			is_dir = (stat(path, &statbuf) == 0 && S_ISDIR(statbuf.st_mode));
+		}
+		nlen = snprintf(name, sizeof(name), "%s%s", ds->names[i],
+						is_dir ? "/" : "");
+		comp_add(cl, name, nlen);
+	}
+}
+
+
+/*
+ * PATH 실행 파일 색인 (trie)
+ *
+ * background 스레드가 PATH 의 디렉터리를 하나씩 읽어 trie 에 추가하므로
+ * 셸 시작을 늦추지 않고, 색인이 끝나기 전에도 읽은 부분까지 완성할 수 있다.
+ * Tab 을 누를 때 PATH 디렉터리의 mtime 을 (최대 1 초에 한 번) 확인하여
+ * 바뀌었으면 새 trie 를 만들어 교체한다.
+ */
+void exec_index_start(void)
+{
+	pthread_t tid;
+
+	pthread_mutex_lock(&exec_idx.lock);
+	exec_idx.refresh = 1;
+	pthread_mutex_unlock(&exec_idx.lock);
+
+	if (pthread_create(&tid, NULL, exec_index_thr_fn, NULL) == 0) {
+		pthread_detach(tid);
+		exec_idx.started = 1;
+	}
+}
+
+
+void *exec_index_thr_fn(void *arg)
+{
+	struct trie *t, *old;
+	char *path, *dir, *saveptr, pathbuf[MAXLINE * 4];
+	struct stat statbuf;
+	int first, n;
+
+	(void)arg;
+
+	while (1) {
+		pthread_mutex_lock(&exec_idx.lock);
+		while (!exec_idx.refresh) {
+			pthread_cond_wait(&exec_idx.cond, &exec_idx.lock);
+		}
+		exec_idx.refresh = 0;
+		exec_idx.building = 1;
+		first = (exec_idx.trie == NULL);
+		pthread_mutex_unlock(&exec_idx.lock);
+
+		t = trie_new();
+		if (t == NULL) {
+			pthread_mutex_lock(&exec_idx.lock);
+			exec_idx.building = 0;
+			pthread_mutex_unlock(&exec_idx.lock);
+			continue;
+		}
+		if (first) {
+			// 처음에는 만드는 중인 trie 를 바로 사용하게 한다.
+			pthread_mutex_lock(&exec_idx.lock);
+			exec_idx.trie = t;
+			pthread_mutex_unlock(&exec_idx.lock);
+		}
+
+		path = getenv("PATH");
+		snprintf(pathbuf, sizeof(pathbuf), "%s", path ? path : "/usr/bin:/bin");
+		snprintf(exec_idx.path, sizeof(exec_idx.path), "%s", pathbuf);
+
+		n = 0;
+		for (dir = strtok_r(pathbuf, ":", &saveptr); dir != NULL &&
+			 n < EXEC_MAXDIRS; dir = strtok_r(NULL, ":", &saveptr)) {
+			if (stat(dir, &statbuf) < 0) {
+				continue;
+			}
+			exec_idx.mtimes[n] = statbuf.st_mtim;
+			snprintf(exec_idx.dirs[n], MAXPATH, "%s", dir);
+			n++;
+			exec_index_add_dir(t, dir, first);
+		}
+		exec_idx.ndirs = n;
+
+		pthread_mutex_lock(&exec_idx.lock);
+		old = exec_idx.trie;
+		exec_idx.trie = t;
+		exec_idx.building = 0;
+		pthread_cond_broadcast(&exec_idx.cond);
+		pthread_mutex_unlock(&exec_idx.lock);
+		if (old != t) {
+			trie_free(old);
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ * exec_index_add_dir
+ *
+ * 디렉터리의 실행 파일을 trie 에 추가한다.
+ * 사용 중인 trie 이면 (locked) 디렉터리 하나를 추가하는 동안만 lock 한다.
+ */
+void exec_index_add_dir(struct trie *t, char *dir, int locked)
+{
+	struct dir_reader dr;
+	struct dirent64 *d_entry;
+	char *names = NULL, *p;
+	size_t used = 0, cap = 0, len;
+	int fd;
+
+	fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) {
+		return;
+	}
+	if (dir_reader_init(&dr, fd) < 0) {
+		close(fd);
+		return;
+	}
+
+	// lock 없이 실행 파일 이름을 모은다.
+	while ((d_entry = dir_reader_next(&dr)) != NULL) {
+		if (d_entry->d_type != DT_REG && d_entry->d_type != DT_LNK &&
+			d_entry->d_type != DT_UNKNOWN) {
+			continue;
+		}
+		if (faccessat(fd, d_entry->d_name, X_OK, AT_EACCESS) < 0) {
+			continue;
+		}
+		len = strlen(d_entry->d_name) + 1;
+		if (used + len > cap) {
+			cap = cap ? cap * 2 : 16 * 1024;
+			p = realloc(names, cap);
+			if (p == NULL) {
+				break;
+			}
+			names = p;
+		}
+		memcpy(names + used, d_entry->d_name, len);
+		used += len;
+	}
+	dir_reader_close(&dr);
+	close(fd);
+
+	if (locked) {
+		pthread_mutex_lock(&exec_idx.lock);
+	}
+	for (p = names; p < names + used; p += strlen(p) + 1) {
+		trie_insert(t, p);
+	}
+	if (locked) {
+		pthread_mutex_unlock(&exec_idx.lock);
+	}
+
+	free(names);
+}
+
+
+/*
+ * exec_index_complete
+ *
+ * prefix 로 시작하는 실행 파일 이름을 cl 에 추가한다.
+ * 먼저 PATH 디렉터리가 바뀌었는지 확인하여 필요하면 다시 색인하도록 요청한다.
+ */
+void exec_index_complete(char *prefix, struct comp_list *cl)
+{
+	struct trie_node *node;
+	struct stat statbuf;
+	struct timespec now;
+	char word[MAXLINE], *path;
+	int i, changed = 0, len = strlen(prefix);
+
+	if (!exec_idx.started) {
+		return;
+	}
+
+	// PATH 디렉터리 변경 확인 (1 초에 한 번)
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (now.tv_sec != exec_idx.checked) {
+		exec_idx.checked = now.tv_sec;
+		path = getenv("PATH");
+		pthread_mutex_lock(&exec_idx.lock);
+		if (!exec_idx.refresh && !exec_idx.building) {
+			if (path && strcmp(path, exec_idx.path)) {
+				changed = 1;
+			}
+			for (i = 0; i < exec_idx.ndirs && !changed; i++) {
+				if (stat(exec_idx.dirs[i], &statbuf) < 0 ||
+					statbuf.st_mtim.tv_sec != exec_idx.mtimes[i].tv_sec ||
+					statbuf.st_mtim.tv_nsec != exec_idx.mtimes[i].tv_nsec) {
+					changed = 1;
+				}
+			}
+			if (changed) {
+				exec_idx.refresh = 1;
+				pthread_cond_broadcast(&exec_idx.cond);
+			}
+		}
+		pthread_mutex_unlock(&exec_idx.lock);
+	}
+
+	pthread_mutex_lock(&exec_idx.lock);
+	if (changed) {
+		// 새 파일이 바로 보이도록 다시 색인을 잠시 (최대 200ms) 기다린다.
+		clock_gettime(CLOCK_REALTIME, &now);
+		now.tv_nsec += 200 * 1000000;
+		if (now.tv_nsec >= 1000000000) {
+			now.tv_sec++;
+			now.tv_nsec -= 1000000000;
+		}
+		while ((exec_idx.refresh || exec_idx.building) &&
+			   pthread_cond_timedwait(&exec_idx.cond, &exec_idx.lock, &now) == 0)
+			;
+	}
+	if (exec_idx.trie != NULL) {
+		node = trie_find(exec_idx.trie, prefix);
+		if (node != NULL) {
+			memcpy(word, prefix, len);
+			trie_collect(node, word, len, cl);
+		}
+	}
+	pthread_mutex_unlock(&exec_idx.lock);
+}
+
+
+/*
+ * trie
+ *
+ * 각 노드는 글자 하나이며 자식은 정렬된 형제 목록으로 연결한다.
+ * 노드는 블록 단위로 할당하여 trie 전체를 한번에 해제한다.
+ */
+struct trie *trie_new(void)
+{
+	return calloc(1, sizeof(struct trie));
+}
+
+
+void trie_free(struct trie *t)
+{
+	struct trie_chunk *cp;
+
+	if (t == NULL) {
+		return;
+	}
+	while (t->chunks != NULL) {
+		cp = t->chunks;
+		t->chunks = cp->next;
+		free(cp);
+	}
+	free(t);
+}
+
+
+struct trie_node *trie_node_new(struct trie *t, unsigned char c)
+{
+	struct trie_chunk *cp = t->chunks;
+	struct trie_node *node;
+
+	if (cp == NULL || cp->used == TRIE_CHUNK) {
+		cp = malloc(sizeof(*cp));
+		if (cp == NULL) {
+			return NULL;
+		}
+		cp->used = 0;
+		cp->next = t->chunks;
+		t->chunks = cp;
+	}
+
+	node = &cp->nodes[cp->used++];
+	node->c = c;
+	node->term = 0;
+	node->child = node->next = NULL;
+
+	return node;
+}
+
+
+void trie_insert(struct trie *t, const char *word)
+{
+	struct trie_node *node = &t->root, **pp, *n;
+	const unsigned char *p;
+
+	for (p = (const unsigned char *)word; *p; p++) {
+		// 정렬된 형제 목록에서 글자를 찾거나 삽입
+		for (pp = &node->child; *pp && (*pp)->c < *p; pp = &(*pp)->next)
+			;
+		if (*pp == NULL || (*pp)->c != *p) {
+			n = trie_node_new(t, *p);
+			if (n == NULL) {
+				return;
+			}
+			n->next = *pp;
+			*pp = n;
+		}
+		node = *pp;
+	}
+	node->term = 1;
+}
+
+
+struct trie_node *trie_find(struct trie *t, const char *prefix)
+{
+	struct trie_node *node = &t->root;
+	const unsigned char *p;
+
+	for (p = (const unsigned char *)prefix; *p && node; p++) {
+		for (node = node->child; node && node->c < *p; node = node->next)
+			;
+		if (node && node->c != *p) {
+			node = NULL;
+		}
+	}
+	return node;
+}
+
+
+/*
+ * trie_collect
+ *
+ * node 아래의 모든 단어를 (word 의 처음 len 글자가 prefix) cl 에 추가한다.
+ * 후보가 너무 많으면 COMP_MAXCAND 개에서 멈춘다.
+ */
+void trie_collect(struct trie_node *node, char *word, int len,
+				  struct comp_list *cl)
+{
+	struct trie_node *n;
+
+	if (node->term) {
+		comp_add(cl, word, len);
+	}
+	if (len >= MAXLINE - 1) {
+		return;
+	}
+	for (n = node->child; n && cl->n < COMP_MAXCAND; n = n->next) {
+		word[len] = n->c;
+		trie_collect(n, word, len + 1, cl);
+	}
+}
+
+
+/*
+ * server mode
+ *
+ * myshell -s [socket] 으로 실행하면 Unix socket 에서 명령 라인을 받아
+ * process_cmd() 로 처리한다. client 는 명령 라인과 함께 자신의
+ * stdin/stdout/stderr 와 작업 디렉터리를 SCM_RIGHTS 로 보내고,
+ * 셸은 명령을 처리하는 동안 이 fd 들을 자신의 0/1/2 로 사용한 뒤
+ * 종료 상태 (int) 를 응답한다. 한 연결에서 여러 명령을 보낼 수 있다.
+ *
+ * 외부 명령은 셸이 커지기 전에 fork 해 둔 zygote 가 실행한다.
+ * 명령은 한 번에 하나씩 처리하며, 다른 client 는 listen backlog 에서 기다린다.
+ *
+ * socket 은 0600 으로 만들고, 연결한 client 의 uid (SO_PEERCRED) 가
+ * 셸과 같을 때만 명령을 받는다. 경로에 이미 있는 파일은 자신이 소유한
+ * socket 일 때만 지우고 다시 만든다.
+ */
+int server_main(char *path)
+{
+	struct sockaddr_un addr;
+	struct ucred cred;
+	struct stat statbuf;
+	socklen_t len;
+	mode_t mask;
+	int sv[2], lfd, cfd;
+	pid_t pid;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "%s: socket path too long\n", path);
+		return 1;
+	}
+	if (lstat(path, &statbuf) == 0 &&
+		(!S_ISSOCK(statbuf.st_mode) || statbuf.st_uid != geteuid())) {
+		fprintf(stderr, "%s: exists and is not our socket\n", path);
+		return 1;
+	}
+
+	// zygote 를 먼저 fork 한다.
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+		perror("socketpair");
+		return 1;
+	}
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return 1;
+	}
+	if (pid == 0) {
+		close(sv[0]);
+		zygote_main(sv[1]);
+		exit(0);
+	}
+	close(sv[1]);
+	zygote_fd = sv[0];
+
+	lfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (lfd < 0) {
+		perror("socket");
+		return 1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	unlink(path);
+	mask = umask(077);
+	if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+		listen(lfd, SOMAXCONN) < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return 1;
+	}
+	umask(mask);
+
+	server_mode = 1;
+	fprintf(stderr, "myshell: listening on %s (zygote %d)\n", path, pid);
+
+	while (1) {
+		cfd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+		if (cfd < 0) {
+			if (errno != EINTR && errno != ECONNABORTED) {
+				perror("accept");
+			}
+			continue;
+		}
+
+		// 다른 사용자의 연결은 받지 않는다.
+		len = sizeof(cred);
+		cred.uid = (uid_t)-1;
+		if (getsockopt(cfd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0 ||
+			cred.uid != geteuid()) {
+			fprintf(stderr, "myshell: connection from uid %d refused\n",
+					(int)cred.uid);
+			close(cfd);
+			continue;
+		}
+		server_conn(cfd);
+		close(cfd);
+	}
+
+	return 0;
+}
+
+
+/*
+ * server_conn
+ *
+ * 한 client 연결의 명령들을 처리한다.
+ * 메시지마다 fd 4 개 (stdin, stdout, stderr, 작업 디렉터리) 가 있어야 한다.
+ */
+void server_conn(int cfd)
+{
+	char cmdline[MAXLINE];
+	int fds[4], saved[3], nfds, n, i;
+
+	for (i = 0; i < 3; i++) {
+		saved[i] = fcntl(i, F_DUPFD_CLOEXEC, 3);
+	}
+
+	server_quit = 0;
+	while (!server_quit) {
+		n = recv_fds(cfd, cmdline, MAXLINE - 2, fds, 4, &nfds);
+		if (n <= 0) {
+			break;
+		}
+		if (nfds != 4) {
+			for (i = 0; i < nfds; i++) {
+				close(fds[i]);
+			}
+			last_status = 126;
+			send(cfd, &last_status, sizeof(last_status), MSG_NOSIGNAL);
+			continue;
+		}
+
+		// fgets 로 읽은 것처럼 '\n' 으로 끝나게 한다.
+		cmdline[n] = '\0';
+		if (n == 0 || cmdline[n - 1] != '\n') {
+			strcat(cmdline, "\n");
+		}
+
+		for (i = 0; i < 3; i++) {
+			dup2(fds[i], i);
+			close(fds[i]);
+		}
+		client_cwd = fds[3];
+		if (fchdir(client_cwd) < 0) {
+			perror("chdir");
+		}
+
+		process_cmd(cmdline);
+
+		fflush(stdout);
+		fflush(stderr);
+		close(client_cwd);
+		client_cwd = -1;
+
+		// client 의 fd 를 계속 잡고 있으면 client 가 EOF 를 받지 못한다.
+		for (i = 0; i < 3; i++) {
+			dup2(saved[i], i);
+		}
+
+		send(cfd, &last_status, sizeof(last_status), MSG_NOSIGNAL);
+	}
+
+	for (i = 0; i < 3; i++) {
+		close(saved[i]);
+	}
+}
+
+
+/*
+ * recv_fds
+ *
+ * 메시지를 받고 함께 온 fd (최대 maxfds 개) 를 fds 에 저장한다.
+ * 받은 바이트 수를 리턴한다.
+ */
+int recv_fds(int sock, void *buf, int size, int *fds, int maxfds, int *nfds)
+{
+	char cbuf[CMSG_SPACE(sizeof(int) * 8)];
+	struct iovec iov = { buf, size };
+	struct msghdr msg = { 0 };
+	struct cmsghdr *cmsg;
+	int n;
+
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = CMSG_SPACE(sizeof(int) * maxfds);
+
+	do {
+		n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+	} while (n < 0 && errno == EINTR);
+
+	*nfds = 0;
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+			*nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * *nfds);
+		}
+	}
+
+	return n;
+}
+
+
+int send_fds(int sock, void *buf, int size, int *fds, int nfds)
+{
+	char cbuf[CMSG_SPACE(sizeof(int) * 8)];
+	struct iovec iov = { buf, size };
+	struct msghdr msg = { 0 };
+	struct cmsghdr *cmsg;
+
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+
+	return sendmsg(sock, &msg, MSG_NOSIGNAL);
+}
+
+
+/*
+ * zygote_main
+ *
+ * 셸이 시작할 때 fork 한 작은 프로세스로, 셸의 요청을 받아 외부 명령을
+ * 실행한다. 메모리가 작은 프로세스에서 실행하므로 셸이 커져도
+ * 실행 지연이 늘어나지 않는다. 자식이 종료하면 SIGCHLD (signalfd) 를 받아
+ * 종료 상태를 셸에 보낸다. 셸이 종료하면 zygote 도 종료한다.
+ */
+void zygote_main(int sock)
+{
+	struct signalfd_siginfo si;
+	struct zy_reply rep;
+	struct pollfd pfd[2];
+	sigset_t mask;
+	int status, sfd;
+	pid_t pid;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+	sfd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+	if (sfd < 0) {
+		perror("signalfd");
+		exit(1);
+	}
+
+	pfd[0].fd = sock;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = sfd;
+	pfd[1].events = POLLIN;
+
+	while (1) {
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			exit(1);
+		}
+
+		if (pfd[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+			zygote_request(sock);
+		}
+
+		if (pfd[1].revents & POLLIN) {
+			while (read(sfd, &si, sizeof(si)) > 0)
+				;
+			while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+				rep.type = ZY_EXITED;
+				rep.pid = pid;
+				rep.status = status;
+				send(sock, &rep, sizeof(rep), MSG_NOSIGNAL);
+			}
+		}
+	}
+}
+
+
+/*
+ * zygote_request
+ *
+ * 실행 요청 하나를 처리한다. 요청과 함께 stdin, stdout, stderr,
+ * 작업 디렉터리 fd 와 (있으면) 파이프 fd 를 받는다.
+ */
+void zygote_request(int sock)
+{
+	static char buf[ZY_MAXMSG];
+	static int saved[3] = { -1, -1, -1 };
+	char *argv[MAXARGS + 1], **largv = argv, *p, *end;
+	struct redirect rd[MAXREDIR];
+	struct zy_req *req = (struct zy_req *)buf;
+	struct zy_redirect zr;
+	struct zy_reply rep;
+	int fds[ZY_MAXFDS], nfds, n, i, in_fd, out_fd;
+
+	if (saved[0] < 0) {
+		for (i = 0; i < 3; i++) {
+			saved[i] = fcntl(i, F_DUPFD_CLOEXEC, 3);
+		}
+	}
+
+	n = recv_fds(sock, buf, sizeof(buf) - 1, fds, ZY_MAXFDS, &nfds);
+	if (n <= 0) {
+		// 셸이 종료됨
+		exit(0);
+	}
+	buf[n] = '\0';
+
+	rep.type = ZY_SPAWNED;
+	rep.pid = -1;
+	rep.status = 0;
+
+	if (n < (int)sizeof(*req) || req->nrd > MAXREDIR ||
+		nfds < 4 + req->has_in + req->has_out) {
+		goto out;
+	}
+
+	// redirection 과 argv 를 푼다.
+	p = buf + sizeof(*req);
+	end = buf + n;
+	for (i = 0; i < req->nrd; i++) {
+		if (p + sizeof(zr) > end) {
+			goto out;
+		}
+		memcpy(&zr, p, sizeof(zr));
+		p += sizeof(zr);
+		rd[i].type = zr.type;
+		rd[i].fd = zr.fd;
+		rd[i].src_fd = zr.src_fd;
+		rd[i].target = NULL;
+		if (zr.fd_idx >= 0) {
+			if (zr.fd_idx >= nfds) {
+				goto out;
+			}
+			rd[i].src_fd = fds[zr.fd_idx];
+		}
+		if (zr.tlen >= 0) {
+			if (p + zr.tlen + 1 > end) {
+				goto out;
+			}
+			rd[i].target = p;
+			p += zr.tlen + 1;
+		}
+	}
+	if (req->argc > MAXARGS) {
+		largv = malloc(sizeof(char *) * (req->argc + 1));
+		if (largv == NULL) {
+			goto out;
+		}
+	}
+	for (i = 0; i < req->argc; i++) {
+		if (p >= end) {
+			goto out;
+		}
+		largv[i] = p;
+		p += strlen(p) + 1;
+	}
+	largv[req->argc] = NULL;
+	if (req->argc == 0) {
+		goto out;
+	}
+
+	for (i = 0; i < 3; i++) {
+		dup2(fds[i], i);
+	}
+	if (fchdir(fds[3]) < 0) {
+		perror("chdir");
+	}
+	in_fd = req->has_in ? fds[4] : -1;
+	out_fd = req->has_out ? fds[4 + req->has_in] : -1;
+
+	cmd_place = req->place;
+	rep.pid = spawn_cmd(largv, in_fd, out_fd, rd, req->nrd);
+
+	fflush(stderr);
+	for (i = 0; i < 3; i++) {
+		dup2(saved[i], i);
+	}
+
+out:
+	if (largv != argv) {
+		free(largv);
+	}
+	for (i = 0; i < nfds; i++) {
+		close(fds[i]);
+	}
+	send(sock, &rep, sizeof(rep), MSG_NOSIGNAL);
+}
+
+
+/*
+ * zygote_spawn
+ *
+ * spawn_cmd 와 같지만 zygote 에게 실행을 요청한다.
+ * 요청이 ZY_MAXMSG 보다 크면 실행하지 않고 -1 을 리턴한다.
+ */
+pid_t zygote_spawn(char **argv, int in_fd, int out_fd,
+				   struct redirect *rd, int nrd)
+{
+	static char buf[ZY_MAXMSG];
+	struct zy_req *req = (struct zy_req *)buf;
+	struct zy_redirect zr;
+	struct zy_reply rep;
+	int fds[ZY_MAXFDS] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO, client_cwd };
+	int nfds = 4, len = sizeof(*req), n, i;
+
+	if (client_cwd < 0) {
+		fds[3] = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+	}
+
+	req->nrd = nrd;
+	req->place = cmd_place;
+	req->has_in = (in_fd >= 0);
+	req->has_out = (out_fd >= 0);
+	if (in_fd >= 0) {
+		fds[nfds++] = in_fd;
+	}
+	if (out_fd >= 0) {
+		fds[nfds++] = out_fd;
+	}
+
+	for (i = 0; i < nrd; i++) {
+		zr.type = rd[i].type;
+		zr.fd = rd[i].fd;
+		zr.src_fd = rd[i].src_fd;
+		zr.fd_idx = -1;
+		// 셸의 다른 fd (파이프 등) 로의 복제는 그 fd 를 함께 보낸다.
+		if (zr.type == RD_DUP && zr.src_fd > STDERR_FILENO) {
+			if (nfds == ZY_MAXFDS) {
+				goto toolong;
+			}
+			zr.fd_idx = nfds;
+			fds[nfds++] = zr.src_fd;
+		}
+		zr.tlen = rd[i].target ? (int)strlen(rd[i].target) : -1;
+		if (len + sizeof(zr) + zr.tlen + 1 > sizeof(buf)) {
+			goto toolong;
+		}
+		memcpy(buf + len, &zr, sizeof(zr));
+		len += sizeof(zr);
+		if (zr.tlen >= 0) {
+			memcpy(buf + len, rd[i].target, zr.tlen + 1);
+			len += zr.tlen + 1;
+		}
+	}
+	for (i = 0; argv[i] != NULL; i++) {
+		n = strlen(argv[i]) + 1;
+		if (len + n > (int)sizeof(buf)) {
+			goto toolong;
+		}
+		memcpy(buf + len, argv[i], n);
+		len += n;
+	}
+	req->argc = i;
+
+	n = send_fds(zygote_fd, buf, len, fds, nfds);
+	if (client_cwd < 0) {
+		close(fds[3]);
+	}
+	if (n < 0) {
+		fprintf(stderr, "zygote: %s\n", strerror(errno));
+		return -1;
+	}
+
+	// 실행 결과를 기다린다. 그 사이에 온 종료 상태는 wait_cmd 가 보관한다.
+	while ((n = recv(zygote_fd, &rep, sizeof(rep), 0)) == sizeof(rep) &&
+		   rep.type == ZY_EXITED) {
+		zygote_save_exit(&rep);
+	}
+	if (n != sizeof(rep)) {
+		fprintf(stderr, "zygote lost\n");
+		close(zygote_fd);
+		zygote_fd = -1;
+		return -1;
+	}
+
+	return rep.pid;
+
+toolong:
+	if (client_cwd < 0) {
+		close(fds[3]);
+	}
+	fprintf(stderr, "%s: argument list too long\n", argv[0]);
+	return -1;
+}
+
+
+/*
+ * zygote_save_exit
+ *
+ * 아직 wait 하지 않은 자식의 종료 상태를 보관한다.
+ */
+void zygote_save_exit(struct zy_reply *rep)
+{
+	if (zy_nexits == zy_cap) {
+		zy_cap = zy_cap ? zy_cap * 2 : 16;
+		zy_exits = realloc(zy_exits, sizeof(*zy_exits) * zy_cap);
+		if (zy_exits == NULL) {
+			myshell_error("zygote: out of memory");
+		}
+	}
+	zy_exits[zy_nexits++] = *rep;
+}
+
+
+/*
+ * builtin_cmd
+ *
+ * 내장 명령을 수행한다.
+ * 내장 명령이 아니면 1을 리턴한다.
+ */
+int builtin_cmd(int argc, char **argv)
+{
+	struct builtin *bp;
+
+	bp = find_builtin(argv[0]);
+	if (bp == NULL) {
+		// 내장 명령어가 아님.
+		return 1;
+	}
+
+	last_status = (bp->func(argc, argv) != 0);
+	return 0;
+}
+
+
+/*
+ * find_builtin
+ *
+ * 내장 명령어 목록에서 cmd 를 찾는다. 없으면 NULL 을 리턴한다.
+ */
+struct builtin *find_builtin(char *cmd)
+{
+	struct builtin *bp;
+
+	for (bp = builtin_table; bp->name != NULL; bp++) {
+		if (!strcmp(cmd, bp->name)) {
+			return bp;
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ * 
+ * 내장 명령 처리 함수들
+ * argc, argv를 인자로 받는다.
+ * 
+ */
+int quit_shell(int argc, char **argv)
+{
+	(void)argc;
+	(void)argv;
+
+	// server mode 에서는 client 연결만 끝낸다.
+	if (server_mode) {
+		server_quit = 1;
+		return 0;
+	}
+
+	exit(0);
+}
+
+
+/*
+ * history [n]           최근 n 개 (기본값 20) 의 명령을 출력
+ * history -s <text> [n] text 를 포함하는 최근 명령 n 개를 최신 순으로 출력
+ */
+int show_history(int argc, char **argv)
+{
+	int i, id, n = 20, count, len;
+	char *text;
+
+	count = hist_sync();
+
+	if (argc >= 3 && !strcmp(argv[1], "-s")) {
+		if (argc == 4) {
+			n = atoi(argv[3]);
+		}
+		id = count;
+		for (i = 0; i < n; i++) {
+			id = hist_search(argv[2], id);
+			if (id < 0) {
+				break;
+			}
+			text = hist_get(id, &len);
+			fprintf(sh_out, "%6d  %.*s\n", id + 1, len, text);
+		}
+		return 0;
+	}
+
+	if (argc == 2) {
+		n = atoi(argv[1]);
+	} else if (argc != 1) {
+		fprintf(sh_err, "Usage: %s [n] | -s <text> [n]\n", argv[0]);
+		return 1;
+	}
+
+	for (i = (count > n) ? count - n : 0; i < count; i++) {
+		text = hist_get(i, &len);
+		fprintf(sh_out, "%6d  %.*s\n", i + 1, len, text);
+	}
+
+	return 0;
+}
+
+
+int list_files(int argc, char **argv)
+{
+	char *dirname, current_dir[] = ".";
+	char pathname[MAXPATH];
+	DIR *dp;
+	struct dirent *d_entry;
+	int lflag = 0;
+	struct stat statbuf;
+
+	// 명령 인자 개수를 확인
+	if (argc == 1) {
+		dirname = current_dir;
+	} else if (argc == 2) {
+		dirname = argv[1];
+	} else {
+		fprintf(sh_err, "Usage: %s [dir name]\n", argv[0]);
+		return 1;
+	}
+
+	// 명령어 종류 확인 ls / ll
+	if (!strcmp(argv[0], "ll")) {
+		lflag = 1;
+	}
+
+	dp = opendir(dirname);
+	if (dp == NULL) {
+		fprintf(sh_err, "directory open error\n");
+		return 1;
+	}
+
+	d_entry = readdir(dp);
+	while (d_entry != NULL) {
+		// ".", ".." 제외
+		//if (d_entry->d_name[0] != '.') {
+		if (strcmp(d_entry->d_name, ".") &&
+			strcmp(d_entry->d_name, "..")) {
+			if (lflag == 0) {	// ls 명령
+				fprintf(sh_out, "%s\n", d_entry->d_name);
+			} else {			// ll 명령
+				sprintf(pathname, "%s/%s", dirname, d_entry->d_name);
+				if (stat(pathname, &statbuf)) {
+					fprintf(sh_err, "file information error\n");
+					closedir(dp);
+					return 1;
+				}
+				print_long_format(d_entry->d_name, &statbuf);
+			}
+		}
+		d_entry = readdir(dp);
+	}
+
+	closedir(dp);
+
+	return 0;
+}
+
+
+void print_long_format(char *filename, struct stat *statbuf)
+{
+	char timestr[30];
+
+	// 디렉터리 / 파일
+	if (S_ISDIR(statbuf->st_mode)) {
+		fprintf(sh_out, "d");
+	} else {
+		fprintf(sh_out, "-");
+	}
+
+	// 파일 접근 모드
+	fprintf(sh_out, "%c%c%c%c%c%c%c%c%c ", 
+		(statbuf->st_mode & S_IRUSR) ? 'r' : '-',
+		(statbuf->st_mode & S_IWUSR) ? 'w' : '-',
+		(statbuf->st_mode & S_IXUSR) ? 'x' : '-',
+		(statbuf->st_mode & S_IRGRP) ? 'r' : '-',
+		(statbuf->st_mode & S_IWGRP) ? 'w' : '-',
+		(statbuf->st_mode & S_IXGRP) ? 'x' : '-',
+		(statbuf->st_mode & S_IROTH) ? 'r' : '-',
+		(statbuf->st_mode & S_IWOTH) ? 'w' : '-',
+		(statbuf->st_mode & S_IXOTH) ? 'x' : '-');
+
+	// 하드 링크 개수
+	fprintf(sh_out, "%2d ", statbuf->st_nlink);
+
+	// 사용자 id와 그룹 id
+	fprintf(sh_out, "%4d ", statbuf->st_uid);
+	fprintf(sh_out, "%4d ", statbuf->st_gid);
+
+	// 파일 크기
+	fprintf(sh_out, "%10d ", (int) statbuf->st_size);
+
+	// 파일 수정 시간
+	ctime_r(&statbuf->st_mtime, timestr);
+	timestr[16] = 0;
+	fprintf(sh_out, "%s ", (char *) &(timestr[4]));
+
+	// 파일 이름
+	fprintf(sh_out, "%s\n", filename);
+
+	return;
+}
+
+
+int copy_file(int argc, char **argv)
+{
+#if 0
+	char *in_file, *out_file;
+	FILE *in, *out;	
+	int c;
+
+	if (argc != 3) {
+		fprintf(sh_err, "Usage: %s <src_file> <dst_file>\n", argv[0]);
+		return 1;
+	}
+
+	in_file = argv[1];
+	out_file = argv[2];
+
+	if ( (in = fopen(in_file,"r")) == NULL) {
+		fprintf(sh_err, "Cannot open %s for reading\n",in_file);
+		return 1;
+	}
+	if ( (out = fopen(out_file,"w")) == NULL) {
+		fprintf(sh_err, "Cannot open %s for writing\n",out_file);
+		return 1;
+	}
+
+	while ( (c = getc(in)) != EOF)
+		putc(c,out);
+
+	fclose(in);
+	fclose(out);
+#else
+	
+	char *in_file, *out_file, *dst_dir, *base, *name = argv[0];
+	char pathname[MAXPATH];
+	struct stat statbuf;
+	int i, ret = 0;
+
+	// 옵션 처리: -V (복사한 데이터를 CRC32C 로 검증), -B (bulk 복사)
+	copy_verify = 0;
+	copy_bulk = 0;
+	copy_verbose = 1;
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (!strcmp(argv[i], "-V")) {
+			copy_verify = 1;
+			crc32c_init();
+		} else if (!strcmp(argv[i], "-B")) {
+			copy_bulk = 1;
+		} else {
+			break;
+		}
+	}
+	argv += i - 1;
+	argc -= i - 1;
+ 
+	if (argc < 3) {
+		fprintf(sh_err, "Usage: %s [-V] [-B] <src_file> <dst_file>\n", name);
+		fprintf(sh_err, "       %s [-V] [-B] <src_file> ... <dst_dir>\n", name);
+		return 1;
+	}
+
+	// 목적지가 디렉터리이면 (wildcard 확장 등) 각 파일을 같은 이름으로 복사
+	dst_dir = argv[argc - 1];
+	if (argc > 3 || (stat(dst_dir, &statbuf) == 0 && S_ISDIR(statbuf.st_mode))) {
+		for (i = 1; i < argc - 1; i++) {
+			in_file = argv[i];
+			base = strrchr(in_file, '/');
+			base = base ? base + 1 : in_file;
+			if (snprintf(pathname, MAXPATH, "%s/%s", dst_dir, base) >= MAXPATH) {
+				fprintf(sh_err, "pathname too long\n");
+				ret = 1;
+				continue;
+			}
+			ret |= copy_one_file(in_file, pathname);
+		}
+	} else {
+		in_file = argv[1];
+		out_file = argv[2];
+		ret = copy_one_file(in_file, out_file);
+	}
+
+	if (copy_verify) {
+		verify_report(sh_out, ret);
+		ret |= (verify_bad > 0);
+	}
+	return ret;
+#endif
+}
+
+
+/*
+ * copy_one_file
+ *
+ * in_file 을 out_file 로 복사한다.
+ */
+int copy_one_file(char *in_file, char *out_file)
+{
+    int in_fd, out_fd, ret = 0;
+ 
+	// 소스 파일을 열고, 목적 파일을 생성한다.
+	in_fd = open(in_file, O_RDONLY | O_CLOEXEC);
+	if (in_fd < 0) {
+		fprintf(sh_err, "source file (%s) open error\n", in_file);
+		return 1;
+	}
+
+	out_fd = open(out_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+				DEFAULT_FILE_MODE);
+	if (out_fd < 0) {
+		fprintf(sh_err, "destination file (%s) creation error\n", out_file);
+		close(in_fd);
+		return 1;
+	}
+ 
+	// 소스 파일의 끝까지 목적 파일로 복사한다.
+	if (copy_verify) {
+		ret = copy_fd_verify(in_file, in_fd, out_fd);
+	} else if ((copy_bulk ? copy_fd_bulk(in_fd, out_fd) :
+				copy_fd_data(in_fd, out_fd)) < 0) {
+		fprintf(sh_err, "copy error: %s\n", strerror(errno));
+		ret = 1;
+	}
+
+	// 소스와 목적 파일을 닫는다.
+    close(in_fd);
+    if (close(out_fd) < 0 && ret == 0) {
+		fprintf(sh_err, "%s: %s\n", out_file, strerror(errno));
+		ret = 1;
+	}
+
+	return ret;
+}
+
+
+int remove_file(int argc, char **argv)
+{
+	char *filename;
+	int i, ret = 0, rflag = 0, nthreads = 0;
+
+	// 옵션 처리: -r (디렉터리 재귀 삭제), -j <스레드 개수>
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (!strcmp(argv[i], "-r")) {
+			rflag = 1;
+		} else if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+			nthreads = atoi(argv[++i]);
+		} else {
+			break;
+		}
+	}
+
+	if (i >= argc) {
+		fprintf(sh_err, "Usage: %s [-r] [-j threads] <file_name> ...\n",
+				argv[0]);
+		return 1;
+	}
+
+	for (; i < argc; i++) {
+		filename = argv[i];
+
+		if (rflag) {
+			ret |= remove_tree(filename, nthreads, 0);
+			continue;
+		}
+
+		//ret = remove(filename);
+		if (unlink(filename) != 0) {
+			fprintf(sh_err, "remove file error\n");
+			ret = 1;
+		}
+	}
+
+	return ret;
+}
+
+
+/*
+ * remove_tree
+ *
+ * rm -r: pathname 이하의 트리를 thread pool 로 병렬 삭제한다.
+ * 각 디렉터리는 하나의 작업(task)이며, 디렉터리 fd 기준으로
+ * getdents64 / unlinkat 을 사용하여 경로 해석 비용을 줄인다.
+ * 하위 디렉터리는 새 작업으로 넘기고, 참조 개수가 0 이 되면
+ * (자신의 scan 과 모든 하위 디렉터리가 끝나면) 부모 fd 기준으로 rmdir 한다.
+ * 끝나면 삭제한 파일 개수와 초당 삭제 개수를 출력한다. (quiet 이면 생략)
+ */
+int remove_tree(char *pathname, int nthreads, int quiet)
+{
+	struct rm_dir *root;
+	struct stat statbuf;
+	struct timespec start, end;
+	double sec;
+	size_t len, base;
+
+	if (lstat(pathname, &statbuf) < 0) {
+		fprintf(sh_err, "%s: %s\n", pathname, strerror(errno));
+		return 1;
+	}
+
+	// 디렉터리가 아니면 그냥 unlink
+	if (!S_ISDIR(statbuf.st_mode)) {
+		if (unlink(pathname) != 0) {
+			fprintf(sh_err, "remove file error\n");
+			return 1;
+		}
+		return 0;
+	}
+
+	// "/", ".", ".." 은 삭제하지 않는다. 끝의 '/' 를 뺀 마지막 이름으로
+	// 비교하므로 "./", "../", "a/..", "//" 등도 거부한다.
+	len = strlen(pathname);
+	while (len > 1 && pathname[len - 1] == '/') {
+		len--;
+	}
+	for (base = len; base > 0 && pathname[base - 1] != '/'; base--)
+		;
+	if ((len == 1 && pathname[0] == '/') ||
+		(len - base == 1 && pathname[base] == '.') ||
+		(len - base == 2 && !strncmp(pathname + base, "..", 2))) {
+		fprintf(sh_err, "refusing to remove '%s'\n", pathname);
+		return 1;
+	}
+
+	if (pool_init(&rm_pool, nthreads) != 0) {
+		fprintf(sh_err, "thread pool creation error\n");
+		return 1;
+	}
+
+	rm_files = rm_dirs = rm_errors = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	root = rm_dir_new(NULL, pathname);
+	if (root == NULL || pool_submit(&rm_pool, rm_dir_task, root) != 0) {
+		fprintf(sh_err, "out of memory\n");
+		free(root);
+		pool_destroy(&rm_pool);
+		return 1;
+	}
+
+	pool_wait(&rm_pool);
+	pool_destroy(&rm_pool);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	if (!quiet) {
+		fprintf(sh_out, "removed %ld files, %ld directories in %.2f sec "
+				"(%.0f files/sec, %d threads)\n",
+				(long)rm_files, (long)rm_dirs, sec,
+				(sec > 0) ? rm_files / sec : 0.0, rm_pool.nthreads);
+	}
+	if (rm_errors) {
+		fprintf(sh_err, "%ld errors\n", (long)rm_errors);
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * rm_dir_new
+ *
+ * 삭제할 디렉터리 구조체를 만든다. 참조 개수는 자신의 scan 몫으로 1 이다.
+ */
+struct rm_dir *rm_dir_new(struct rm_dir *parent, char *name)
+{
+	struct rm_dir *dp;
+	size_t plen = parent ? strlen(parent->path) + 1 : 0;
+	size_t nlen = strlen(name);
+
+	// 전체 경로는 "부모 경로/이름", 이름은 경로의 마지막 부분
+	dp = malloc(sizeof(*dp) + plen + nlen + 1);
+	if (dp == NULL) {
+		return NULL;
+	}
+
+	dp->fd = -1;
+	dp->parent = parent;
+	atomic_init(&dp->refs, 1);
+	atomic_init(&dp->failed, 0);
+	if (parent) {
+		memcpy(dp->path, parent->path, plen - 1);
+		dp->path[plen - 1] = '/';
+	}
+	memcpy(dp->path + plen, name, nlen + 1);
+	dp->name = dp->path + plen;
+
+	return dp;
+}
+
+
+/*
+ * rm_dir_release
+ *
+ * 디렉터리의 참조 개수를 줄이고, 0 이 되면 디렉터리를 삭제한 후
+ * 부모의 참조 개수를 줄인다. (post-order rmdir)
+ */
+void rm_dir_release(struct rm_dir *dp)
+{
+	struct rm_dir *parent;
+	int ret;
+
+	while (dp != NULL && atomic_fetch_sub(&dp->refs, 1) == 1) {
+		parent = dp->parent;
+
+		if (dp->fd >= 0) {
+			close(dp->fd);
+		}
+
+		if (atomic_load(&dp->failed)) {
+			// 하위 항목 삭제 실패: 비어 있지 않으므로 rmdir 하지 않는다.
+			if (parent) {
+				atomic_store(&parent->failed, 1);
+			}
+		} else {
+			if (parent) {
+				ret = unlinkat(parent->fd, dp->name, AT_REMOVEDIR);
+			} else {
+				ret = rmdir(dp->path);
+			}
+			if (ret < 0) {
+				fprintf(sh_err, "remove directory (%s) error: %s\n",
+						dp->path, strerror(errno));
+				atomic_fetch_add(&rm_errors, 1);
+				if (parent) {
+					atomic_store(&parent->failed, 1);
+				}
+			} else {
+				atomic_fetch_add(&rm_dirs, 1);
+			}
+		}
+
+		free(dp);
+		dp = parent;
+	}
+}
+
+
+/*
+ * rm_dir_task
+ *
+ * 하나의 디렉터리를 scan 하면서 파일은 바로 unlinkat 하고,
+ * 하위 디렉터리는 새 작업으로 thread pool 에 넣는다.
+ */
+void rm_dir_task(void *arg)
+{
+	struct rm_dir *dp = arg, *child;
+	struct dir_reader dr;
+	struct dirent64 *d_entry;
+	long nfiles = 0;
+	int is_dir;
+
+	if (dp->parent) {
+		dp->fd = openat(dp->parent->fd, dp->name,
+				O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	} else {
+		dp->fd = open(dp->path,
+				O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	}
+	if (dp->fd < 0 || dir_reader_init(&dr, dp->fd) < 0) {
+		fprintf(sh_err, "directory (%s) open error: %s\n",
+				dp->path, strerror(errno));
+		atomic_fetch_add(&rm_errors, 1);
+		atomic_store(&dp->failed, 1);
+		rm_dir_release(dp);
+		return;
+	}
+
+	while ((d_entry = dir_reader_next(&dr)) != NULL) {
+		is_dir = (d_entry->d_type == DT_DIR);
+
+		// d_type 을 모르면 unlinkat 을 먼저 시도 (디렉터리면 EISDIR)
+		if (!is_dir) {
+			if (unlinkat(dp->fd, d_entry->d_name, 0) == 0) {
+				nfiles++;
+				continue;
+			}
+			if (errno != EISDIR) {
+				fprintf(sh_err, "remove file (%s/%s) error: %s\n",
+						dp->path, d_entry->d_name, strerror(errno));
+				atomic_fetch_add(&rm_errors, 1);
+				atomic_store(&dp->failed, 1);
+				continue;
+			}
+		}
+
+		// 하위 디렉터리는 새 작업으로 처리
+		child = rm_dir_new(dp, d_entry->d_name);
+		if (child == NULL) {
+			atomic_fetch_add(&rm_errors, 1);
+			atomic_store(&dp->failed, 1);
+			continue;
+		}
+		atomic_fetch_add(&dp->refs, 1);
+		if (pool_submit(&rm_pool, rm_dir_task, child) != 0) {
+			free(child);
+			atomic_fetch_sub(&dp->refs, 1);
+			atomic_fetch_add(&rm_errors, 1);
+			atomic_store(&dp->failed, 1);
+		}
+	}
+
+	if (dr.error) {
+		fprintf(sh_err, "directory (%s) read error\n", dp->path);
+		atomic_fetch_add(&rm_errors, 1);
+		atomic_store(&dp->failed, 1);
+	}
+	dir_reader_close(&dr);
+
+	atomic_fetch_add(&rm_files, nfiles);
+
+	// 자신의 scan 몫 참조를 반환
+	rm_dir_release(dp);
+}
+
+
+int move_file(int argc, char **argv)
+{
+	char *old_file, *new_file;
+	int ret, nthreads = 0, i = 1;
+
+	// 옵션 처리: -j <스레드 개수> (다른 파일 시스템으로 이동할 때 사용)
+	if (argc == 5 && !strcmp(argv[1], "-j")) {
+		nthreads = atoi(argv[2]);
+		i = 3;
+	}
+
+	if (argc - i != 2) {
+		fprintf(sh_err, "Usage: %s [-j threads] <old_file> <new_file>\n",
+				argv[0]);
+		return 1;
+	}
+
+	old_file = argv[i];
+	new_file = argv[i + 1];
+
+	ret = rename(old_file, new_file);
+	if (ret != 0) {
+		// 다른 파일 시스템이면 복사 후 원본을 삭제한다.
+		if (errno == EXDEV) {
+			return move_cross_device(old_file, new_file, nthreads);
+		}
+		fprintf(sh_err, "move file error\n");
+	}
+
+	return ret;
+}
+
+
+/*
+ * move_cross_device
+ *
+ * rename 이 EXDEV 로 실패한 경우 (다른 파일 시스템) 의 mv.
+ * copy_fd_data 로 복사하고 (디렉터리는 thread pool 로 병렬 복사)
+ * 모드, 소유자, 시간을 보존한다. 목적 파일과 디렉터리를 모두 fsync 한
+ * 후에만 원본을 삭제하며, 복사 중 에러가 있으면 원본을 남겨 둔다.
+ * 끝나면 처리량을 출력한다.
+ */
+int move_cross_device(char *old_file, char *new_file, int nthreads)
+{
+	struct mv_dir *root;
+	struct stat statbuf;
+	struct timespec start, end;
+	double sec;
+
+	if (lstat(old_file, &statbuf) < 0) {
+		fprintf(sh_err, "%s: %s\n", old_file, strerror(errno));
+		return 1;
+	}
+
+	mv_files = mv_bytes = mv_errors = 0;
+	mv_threads = 1;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if (!S_ISDIR(statbuf.st_mode)) {
+		// 파일 하나: 현재 스레드에서 복사
+		mv_copy_entry(AT_FDCWD, old_file, AT_FDCWD, new_file, old_file);
+	} else {
+		if (pool_init(&mv_pool, nthreads) != 0) {
+			fprintf(sh_err, "thread pool creation error\n");
+			return 1;
+		}
+		mv_threads = mv_pool.nthreads;
+
+		root = mv_dir_new(NULL, old_file, new_file);
+		if (root == NULL || pool_submit(&mv_pool, mv_dir_task, root) != 0) {
+			fprintf(sh_err, "out of memory\n");
+			free(root);
+			pool_destroy(&mv_pool);
+			return 1;
+		}
+		pool_wait(&mv_pool);
+		pool_destroy(&mv_pool);
+	}
+
+	if (mv_errors) {
+		fprintf(sh_err, "%ld errors: source (%s) is not removed\n",
+				(long)mv_errors, old_file);
+		return 1;
+	}
+
+	// 새 이름이 들어간 목적지의 부모 디렉터리도 sync 해야 이름이 남는다.
+	if (mv_sync_parent(new_file) != 0) {
+		fprintf(sh_err, "directory sync error: %s: source (%s) is not removed\n",
+				strerror(errno), old_file);
+		return 1;
+	}
+
+	// 목적지가 모두 sync 되었으므로 원본 삭제
+	if (!S_ISDIR(statbuf.st_mode)) {
+		if (unlink(old_file) < 0) {
+			fprintf(sh_err, "remove file error\n");
+			return 1;
+		}
+	} else if (remove_tree(old_file, nthreads, 1) != 0) {
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	fprintf(sh_out, "moved %ld files, %.1f MB in %.2f sec "
+			"(%.1f MB/s, %d threads)\n",
+			(long)mv_files, mv_bytes / 1e6, sec,
+			(sec > 0) ? mv_bytes / 1e6 / sec : 0.0, mv_threads);
+
+	return 0;
+}
+
+
+/*
+ * mv_dir_new
+ *
+ * 이동 중인 디렉터리 구조체를 만든다.
+ * 부모가 있으면 name 은 부모 기준 이름이고, 없으면 src/dst 경로이다.
+ */
+struct mv_dir *mv_dir_new(struct mv_dir *parent, char *name, char *dst_name)
+{
+	struct mv_dir *dp;
+	size_t plen = parent ? strlen(parent->path) + 1 : 0;
+	size_t nlen = strlen(name);
+
+	dp = malloc(sizeof(*dp) + plen + nlen + 1);
+	if (dp == NULL) {
+		return NULL;
+	}
+
+	dp->src_fd = dp->dst_fd = -1;
+	dp->parent = parent;
+	dp->dst_name = dst_name;
+	atomic_init(&dp->refs, 1);
+	if (parent) {
+		memcpy(dp->path, parent->path, plen - 1);
+		dp->path[plen - 1] = '/';
+	}
+	memcpy(dp->path + plen, name, nlen + 1);
+	dp->name = dp->path + plen;
+	if (parent) {
+		dp->dst_name = dp->name;
+	}
+
+	return dp;
+}
+
+
+/*
+ * mv_dir_release
+ *
+ * 디렉터리의 참조 개수를 줄이고, 0 이 되면 (모든 항목 복사 완료)
+ * 목적 디렉터리의 모드와 시간을 설정하고 fsync 한 후 부모를 release 한다.
+ */
+void mv_dir_release(struct mv_dir *dp)
+{
+	struct mv_dir *parent;
+	struct timespec times[2];
+
+	while (dp != NULL && atomic_fetch_sub(&dp->refs, 1) == 1) {
+		parent = dp->parent;
+
+		if (dp->dst_fd >= 0) {
+			// 하위 항목을 만들면 시간이 바뀌므로 마지막에 설정
+			times[0] = dp->st.st_atim;
+			times[1] = dp->st.st_mtim;
+			if (fchmod(dp->dst_fd, dp->st.st_mode & 07777) < 0 ||
+				futimens(dp->dst_fd, times) < 0 || fsync(dp->dst_fd) < 0) {
+				fprintf(sh_err, "directory (%s) sync error: %s\n",
+						dp->path, strerror(errno));
+				atomic_fetch_add(&mv_errors, 1);
+			}
+			close(dp->dst_fd);
+		}
+		if (dp->src_fd >= 0) {
+			close(dp->src_fd);
+		}
+
+		free(dp);
+		dp = parent;
+	}
+}
+
+
+/*
+ * mv_dir_task
+ *
+ * 원본 디렉터리를 scan 하여 목적 디렉터리를 만들고,
+ * 하위 디렉터리와 파일을 각각 thread pool 작업으로 넘긴다.
+ */
+void mv_dir_task(void *arg)
+{
+	struct mv_dir *dp = arg, *child;
+	struct mv_file *fp;
+	struct dir_reader dr;
+	struct dirent64 *d_entry;
+	struct stat statbuf;
+	int src_parent = dp->parent ? dp->parent->src_fd : AT_FDCWD;
+	int dst_parent = dp->parent ? dp->parent->dst_fd : AT_FDCWD;
+	int is_dir;
+	size_t len;
+
+	dp->src_fd = openat(src_parent, dp->name,
+			O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (dp->src_fd < 0 || fstat(dp->src_fd, &dp->st) < 0) {
+		goto error;
+	}
+
+	// 목적 디렉터리는 복사가 끝날 때까지 쓰기 가능한 모드로 만든다.
+	if (mkdirat(dst_parent, dp->dst_name, S_IRWXU) < 0) {
+		goto error;
+	}
+	dp->dst_fd = openat(dst_parent, dp->dst_name,
+			O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (dp->dst_fd < 0) {
+		goto error;
+	}
+	if (geteuid() == 0) {
+		fchown(dp->dst_fd, dp->st.st_uid, dp->st.st_gid);
+	}
+
+	if (dir_reader_init(&dr, dp->src_fd) < 0) {
+		goto error;
+	}
+
+	while ((d_entry = dir_reader_next(&dr)) != NULL) {
+		atomic_fetch_add(&dp->refs, 1);
+
+		// d_type 을 알려주지 않는 파일 시스템이면 fstatat 으로 확인
+		is_dir = d_entry->d_type == DT_DIR;
+		if (d_entry->d_type == DT_UNKNOWN &&
+			fstatat(dp->src_fd, d_entry->d_name, &statbuf,
+					AT_SYMLINK_NOFOLLOW) == 0) {
+			is_dir = S_ISDIR(statbuf.st_mode);
+		}
+
+		if (is_dir) {
+			child = mv_dir_new(dp, d_entry->d_name, NULL);
+			if (child && pool_submit(&mv_pool, mv_dir_task, child) == 0) {
+				continue;
+			}
+			free(child);
+		} else {
+			len = strlen(d_entry->d_name);
+			fp = malloc(sizeof(*fp) + len + 1);
+			if (fp) {
+				fp->dir = dp;
+				memcpy(fp->name, d_entry->d_name, len + 1);
+				if (pool_submit(&mv_pool, mv_file_task, fp) == 0) {
+					continue;
+				}
+			}
+			free(fp);
+		}
+
+		fprintf(sh_err, "out of memory\n");
+		atomic_fetch_add(&mv_errors, 1);
+		atomic_fetch_sub(&dp->refs, 1);
+	}
+
+	if (dr.error) {
+		fprintf(sh_err, "directory (%s) read error\n", dp->path);
+		atomic_fetch_add(&mv_errors, 1);
+	}
+	dir_reader_close(&dr);
+
+	mv_dir_release(dp);
+	return;
+
+error:
+	fprintf(sh_err, "directory (%s) copy error: %s\n", dp->path,
+			strerror(errno));
+	atomic_fetch_add(&mv_errors, 1);
+	mv_dir_release(dp);
+}
+
+
+void mv_file_task(void *arg)
+{
+	struct mv_file *fp = arg;
+	struct mv_dir *dp = fp->dir;
+	char path[MAXPATH];
+
+	snprintf(path, MAXPATH, "%s/%s", dp->path, fp->name);
+	mv_copy_entry(dp->src_fd, fp->name, dp->dst_fd, fp->name, path);
+
+	free(fp);
+	mv_dir_release(dp);
+}
+
+
+/*
+ * mv_copy_entry
+ *
+ * 디렉터리가 아닌 항목 하나를 복사한다. (정규 파일, 심볼릭 링크, 특수 파일)
+ * 정규 파일은 데이터를 복사하고 fsync 한다.
+ * path 는 에러 메시지에 사용한다.
+ */
+void mv_copy_entry(int src_dirfd, char *src_name, int dst_dirfd,
+				   char *dst_name, char *path)
+{
+	struct stat st;
+	struct timespec times[2];
+	char target[MAXPATH];
+	int in_fd = -1, out_fd = -1;
+	ssize_t len;
+	off_t bytes;
+
+	if (fstatat(src_dirfd, src_name, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+		goto error;
+	}
+	times[0] = st.st_atim;
+	times[1] = st.st_mtim;
+
+	if (S_ISLNK(st.st_mode)) {
+		len = readlinkat(src_dirfd, src_name, target, MAXPATH - 1);
+		if (len < 0) {
+			goto error;
+		}
+		target[len] = '\0';
+		if (symlinkat(target, dst_dirfd, dst_name) < 0) {
+			goto error;
+		}
+		utimensat(dst_dirfd, dst_name, times, AT_SYMLINK_NOFOLLOW);
+	} else if (!S_ISREG(st.st_mode)) {
+		// fifo, 장치 파일 등은 다시 만든다.
+		if (mknodat(dst_dirfd, dst_name, st.st_mode, st.st_rdev) < 0) {
+			goto error;
+		}
+		utimensat(dst_dirfd, dst_name, times, 0);
+	} else {
+		in_fd = openat(src_dirfd, src_name, O_RDONLY | O_CLOEXEC);
+		if (in_fd < 0) {
+			goto error;
+		}
+		out_fd = openat(dst_dirfd, dst_name,
+				O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+		if (out_fd < 0) {
+			goto error;
+		}
+
+		bytes = copy_fd_data(in_fd, out_fd);
+		if (bytes < 0) {
+			goto error;
+		}
+		if (geteuid() == 0) {
+			fchown(out_fd, st.st_uid, st.st_gid);
+		}
+		if (fchmod(out_fd, st.st_mode & 07777) < 0 ||
+			futimens(out_fd, times) < 0 || fsync(out_fd) < 0) {
+			goto error;
+		}
+
+		close(in_fd);
+		close(out_fd);
+		atomic_fetch_add(&mv_bytes, bytes);
+	}
+
+	atomic_fetch_add(&mv_files, 1);
+	return;
+
+error:
+	fprintf(sh_err, "file (%s) copy error: %s\n", path, strerror(errno));
+	atomic_fetch_add(&mv_errors, 1);
+	if (in_fd >= 0) {
+		close(in_fd);
+	}
+	if (out_fd >= 0) {
+		close(out_fd);
+	}
+}
+
+
+/*
+ * mv_sync_parent
+ *
+ * path 가 들어 있는 디렉터리를 fsync 한다.
+ */
+int mv_sync_parent(char *path)
+{
+	char dir[MAXPATH];
+	char *slash;
+	int fd, ret;
+
+	if (snprintf(dir, MAXPATH, "%s", path) >= MAXPATH) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	// 끝의 '/' 는 이름의 일부가 아니다.
+	slash = dir + strlen(dir);
+	while (slash > dir + 1 && slash[-1] == '/') {
+		*--slash = '\0';
+	}
+	slash = strrchr(dir, '/');
+	if (slash == NULL) {
+		strcpy(dir, ".");
+	} else if (slash == dir) {
+		dir[1] = '\0';
+	} else {
+		*slash = '\0';
+	}
+
+	fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) {
+		return -1;
+	}
+	ret = fsync(fd);
+	close(fd);
+
+	return ret;
+}
+
+
+int change_directory(int argc, char **argv)
+{
+	char *dirname;
+	int ret;
+
+	if (argc != 2) {
+		fprintf(sh_err, "Usage: %s <dir_name>\n", argv[0]);
+		return 1;
+	}
+
+	dirname = argv[1];
+
+	ret = chdir(dirname);
+	if (ret != 0) {
+		fprintf(sh_err, "change directory error\n");
+	}
+
+	return ret;
+}
+
+
+int print_working_directory(int argc, char **argv)
+{
+	char *cwd;
+
+	(void)argc;
+	(void)argv;
+
+	cwd = getcwd(NULL, 0);
+	if (cwd == 0) {
+		fprintf(sh_err, "get current working directory error\n");
+		return 1;
+	}
+
+	fprintf(sh_out, "%s\n", cwd);
+	free(cwd);
+
+	return 0;
+}
+
+
+int make_directory(int argc, char **argv)
+{
+	char *dirname;
+	int ret;
+
+	if (argc != 2) {
+		fprintf(sh_err, "Usage: %s <dir_name>\n", argv[0]);
+		return 1;
+	}
+
+	dirname = argv[1];
+
+	ret = mkdir(dirname, DEFAULT_DIR_MODE);
+	if (ret != 0) {
+		fprintf(sh_err, "make directory error\n");
+	}
+
+	return ret;
+}
+
+
+int remove_directory(int argc, char **argv)
+{
+	char *dirname;
+	int ret;
+
+	if (argc != 2) {
+		fprintf(sh_err, "Usage: %s <dir_name>\n", argv[0]);
+		return 1;
+	}
+
+	dirname = argv[1];
+
+	ret = rmdir(dirname);
+	if (ret != 0) {
+		fprintf(sh_err, "remove directory error\n");
+	}
+
+	return ret;
+}
+
+
+/* 
+ * copy_directory
+ *
+ * source와 destination 디렉터리를 입력 받는다.
+ * source의 각 파일에 대해 디렉터리가 아닌 경우, 복사 큐에 넣고
+ *   복사 스레드 (dcp_worker) 가 destination 디렉터리에 같은 이름으로 복사한다.
+ * 동시에 복사하는 스레드 개수는 dcp_monitor 가 처리량에 따라 조절하며,
+ *   -j 로 고정할 수 있다. 터미널이면 진행 상황 (처리량, 남은 시간) 을
+ *   한 줄로 갱신하고, 끝나면 요약과 실패한 파일 목록을 출력한다.
+ *   -v 이면 파일마다, 그리고 조절 주기마다 처리량과 결정을 출력한다.
+ * 하드링크된 파일은 한 번만 복사하고 나머지는 링크로, 심볼릭 링크는
+ * 심볼릭 링크로, FIFO 와 장치 파일은 새로 만든다. (dcp_link_entry)
+ * 복사에 실패한 파일이 있으면 1 을 리턴한다.
+ * -V 이면 복사한 데이터를 CRC32C 로 검증하고 결과를 출력한다.
+ * DCP_SMALL_SIZE 이하의 파일은 경로를 만들지 않고 DCP_BATCH_FILES 개씩
+ * 묶어 큐에 넣는다. (dcp_copy_batch, -V/-B 는 제외)
+ */
+int copy_directory(int argc, char **argv)
+{
+	char *src_dirname, *dst_dirname;
+	char src_path[MAXPATH], dst_path[MAXPATH];
+	DIR *dp, *tmp_dp;
+	struct dirent *d_entry;
+	struct stat statbuf;
+	struct dcp_link *links[DCP_HASH_BUCKETS] = { NULL }, *lp;
+	struct dcp_batch *batch = NULL;
+	struct dcp_fail *fp;
+	struct dcp_file f;
+	struct timespec start, end;
+	pthread_t mon_tid;
+	long files, errors;
+	long long bytes, lat;
+	int i, ret, failed = 0, nworkers = 0, mon, len;
+	char *name = argv[0];
+	double sec;
+
+	// 옵션 처리: -V (복사한 데이터를 CRC32C 로 검증), -B (bulk 복사),
+	// -j <스레드 개수>, -v
+	copy_verify = 0;
+	copy_bulk = 0;
+	copy_verbose = 0;
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (!strcmp(argv[i], "-V")) {
+			copy_verify = 1;
+			crc32c_init();
+		} else if (!strcmp(argv[i], "-B")) {
+			copy_bulk = 1;
+		} else if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+			nworkers = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-v")) {
+			copy_verbose = 1;
+		} else {
+			break;
+		}
+	}
+	argv += i - 1;
+	argc -= i - 1;
+
+	// 명령 인자 개수를 확인
+	if (argc != 3) {
+		fprintf(sh_err, "Usage: %s [-V] [-B] [-j threads] [-v] <src_dir> <dst_dir>\n",
+				name);
+		return 1;
+	}
+	src_dirname = argv[1];
+	dst_dirname = argv[2];
+
+	// source 디렉터리 열기
+	dp = opendir(src_dirname);
+	if (dp == NULL) {
+		fprintf(sh_err, "directory <%s> open error\n", src_dirname);
+		return 1;
+	}
+
+	// destination 디렉터리 열기
+	tmp_dp = opendir(dst_dirname);
+	if (tmp_dp == NULL) {
+		// destination 디렉터리 생성
+		ret = mkdir(dst_dirname, DEFAULT_DIR_MODE);
+		if (ret != 0) {
+			fprintf(sh_err, "directory <%s> creation error\n", dst_dirname);
+			closedir(dp);
+			return 1;
+		}
+	} else {
+		closedir(tmp_dp);
+	}
+
+	// 작은 파일은 디렉터리 fd 에 대해 openat 으로 복사한다.
+	dcp_src_name = src_dirname;
+	dcp_dst_name = dst_dirname;
+	if (!copy_verify && !copy_bulk) {
+		dcp_src_fd = open(src_dirname, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		dcp_dst_fd = open(dst_dirname, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	}
+
+	// 동시 복사 개수: 회전 디스크이면 적게 시작하고 상한도 낮춘다.
+	dcp_rotational = (dev_rotational(src_dirname) > 0 ||
+					  dev_rotational(dst_dirname) > 0);
+	if (nworkers > 0) {
+		dcp_max = dcp_limit = (nworkers < DCP_MAXWORKERS) ?
+			nworkers : DCP_MAXWORKERS;
+	} else {
+		dcp_max = dcp_rotational ? DCP_ROT_MAXWORKERS : DCP_MAXWORKERS;
+		dcp_limit = dcp_rotational ? 1 : pool_default_threads();
+		if (dcp_limit < 2 && !dcp_rotational) {
+			dcp_limit = 2;
+		}
+	}
+	dcp_auto = (nworkers <= 0);
+	dcp_progress = !copy_verbose && isatty(fileno(sh_err));
+	dcp_qhead = dcp_qtail = 0;
+	dcp_eof = 0;
+	dcp_nworkers = 0;
+	memset(dcp_stats, 0, sizeof(dcp_stats));
+	dcp_total_files = dcp_total_bytes = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pthread_mutex_lock(&dcp_lock);
+	dcp_add_workers();
+	pthread_mutex_unlock(&dcp_lock);
+	if (dcp_nworkers == 0) {
+		fprintf(sh_err, "thread creation error\n");
+		closedir(dp);
+		failed = 1;
+		goto out;
+	}
+	mon = (pthread_create(&mon_tid, NULL, dcp_monitor, NULL) == 0);
+
+	// 모든 파일을 복사 큐에 넣는다.
+	d_entry = readdir(dp);
+	while (d_entry != NULL) {
+#if 0
+		// 소스 파일 확인
+		sprintf(src_path, "%s/%s", src_dirname, d_entry->d_name);
+		if (stat(src_path, &statbuf)) {
+			fprintf(sh_err, "file (%s) access error\n", src_path);
+
+			// 다음 파일 이름 읽기
+			d_entry = readdir(dp);
+			continue;
+		}
+
+		// 디렉터리는 무시
+		if (S_ISDIR(statbuf.st_mode)) {
+			// 다음 파일 이름 읽기
+			d_entry = readdir(dp);
+			continue;
+		}
+#else
+		// 디렉터리는 무시
+		if (d_entry->d_type == DT_DIR) {
+			// 다음 파일 이름 읽기
+			d_entry = readdir(dp);
+			continue;
+		}
+#endif
+
+		// 하드링크, 심볼릭 링크, 특수 파일은 데이터를 복사하지 않는다.
+		if (fstatat(dirfd(dp), d_entry->d_name, &statbuf,
+					AT_SYMLINK_NOFOLLOW) != 0) {
+			dcp_batch_fail(src_dirname, d_entry->d_name, "access", errno);
+			failed = 1;
+			d_entry = readdir(dp);
+			continue;
+		}
+
+		// 작은 파일은 이름만 묶음에 넣는다. (경로를 만들지 않음)
+		len = strlen(d_entry->d_name) + 1;
+		if (dcp_src_fd >= 0 && dcp_dst_fd >= 0 && S_ISREG(statbuf.st_mode) &&
+			statbuf.st_nlink < 2 && statbuf.st_size <= DCP_SMALL_SIZE &&
+			(batch != NULL || (batch = calloc(1, sizeof(*batch))) != NULL)) {
+			if (batch->n > 0 && batch->used + len > DCP_BATCH_NAMES) {
+				f.src = f.dst = NULL;
+				f.batch = batch;
+				dcp_queue_put(&f);
+				batch = calloc(1, sizeof(*batch));
+			}
+			if (batch != NULL) {
+				batch->name[batch->n++] = batch->used;
+				memcpy(batch->names + batch->used, d_entry->d_name, len);
+				batch->used += len;
+				dcp_total_files++;
+				dcp_total_bytes += statbuf.st_size;
+				if (batch->n == DCP_BATCH_FILES) {
+					f.src = f.dst = NULL;
+					f.batch = batch;
+					dcp_queue_put(&f);
+					batch = NULL;
+				}
+				d_entry = readdir(dp);
+				continue;
+			}
+		}
+
+		// 소스와 destination 경로 이름 완성
+		sprintf(src_path, "%s/%s", src_dirname, d_entry->d_name);
+		sprintf(dst_path, "%s/%s", dst_dirname, d_entry->d_name);
+
+		ret = dcp_link_entry(src_path, dst_path, &statbuf, links);
+		if (ret != 0) {
+			failed |= (ret < 0);
+			d_entry = readdir(dp);
+			continue;
+		}
+
+		// 복사 큐에 넣는다. (가득 차 있으면 기다림)
+		if (dcp_enqueue(src_path, dst_path) != 0) {
+			dcp_fail_add(src_path, "queue", ENOMEM);
+			failed = 1;
+		} else {
+			dcp_total_files++;
+			dcp_total_bytes += statbuf.st_size;
+		}
+
+		// 다음 파일 이름 읽기
+		d_entry = readdir(dp);
+	}
+
+	closedir(dp);
+	if (batch != NULL && batch->n > 0) {
+		f.src = f.dst = NULL;
+		f.batch = batch;
+		dcp_queue_put(&f);
+	} else {
+		free(batch);
+	}
+
+	// 큐가 빌 때까지 조절을 계속하고, 모든 복사 스레드를 기다림
+	pthread_mutex_lock(&dcp_lock);
+	dcp_eof = 1;
+	pthread_cond_broadcast(&dcp_cond);
+	pthread_mutex_unlock(&dcp_lock);
+	if (mon) {
+		pthread_join(mon_tid, NULL);
+	}
+	for (i = 0; i < dcp_nworkers; i++) {
+		if (pthread_join(dcp_tid[i], NULL) != 0) {
+			fprintf(sh_err, "thread join error\n");
+			failed = 1;
+		}
+	}
+	dcp_sum(&files, &bytes, &errors, &lat);
+	failed |= (errors > 0);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	for (i = 0; i < DCP_HASH_BUCKETS; i++) {
+		while ((lp = links[i]) != NULL) {
+			links[i] = lp->next;
+			free(lp);
+		}
+	}
+
+	// 처리량, 선택한 동시 복사 개수, 실패한 파일 목록
+	if (dcp_progress) {
+		fprintf(sh_err, "\r\033[K");
+	}
+	fprintf(sh_out, "dcp: %ld files, %.1f MB in %.2f s (%.1f MB/s), "
+			"%d threads (max %d, %s)", files - errors, bytes / 1e6,
+			sec, (sec > 0) ? bytes / 1e6 / sec : 0.0, dcp_limit, dcp_max,
+			dcp_rotational ? "rotational" : "non-rotational");
+	for (i = 0, fp = dcp_fails; fp != NULL; fp = fp->next) {
+		i++;
+	}
+	fprintf(sh_out, i ? ", %d failed:\n" : "\n", i);
+	while ((fp = dcp_fails) != NULL) {
+		fprintf(sh_out, "  %s\n", fp->msg);
+		dcp_fails = fp->next;
+		free(fp);
+	}
+	dcp_fail_tail = &dcp_fails;
+
+	if (copy_verify) {
+		verify_report(sh_out, failed);
+		failed |= (verify_bad > 0);
+	}
+
+out:
+	if (dcp_src_fd >= 0) {
+		close(dcp_src_fd);
+	}
+	if (dcp_dst_fd >= 0) {
+		close(dcp_dst_fd);
+	}
+	dcp_src_fd = dcp_dst_fd = -1;
+
+	return failed;
+}
+
+
+/*
+ * dcp_enqueue
+ *
+ * 복사할 파일을 dcp 복사 큐에 넣는다. 큐가 가득 차 있으면 기다린다.
+ */
+int dcp_enqueue(char *src, char *dst)
+{
+	struct dcp_file f;
+
+	f.src = strdup(src);
+	f.dst = strdup(dst);
+	f.batch = NULL;
+	if (f.src == NULL || f.dst == NULL) {
+		free(f.src);
+		free(f.dst);
+		return 1;
+	}
+	dcp_queue_put(&f);
+
+	return 0;
+}
+
+
+/*
+ * dcp_queue_put
+ *
+ * 복사 작업 (파일 혹은 작은 파일 묶음) 을 큐에 넣는다.
+ * 큐가 가득 차 있으면 기다린다.
+ */
+void dcp_queue_put(struct dcp_file *f)
+{
+	pthread_mutex_lock(&dcp_lock);
+	while (dcp_qtail - dcp_qhead == DCP_QUEUE_SIZE) {
+		pthread_cond_wait(&dcp_cond, &dcp_lock);
+	}
+	dcp_queue[dcp_qtail++ % DCP_QUEUE_SIZE] = *f;
+	pthread_cond_broadcast(&dcp_cond);
+	pthread_mutex_unlock(&dcp_lock);
+}
+
+
+/*
+ * dcp_add_workers
+ *
+ * dcp_limit 개가 될 때까지 복사 스레드를 만든다. (dcp_lock 을 가진 상태)
+ * 만들지 못하면 dcp_limit 를 만든 개수로 줄인다.
+ */
+void dcp_add_workers(void)
+{
+	while (dcp_nworkers < dcp_limit) {
+		if (pthread_create(&dcp_tid[dcp_nworkers], NULL, dcp_worker,
+						   (void *)(long)dcp_nworkers) != 0) {
+			dcp_limit = dcp_nworkers;
+			break;
+		}
+		dcp_nworkers++;
+	}
+}
+
+
+/*
+ * dcp_worker
+ *
+ * 복사 스레드: 큐에서 파일을 꺼내 복사한다. 스레드 번호가 dcp_limit
+ * 이상이면 (동시 복사 개수가 줄어들면) 다시 늘어날 때까지 쉰다.
+ * 큐가 비고 더 넣을 파일이 없으면 종료한다.
+ * 작은 파일 묶음은 스레드마다 하나씩 할당한 버퍼로 복사한다.
+ */
+void *dcp_worker(void *arg)
+{
+	int id = (long)arg;
+	struct dcp_stat *st = &dcp_stats[id];
+	struct dcp_file f;
+	struct timespec t0, t1;
+	char *buf = NULL;
+	long nfiles, errors;
+	long long before;
+	off_t n;
+
+	// 복사 도중의 바이트는 copy_report 가 st->bytes 에 바로 더한다.
+	copy_progress = &st->bytes;
+
+	// place 로 지정한 실행 위치를 복사 스레드에 적용한다.
+	if (cmd_place.set && place_apply(&cmd_place) < 0) {
+		dcp_fail_add("placement", "thread", errno);
+	}
+
+	pthread_mutex_lock(&dcp_lock);
+	while (1) {
+		if (dcp_qhead == dcp_qtail && dcp_eof) {
+			break;
+		}
+		if (id >= dcp_limit || dcp_qhead == dcp_qtail) {
+			pthread_cond_wait(&dcp_cond, &dcp_lock);
+			continue;
+		}
+		f = dcp_queue[dcp_qhead++ % DCP_QUEUE_SIZE];
+		pthread_cond_broadcast(&dcp_cond);
+		pthread_mutex_unlock(&dcp_lock);
+
+		if (copy_verbose && f.batch == NULL) {
+			fprintf(sh_out, "Thread[%d]: copy \"%s\" into \"%s\"\n", id,
+					f.src, f.dst);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		before = atomic_load_explicit(&st->bytes, memory_order_relaxed);
+		if (f.batch != NULL) {
+			if (buf == NULL) {
+				buf = malloc(DCP_SMALL_SIZE);
+			}
+			n = dcp_copy_batch(f.batch, buf, id, &errors);
+			nfiles = f.batch->n;
+			free(f.batch);
+		} else {
+			n = dcp_copy_file(f.src, f.dst);
+			nfiles = 1;
+			errors = (n < 0);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+
+		// 자신의 통계만 갱신한다. (다른 스레드와 공유하지 않는 cache line)
+		// 묶음은 파일 개수만큼 세어 파일당 지연을 유지한다.
+		// 바이트는 복사 도중에 알린 만큼을 빼고 더한다. (실패하면 되돌림)
+		atomic_fetch_add_explicit(&st->errors, errors, memory_order_relaxed);
+		atomic_fetch_add_explicit(&st->bytes, ((n > 0) ? n : 0) -
+				(atomic_load_explicit(&st->bytes, memory_order_relaxed) - before),
+				memory_order_relaxed);
+		atomic_fetch_add_explicit(&st->files, nfiles, memory_order_relaxed);
+		atomic_fetch_add_explicit(&st->lat_ns,
+				(t1.tv_sec - t0.tv_sec) * 1000000000LL +
+				(t1.tv_nsec - t0.tv_nsec), memory_order_relaxed);
+		free(f.src);
+		free(f.dst);
+
+		pthread_mutex_lock(&dcp_lock);
+	}
+	pthread_mutex_unlock(&dcp_lock);
+	free(buf);
+
+	return NULL;
+}
+
+
+/*
+ * dcp_copy_file
+ *
+ * in_file 을 out_file 로 복사하고 복사한 바이트 수를 리턴한다.
+ * 실패하면 실패 목록에 추가하고 -1 을 리턴한다.
+ */
+off_t dcp_copy_file(char *in_file, char *out_file)
+{
+	struct stat statbuf;
+    int in_fd, out_fd, ret = 0;
+	off_t n = 0;
+ 
+	// 소스 파일을 열고, 목적 파일을 생성한다.
+	in_fd = open(in_file, O_RDONLY | O_CLOEXEC);
+	if (in_fd < 0) {
+		dcp_fail_add(in_file, "open", errno);
+		return -1;
+	}
+
+	out_fd = open(out_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+				DEFAULT_FILE_MODE);
+	if (out_fd < 0) {
+		dcp_fail_add(out_file, "create", errno);
+		close(in_fd);
+		return -1;
+	}
+ 
+	// 소스 파일의 끝까지 목적 파일로 복사한다.
+	if (copy_verify) {
+		ret = copy_fd_verify(in_file, in_fd, out_fd);
+		if (ret != 0) {
+			dcp_fail_add(in_file, "verify", 0);
+		}
+		if (fstat(in_fd, &statbuf) == 0) {
+			n = statbuf.st_size;
+		}
+	} else if ((n = copy_bulk ? copy_fd_bulk(in_fd, out_fd) :
+						copy_fd_data(in_fd, out_fd)) < 0) {
+		dcp_fail_add(in_file, "copy", errno);
+		ret = 1;
+	}
+
+	// 소스와 목적 파일을 닫는다.
+    close(in_fd);
+    if (close(out_fd) < 0 && ret == 0) {
+		dcp_fail_add(out_file, "close", errno);
+		ret = 1;
+	}
+
+	return ret ? -1 : n;
+}
+
+
+/*
+ * dcp_copy_batch
+ *
+ * 작은 파일 묶음을 복사한다. source/destination 디렉터리 fd 에 대해
+ * openat 하고 (경로 해석은 이름 하나만), 파일마다 buf 로 한 번에 읽어 쓴다.
+ * 나열한 뒤 DCP_SMALL_SIZE 이상으로 자란 파일은 나머지를 copy_fd_data 로
+ * 복사한다. 복사한 바이트 수를 리턴하고, 실패한 파일 개수를 *errors 에 넣는다.
+ */
+long long dcp_copy_batch(struct dcp_batch *b, char *buf, int id, long *errors)
+{
+	long long total = 0;
+	ssize_t rd_count, wt_count, n;
+	off_t m = 0;
+	char *name;
+	int i, in_fd, out_fd;
+
+	*errors = 0;
+	for (i = 0; i < b->n; i++) {
+		name = b->names + b->name[i];
+		if (copy_verbose) {
+			fprintf(sh_out, "Thread[%d]: copy \"%s/%s\" into \"%s/%s\"\n", id,
+					dcp_src_name, name, dcp_dst_name, name);
+		}
+
+		in_fd = openat(dcp_src_fd, name, O_RDONLY | O_CLOEXEC);
+		if (in_fd < 0 || buf == NULL) {
+			dcp_batch_fail(dcp_src_name, name, "open", buf ? errno : ENOMEM);
+			if (in_fd >= 0) {
+				close(in_fd);
+			}
+			(*errors)++;
+			continue;
+		}
+		out_fd = openat(dcp_dst_fd, name, O_WRONLY | O_CREAT | O_TRUNC |
+						O_CLOEXEC, DEFAULT_FILE_MODE);
+		if (out_fd < 0) {
+			dcp_batch_fail(dcp_dst_name, name, "create", errno);
+			close(in_fd);
+			(*errors)++;
+			continue;
+		}
+
+		rd_count = read(in_fd, buf, DCP_SMALL_SIZE);
+		for (n = 0; n < rd_count; n += wt_count) {
+			wt_count = write(out_fd, buf + n, rd_count - n);
+			if (wt_count <= 0) {
+				rd_count = -1;
+				break;
+			}
+		}
+		if (rd_count == DCP_SMALL_SIZE) {
+			m = copy_fd_data(in_fd, out_fd);
+		}
+		close(in_fd);
+		if (rd_count < 0 || m < 0) {
+			dcp_batch_fail(dcp_src_name, name, "copy", errno);
+			close(out_fd);
+			(*errors)++;
+		} else if (close(out_fd) < 0) {
+			dcp_batch_fail(dcp_dst_name, name, "close", errno);
+			(*errors)++;
+		} else {
+			total += rd_count + m;
+		}
+		m = 0;
+	}
+
+	return total;
+}
+
+
+/*
+ * dcp_batch_fail
+ *
+ * dir 안의 name 을 경로로 만들어 실패 목록에 추가한다.
+ */
+void dcp_batch_fail(char *dir, char *name, const char *what, int err)
+{
+	char path[MAXPATH];
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	dcp_fail_add(path, what, err);
+}
+
+
+/*
+ * dcp_monitor
+ *
+ * DCP_INTERVAL_MS 마다 복사 스레드별 통계를 합산하여 처리량 (MB/s) 과
+ * 파일당 지연을 재고, 진행 상황을 출력하며 동시 복사 개수 (dcp_limit) 를
+ * 조절한다. (-j 로 고정하지 않은 경우, hill climbing)
+ *   - 늘린 뒤 처리량이 10% 이상 좋아지면 계속 두 배로 늘린다. (ramp)
+ *   - 늘렸는데 좋아지지 않으면 이전 값으로 되돌리고 유지한다. (hold)
+ *   - 유지 중 처리량이 20% 이상 떨어지고 지연이 늘면 하나 줄인다. (backoff)
+ *   - 유지 중에는 8 주기마다 하나 늘려 본다. (probe)
+ * 터미널이면 진행 줄 (파일, 크기, 처리량, 남은 시간) 을 갱신하고,
+ * -v 이면 주기마다 측정값과 결정을 출력한다.
+ */
+void *dcp_monitor(void *arg)
+{
+	struct timespec now, deadline, start;
+	long last_files = 0, files, nfiles, errors;
+	long long last_bytes = 0, last_lat = 0, bytes, nbytes, lat, total;
+	double rate, lat_ms, best_rate = 0, best_lat = 0, t, eta;
+	int best_limit = dcp_limit, ramp = 1, hold = 0, old;
+	const char *why;
+
+	(void)arg;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	clock_gettime(CLOCK_REALTIME, &deadline);
+
+	pthread_mutex_lock(&dcp_lock);
+	while (!(dcp_eof && dcp_qhead == dcp_qtail)) {
+		// 다음 주기까지 기다린다. (큐가 비면 일찍 깨어남)
+		deadline.tv_nsec += DCP_INTERVAL_MS * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		while (!(dcp_eof && dcp_qhead == dcp_qtail) &&
+			   pthread_cond_timedwait(&dcp_cond, &dcp_lock, &deadline) == 0)
+			;
+		if (dcp_eof && dcp_qhead == dcp_qtail) {
+			break;
+		}
+
+		dcp_sum(&nfiles, &nbytes, &errors, &lat);
+		files = nfiles - last_files;
+		bytes = nbytes - last_bytes;
+		lat -= last_lat;
+		last_files = nfiles;
+		last_bytes = nbytes;
+		last_lat += lat;
+		rate = bytes / 1e6 / (DCP_INTERVAL_MS / 1000.0);
+		// 큰 파일만 복사 중인 주기에는 끝난 파일이 없으므로 지연은 이전 값을 쓴다.
+		lat_ms = files ? lat / 1e6 / files : best_lat;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		t = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+
+		// 진행 줄: 남은 시간은 지금까지의 평균 처리량으로 계산한다.
+		// (아직 디렉터리를 읽는 중이면 '+')
+		if (dcp_progress) {
+			total = dcp_total_bytes;
+			eta = (nbytes > 0) ? (total - nbytes) * t / nbytes : 0;
+			fprintf(sh_err, "\r\033[Kdcp: %ld/%ld%s files, %.1f/%.1f MB, "
+					"%.1f MB/s, %d threads, ETA %d:%02d%s%s",
+					nfiles, (long)dcp_total_files, dcp_eof ? "" : "+",
+					nbytes / 1e6, total / 1e6, rate, dcp_limit,
+					(int)eta / 60, (int)eta % 60, dcp_eof ? "" : "+",
+					errors ? ", errors" : "");
+			fflush(sh_err);
+		}
+		if (!dcp_auto) {
+			continue;
+		}
+
+		old = dcp_limit;
+		why = "hold";
+		if (files == 0 && bytes == 0) {
+			why = "idle";
+		} else if (ramp) {
+			if (rate > best_rate * 1.1 || best_rate == 0) {
+				best_rate = rate;
+				best_lat = lat_ms;
+				best_limit = dcp_limit;
+				if (dcp_limit < dcp_max) {
+					dcp_limit = (dcp_limit * 2 < dcp_max) ?
+						dcp_limit * 2 : dcp_max;
+					why = "ramp";
+				} else {
+					ramp = 0;
+				}
+			} else {
+				dcp_limit = best_limit;
+				ramp = 0;
+				why = "revert";
+			}
+		} else if (rate < best_rate * 0.8 && lat_ms > best_lat * 1.5 &&
+				   dcp_limit > 1) {
+			dcp_limit--;
+			best_rate = rate;
+			best_lat = lat_ms;
+			why = "backoff";
+		} else if (++hold % 8 == 0 && dcp_limit < dcp_max) {
+			best_rate = rate;
+			best_lat = lat_ms;
+			best_limit = dcp_limit++;
+			ramp = 1;
+			why = "probe";
+		} else if (rate > best_rate) {
+			best_rate = rate;
+			best_lat = lat_ms;
+		}
+
+		if (dcp_limit > old) {
+			dcp_add_workers();
+		}
+		pthread_cond_broadcast(&dcp_cond);
+
+		if (copy_verbose) {
+			fprintf(sh_out, "dcp: %6.2fs %6ld files %9.1f MB/s %8.2f ms/file "
+					"threads %d -> %d (%s)\n", t, files, rate, lat_ms, old,
+					dcp_limit, why);
+		}
+	}
+	pthread_mutex_unlock(&dcp_lock);
+
+	return NULL;
+}
+
+
+/*
+ * dcp_sum
+ *
+ * 복사 스레드별 통계를 합산한다.
+ */
+void dcp_sum(long *files, long long *bytes, long *errors, long long *lat)
+{
+	int i;
+
+	*files = *errors = 0;
+	*bytes = *lat = 0;
+	for (i = 0; i < DCP_MAXWORKERS; i++) {
+		*files += atomic_load_explicit(&dcp_stats[i].files,
+									   memory_order_relaxed);
+		*errors += atomic_load_explicit(&dcp_stats[i].errors,
+										memory_order_relaxed);
+		*bytes += atomic_load_explicit(&dcp_stats[i].bytes,
+									   memory_order_relaxed);
+		*lat += atomic_load_explicit(&dcp_stats[i].lat_ns,
+									 memory_order_relaxed);
+	}
+}
+
+
+/*
+ * dcp_fail_add
+ *
+ * 실패 목록에 "path: what: 에러" 를 추가한다. -v 이면 바로 출력한다.
+ * err 가 0 이면 에러 문자열 없이 추가한다.
+ */
+void dcp_fail_add(const char *path, const char *what, int err)
+{
+	struct dcp_fail *fp;
+	int len;
+
+	len = strlen(path) + strlen(what) + 64 + (err ? strlen(strerror(err)) : 0);
+	fp = malloc(sizeof(*fp) + len);
+	if (fp == NULL) {
+		return;
+	}
+	snprintf(fp->msg, len, "%s: %s%s%s", path, what, err ? ": " : " failed",
+			 err ? strerror(err) : "");
+	fp->next = NULL;
+
+	if (copy_verbose) {
+		fprintf(sh_err, "%s\n", fp->msg);
+	}
+
+	pthread_mutex_lock(&dcp_fail_lock);
+	*dcp_fail_tail = fp;
+	dcp_fail_tail = &fp->next;
+	pthread_mutex_unlock(&dcp_fail_lock);
+}
+
+
+/*
+ * dev_rotational
+ *
+ * path 가 있는 블록 장치가 회전 디스크인지 /sys/dev/block/<major>:<minor>
+ * (/sys/block 의 장치) 의 queue/rotational 로 확인한다. 파티션이면 디스크의
+ * 값을 사용한다. 회전 디스크이면 1, 아니면 0, 알 수 없으면 (tmpfs 등) -1.
+ */
+int dev_rotational(char *path)
+{
+	struct stat st;
+	char sys[MAXPATH];
+	int fd, n, i;
+	char c = 0;
+
+	if (stat(path, &st) != 0) {
+		return -1;
+	}
+
+	for (i = 0; i < 2; i++) {
+		snprintf(sys, sizeof(sys), "/sys/dev/block/%u:%u/%squeue/rotational",
+				 major(st.st_dev), minor(st.st_dev), i ? "../" : "");
+		fd = open(sys, O_RDONLY | O_CLOEXEC);
+		if (fd >= 0) {
+			n = read(fd, &c, 1);
+			close(fd);
+			return (n == 1) ? (c == '1') : -1;
+		}
+	}
+
+	return -1;
+}
+
+
+/*
+ * dcp_link_entry
+ *
+ * 데이터를 복사하지 않는 src 엔트리를 dst 에 만든다.
+ *   - 심볼릭 링크: 같은 내용의 심볼릭 링크 (대상을 따라가지 않음)
+ *   - FIFO, 장치 파일: mkfifo/mknod (권한이 없으면 건너뜀), 소켓: 건너뜀
+ *   - 링크가 여러 개인 파일: 이미 복사한 같은 inode 가 있으면 그 파일에
+ *     하드링크하고, 처음이면 links 에 기록한 뒤 복사하도록 0 을 리턴
+ * 처리했으면 1, 데이터를 복사해야 하면 0, 에러면 -1 을 리턴한다.
+ */
+int dcp_link_entry(char *src, char *dst, struct stat *st,
+				   struct dcp_link **links)
+{
+	struct dcp_link *lp;
+	char target[MAXPATH];
+	unsigned int h;
+	ssize_t n;
+	int fd;
+
+	if (S_ISREG(st->st_mode) && st->st_nlink < 2) {
+		return 0;
+	}
+
+	if (S_ISREG(st->st_mode)) {
+		h = (unsigned int)(st->st_ino ^ (st->st_dev << 7)) % DCP_HASH_BUCKETS;
+		for (lp = links[h]; lp != NULL; lp = lp->next) {
+			if (lp->ino == st->st_ino && lp->dev == st->st_dev) {
+				break;
+			}
+		}
+		if (lp == NULL) {
+			lp = malloc(sizeof(*lp) + strlen(dst) + 1);
+			if (lp != NULL) {
+				lp->dev = st->st_dev;
+				lp->ino = st->st_ino;
+				strcpy(lp->path, dst);
+				lp->next = links[h];
+				links[h] = lp;
+			}
+
+			// 복사 스레드보다 먼저 다음 링크가 연결될 수 있도록 만들어 둔다.
+			fd = open(dst, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+					  DEFAULT_FILE_MODE);
+			if (fd >= 0) {
+				close(fd);
+			}
+			return 0;
+		}
+
+		unlink(dst);
+		if (link(lp->path, dst) != 0) {
+			dcp_fail_add(dst, "link", errno);
+			return -1;
+		}
+		if (copy_verbose) {
+			fprintf(sh_out, "Link: \"%s\" to \"%s\"\n", dst, lp->path);
+		}
+		return 1;
+	}
+
+	if (S_ISLNK(st->st_mode)) {
+		n = readlink(src, target, sizeof(target) - 1);
+		if (n < 0) {
+			dcp_fail_add(src, "readlink", errno);
+			return -1;
+		}
+		target[n] = '\0';
+		unlink(dst);
+		if (symlink(target, dst) != 0) {
+			dcp_fail_add(dst, "symlink", errno);
+			return -1;
+		}
+		if (copy_verbose) {
+			fprintf(sh_out, "Symlink: \"%s\" -> \"%s\"\n", dst, target);
+		}
+		return 1;
+	}
+
+	if (S_ISFIFO(st->st_mode) || S_ISCHR(st->st_mode) || S_ISBLK(st->st_mode)) {
+		unlink(dst);
+		if (mknod(dst, st->st_mode & (S_IFMT | 07777), st->st_rdev) != 0) {
+			if (errno != EPERM) {
+				dcp_fail_add(dst, "mknod", errno);
+				return -1;
+			}
+			if (copy_verbose) {
+				fprintf(sh_err, "special file (%s) skipped: %s\n", src,
+						strerror(errno));
+			}
+			return 1;
+		}
+		if (copy_verbose) {
+			fprintf(sh_out, "Special: \"%s\"\n", dst);
+		}
+		return 1;
+	}
+
+	if (copy_verbose) {
+		fprintf(sh_err, "special file (%s) skipped\n", src);
+	}
+	return 1;
+}
+
+
+/*
+ * parallel [-j slots] [-a file] [-v] command [args...] [::: arg...]
+ *
+ * 인자 목록의 각 인자로 command 를 최대 slots 개 (기본값: CPU 개수) 씩
+ * 동시에 실행한다. 인자는 ::: 뒤의 단어, -a 파일의 줄, 또는 입력 (stdin) 의
+ * 줄이다. command 의 {} 는 인자로 바뀌며, {} 가 없으면 인자를 끝에 붙인다.
+ *
+ * 각 job 의 stdout, stderr 는 job 별 버퍼에 따로 모았다가 job 이 끝나면
+ * 각각 한번에 출력하므로 job 들의 출력이 섞이지 않는다. (끝난 순서대로 출력)
+ * 버퍼는 각각 PAR_BUF_MAX (1 MB) 까지만 메모리에 두고, 넘는 출력은
+ * 이름 없는 임시 파일 (/tmp, O_TMPFILE) 에 모은다.
+ * 실패한 job 과 (-v 이면 모든 job 의) 종료 상태, 전체 처리량을 출력한다.
+ */
+int run_parallel(int argc, char **argv)
+{
+	struct par_src src = { 0 };
+	struct par_job *jobs;
+	struct pollfd *pfd;
+	struct timespec start, end;
+	char *arg, **tmpl;
+	int i, j, ntmpl, slots = 0, verbose = 0, running = 0, status, null_fd;
+	long seq = 0, failed = 0;
+	double sec;
+	char *file = NULL;
+
+	// 옵션 처리: -j <slot 개수>, -a <인자 파일>, -v
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+			slots = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-a") && i + 1 < argc) {
+			file = argv[++i];
+		} else if (!strcmp(argv[i], "-v")) {
+			verbose = 1;
+		} else {
+			break;
+		}
+	}
+
+	// command 와 ::: 뒤의 인자 목록
+	tmpl = argv + i;
+	for (ntmpl = 0; i < argc && strcmp(argv[i], ":::"); i++, ntmpl++)
+		;
+	if (ntmpl == 0) {
+		fprintf(sh_err, "Usage: %s [-j slots] [-a file] [-v] command "
+				"[args...] [::: arg...]\n", argv[0]);
+		return 1;
+	}
+	if (i < argc) {
+		src.list = argv + i + 1;
+		src.n = argc - i - 1;
+	} else if (file != NULL) {
+		src.fp = fopen(file, "re");
+		if (src.fp == NULL) {
+			fprintf(sh_err, "%s: %s\n", file, strerror(errno));
+			return 1;
+		}
+	} else if (sh_in == STDIN_FILENO) {
+		// 셸의 입력과 같은 버퍼를 사용해야 줄을 잃지 않는다.
+		src.fp = stdin;
+	} else {
+		src.fp = fdopen(dup(sh_in), "r");
+		if (src.fp == NULL) {
+			fprintf(sh_err, "parallel: %s\n", strerror(errno));
+			return 1;
+		}
+	}
+
+	if (slots <= 0) {
+		slots = sysconf(_SC_NPROCESSORS_ONLN);
+		if (slots <= 0) {
+			slots = 1;
+		}
+	}
+
+	// slot i 의 stdout 파이프는 pfd[2 * i], stderr 파이프는 pfd[2 * i + 1]
+	jobs = calloc(slots, sizeof(*jobs));
+	pfd = malloc(sizeof(*pfd) * slots * 2);
+	null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+	if (jobs == NULL || pfd == NULL || null_fd < 0) {
+		fprintf(sh_err, "parallel: %s\n", strerror(errno));
+		free(jobs);
+		free(pfd);
+		if (null_fd >= 0) {
+			close(null_fd);
+		}
+		if (src.fp != NULL && src.fp != stdin) {
+			fclose(src.fp);
+		}
+		return 1;
+	}
+	for (i = 0; i < slots * 2; i++) {
+		pfd[i].fd = -1;
+		pfd[i].events = POLLIN;
+		jobs[i / 2].buf[i % 2].spill_fd = -1;
+	}
+
+	fflush(sh_out);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (1) {
+		// 빈 slot 에 job 을 실행한다.
+		for (i = 0; i < slots && running < slots; i++) {
+			if (jobs[i].open > 0) {
+				continue;
+			}
+			arg = par_next_arg(&src);
+			if (arg == NULL) {
+				break;
+			}
+
+			jobs[i].seq = ++seq;
+			jobs[i].buf[0].len = jobs[i].buf[1].len = 0;
+			jobs[i].arg = strdup(arg);
+			clock_gettime(CLOCK_MONOTONIC, &jobs[i].start);
+			jobs[i].pid = par_launch(tmpl, ntmpl, arg, null_fd,
+									 &pfd[2 * i].fd, &pfd[2 * i + 1].fd);
+			if (jobs[i].pid < 0) {
+				// 실행하지 못했으면 같은 slot 에 다음 인자를 실행한다.
+				par_finish(&jobs[i], 127 << 8, verbose, &failed);
+				i--;
+				continue;
+			}
+			jobs[i].open = 2;
+			running++;
+		}
+
+		if (running == 0) {
+			break;
+		}
+
+		if (poll(pfd, slots * 2, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			fprintf(sh_err, "parallel: poll: %s\n", strerror(errno));
+			break;
+		}
+
+		// 출력을 job 버퍼에 모으고, 두 파이프가 모두 EOF 이면 job 을 끝낸다.
+		for (j = 0; j < slots * 2; j++) {
+			if (pfd[j].fd < 0 || pfd[j].revents == 0) {
+				continue;
+			}
+			i = j / 2;
+			if (par_read(&jobs[i].buf[j % 2], pfd[j].fd) == 0) {
+				continue;
+			}
+
+			close(pfd[j].fd);
+			pfd[j].fd = -1;
+			if (--jobs[i].open > 0) {
+				continue;
+			}
+			if (wait_cmd(jobs[i].pid, &status, 0) < 0) {
+				status = 127 << 8;
+			}
+			par_finish(&jobs[i], status, verbose, &failed);
+			running--;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	fflush(sh_out);
+	fprintf(sh_err, "parallel: %ld jobs (%ld failed) in %.2f sec "
+			"(%.0f jobs/sec, %d slots)\n", seq, failed, sec,
+			(sec > 0) ? seq / sec : 0.0, slots);
+
+	for (i = 0; i < slots; i++) {
+		free(jobs[i].buf[0].data);
+		free(jobs[i].buf[1].data);
+	}
+	free(jobs);
+	free(pfd);
+	close(null_fd);
+	free(src.line);
+	if (src.fp != NULL && src.fp != stdin) {
+		fclose(src.fp);
+	}
+
+	return (failed > 0);
+}
+
+
+/*
+ * par_next_arg
+ *
+ * 다음 인자를 리턴한다. 파일의 줄은 끝의 '\n' 을 뺀다. (빈 줄은 건너뜀)
+ */
+char *par_next_arg(struct par_src *src)
+{
+	ssize_t len;
+
+	if (src->list != NULL) {
+		return (src->idx < src->n) ? src->list[src->idx++] : NULL;
+	}
+
+	while ((len = getline(&src->line, &src->cap, src->fp)) > 0) {
+		if (src->line[len - 1] == '\n') {
+			src->line[--len] = '\0';
+		}
+		if (len > 0) {
+			return src->line;
+		}
+	}
+	return NULL;
+}
+
+
+/*
+ * par_launch
+ *
+ * command 의 {} 를 arg 로 바꾸어 실행한다. stdin 은 null_fd (/dev/null),
+ * stdout, stderr 는 각각 파이프로 연결하고 읽는 쪽을 out_fd, err_fd 에
+ * 저장한다. 셸의 실행 경로 (spawn_cmd) 를 그대로 사용한다.
+ */
+pid_t par_launch(char **tmpl, int ntmpl, char *arg, int null_fd, int *out_fd,
+				 int *err_fd)
+{
+	struct redirect rd_err = { RD_DUP, STDERR_FILENO, -1, NULL };
+	char *argv[MAXARGS + 2], *words, *p, *q;
+	int i, found = 0, alen = strlen(arg), pipefd[2], errfd[2];
+	size_t len = 0;
+	pid_t pid;
+
+	if (ntmpl > MAXARGS) {
+		ntmpl = MAXARGS;
+	}
+
+	// {} 를 바꾼 단어들을 위한 메모리 (spawn 이 복사하므로 바로 해제)
+	for (i = 0; i < ntmpl; i++) {
+		for (p = tmpl[i]; (p = strstr(p, "{}")) != NULL; p += 2) {
+			len += alen;
+		}
+		len += strlen(tmpl[i]) + 1;
+	}
+	words = q = malloc(len);
+	if (words == NULL) {
+		fprintf(sh_err, "parallel: out of memory\n");
+		return -1;
+	}
+
+	for (i = 0; i < ntmpl; i++) {
+		if (strstr(tmpl[i], "{}") == NULL) {
+			argv[i] = tmpl[i];
+			continue;
+		}
+
+		found = 1;
+		argv[i] = q;
+		for (p = tmpl[i]; *p; ) {
+			if (p[0] == '{' && p[1] == '}') {
+				memcpy(q, arg, alen);
+				q += alen;
+				p += 2;
+			} else {
+				*q++ = *p++;
+			}
+		}
+		*q++ = '\0';
+	}
+	if (!found) {
+		argv[i++] = arg;
+	}
+	argv[i] = NULL;
+
+	*out_fd = *err_fd = -1;
+	if (pipe2(pipefd, O_CLOEXEC) < 0) {
+		fprintf(sh_err, "pipe error\n");
+		free(words);
+		return -1;
+	}
+	if (pipe2(errfd, O_CLOEXEC) < 0) {
+		fprintf(sh_err, "pipe error\n");
+		close(pipefd[0]);
+		close(pipefd[1]);
+		free(words);
+		return -1;
+	}
+
+	rd_err.src_fd = errfd[1];
+	pid = spawn_cmd(argv, null_fd, pipefd[1], &rd_err, 1);
+	close(pipefd[1]);
+	close(errfd[1]);
+	free(words);
+	if (pid < 0) {
+		close(pipefd[0]);
+		close(errfd[0]);
+		return -1;
+	}
+
+	*out_fd = pipefd[0];
+	*err_fd = errfd[0];
+	return pid;
+}
+
+
+/*
+ * par_read
+ *
+ * fd 에서 한번 읽어 buf 에 붙인다. EOF 나 에러이면 -1 을 리턴한다.
+ * 버퍼가 PAR_BUF_MAX 만큼 차면 내용을 임시 파일로 옮기고 다시 쓴다.
+ * (임시 파일을 만들 수 없으면 메모리에 계속 모은다)
+ */
+int par_read(struct par_buf *buf, int fd)
+{
+	ssize_t n;
+
+	if (buf->cap - buf->len < PAR_READ_SIZE && buf->cap >= PAR_BUF_MAX &&
+		par_spill(buf) == 0) {
+		buf->len = 0;
+	}
+	if (buf->cap - buf->len < PAR_READ_SIZE) {
+		buf->cap = buf->cap ? buf->cap * 2 : PAR_READ_SIZE * 2;
+		buf->data = realloc(buf->data, buf->cap);
+		if (buf->data == NULL) {
+			myshell_error("parallel: out of memory");
+		}
+	}
+	n = read(fd, buf->data + buf->len, PAR_READ_SIZE);
+	if (n > 0) {
+		buf->len += n;
+		return 0;
+	}
+	if (n < 0 && errno == EINTR) {
+		return 0;
+	}
+	return -1;
+}
+
+
+/*
+ * par_spill
+ *
+ * 버퍼의 내용을 임시 파일 끝에 쓴다. (처음이면 임시 파일을 만든다)
+ * 실패하면 -1 을 리턴한다.
+ */
+int par_spill(struct par_buf *buf)
+{
+	off_t start;
+	size_t off;
+	ssize_t n;
+
+	if (buf->spill_fd < 0) {
+		buf->spill_fd = open("/tmp", O_TMPFILE | O_RDWR | O_CLOEXEC,
+							 S_IRUSR | S_IWUSR);
+		if (buf->spill_fd < 0) {
+			return -1;
+		}
+	}
+	// 일부만 썼으면 되돌린다. (버퍼에 남은 내용과 겹치지 않도록)
+	start = lseek(buf->spill_fd, 0, SEEK_CUR);
+	for (off = 0; off < buf->len; off += n) {
+		n = write(buf->spill_fd, buf->data + off, buf->len - off);
+		if (n <= 0) {
+			if (ftruncate(buf->spill_fd, start) == 0) {
+				lseek(buf->spill_fd, start, SEEK_SET);
+			}
+			return -1;
+		}
+	}
+	return 0;
+}
+
+
+/*
+ * par_flush
+ *
+ * 임시 파일에 옮긴 출력과 버퍼의 나머지를 차례로 fp 에 쓰고 비운다.
+ */
+void par_flush(struct par_buf *buf, FILE *fp)
+{
+	char chunk[PAR_READ_SIZE];
+	off_t off = 0;
+	ssize_t n;
+
+	if (buf->spill_fd >= 0) {
+		while ((n = pread(buf->spill_fd, chunk, sizeof(chunk), off)) > 0) {
+			fwrite(chunk, 1, n, fp);
+			off += n;
+		}
+		close(buf->spill_fd);
+		buf->spill_fd = -1;
+	}
+	if (buf->len > 0) {
+		fwrite(buf->data, 1, buf->len, fp);
+	}
+	buf->len = 0;
+}
+
+
+/*
+ * par_finish
+ *
+ * job 의 출력을 한번에 쓰고 종료 상태를 보고한다.
+ */
+void par_finish(struct par_job *job, int status, int verbose, long *failed)
+{
+	struct timespec end;
+	double sec;
+	int code;
+
+	par_flush(&job->buf[0], sh_out);
+	if (job->buf[1].len > 0 || job->buf[1].spill_fd >= 0) {
+		fflush(sh_out);
+		par_flush(&job->buf[1], sh_err);
+		fflush(sh_err);
+	}
+
+	code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+	if (code != 0) {
+		(*failed)++;
+	}
+
+	if (verbose || code != 0) {
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		sec = (end.tv_sec - job->start.tv_sec) +
+			(end.tv_nsec - job->start.tv_nsec) / 1e9;
+		fflush(sh_out);
+		fprintf(sh_err, "parallel: job %ld (%s): exit %d, %.3f sec\n",
+				job->seq, job->arg, code, sec);
+	}
+
+	free(job->arg);
+	job->arg = NULL;
+}
+
+
+/*
+ * place [-c cpus] [-n nice] [-i class[:level]] [-m nodes] [-r] [command ...]
+ *
+ * 명령의 실행 위치를 지정한다.
+ *   -c cpus     CPU 목록 (예: 0-3,6)
+ *   -n nice     nice 값 (-20 ~ 19)
+ *   -i class    I/O 스케줄링 클래스 rt, be, idle (level 0-7, 기본값 4)
+ *   -m nodes    NUMA 메모리 node 목록 (MPOL_BIND)
+ * command 가 있으면 그 명령 (파이프 포함) 에만 적용하며, process_cmd 가
+ * 처리한다. 내장 명령 dcp 는 복사 스레드에 적용한다.
+ * command 가 없으면 이후 모든 명령의 기본값으로 설정한다.
+ * (-r 은 기본값 해제, 옵션이 없으면 현재 기본값 출력)
+ */
+int place_cmd(int argc, char **argv)
+{
+	struct placement pl = sh_place;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-r")) {
+			memset(&sh_place, 0, sizeof(sh_place));
+			return 0;
+		}
+	}
+
+	if (argc == 1) {
+		place_print(sh_out, &sh_place, 0);
+		fprintf(sh_out, "\n");
+		return 0;
+	}
+
+	if (place_parse(argc, argv, &pl) < 0) {
+		return 1;
+	}
+	sh_place = pl;
+
+	return 0;
+}
+
+
+/*
+ * place_parse
+ *
+ * place 의 옵션을 pl 에 설정하고 command 의 위치 (argv 의 index) 를 리턴한다.
+ * 옵션이 잘못되면 에러 메시지를 출력하고 -1 을 리턴한다.
+ */
+int place_parse(int argc, char **argv, struct placement *pl)
+{
+	char *p, *end;
+	long val;
+	int i;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (!strcmp(argv[i], "-r")) {
+			continue;
+		}
+		if (i + 1 >= argc) {
+			goto usage;
+		}
+
+		if (!strcmp(argv[i], "-c")) {
+			CPU_ZERO(&pl->cpus);
+			if (place_parse_list(argv[++i], CPU_SETSIZE,
+								 place_set_cpu, &pl->cpus) <= 0) {
+				fprintf(sh_err, "place: invalid cpu list: %s\n", argv[i]);
+				return -1;
+			}
+			pl->set |= PL_CPU;
+		} else if (!strcmp(argv[i], "-n")) {
+			errno = 0;
+			val = strtol(argv[++i], &end, 10);
+			if (errno != 0 || end == argv[i] || *end != '\0' ||
+				val < -20 || val > 19) {
+				fprintf(sh_err, "place: invalid nice value: %s\n", argv[i]);
+				return -1;
+			}
+			pl->nice = val;
+			pl->set |= PL_NICE;
+		} else if (!strcmp(argv[i], "-i")) {
+			p = argv[++i];
+			if (!strncmp(p, "rt", 2)) {
+				pl->io_class = 1;
+			} else if (!strncmp(p, "be", 2)) {
+				pl->io_class = 2;
+			} else if (!strncmp(p, "idle", 4)) {
+				pl->io_class = 3;
+			} else {
+				fprintf(sh_err, "place: invalid io class: %s\n", p);
+				return -1;
+			}
+			p = strchr(p, ':');
+			val = 4;
+			if (p != NULL) {
+				val = strtol(p + 1, &end, 10);
+				if (end == p + 1 || *end != '\0') {
+					val = -1;
+				}
+			}
+			pl->io_level = val;
+			if (val < 0 || val > 7) {
+				fprintf(sh_err, "place: invalid io level: %s\n", argv[i]);
+				return -1;
+			}
+			pl->set |= PL_IO;
+		} else if (!strcmp(argv[i], "-m")) {
+			pl->mems = 0;
+			if (place_parse_list(argv[++i], PL_MAXNODE,
+								 place_set_node, &pl->mems) <= 0) {
+				fprintf(sh_err, "place: invalid node list: %s\n", argv[i]);
+				return -1;
+			}
+			pl->set |= PL_MEM;
+		} else {
+			goto usage;
+		}
+	}
+
+	return i;
+
+usage:
+	fprintf(sh_err, "Usage: place [-c cpus] [-n nice] [-i class[:level]] "
+			"[-m nodes] [-r] [command ...]\n");
+	return -1;
+}
+
+
+/*
+ * place_parse_list
+ *
+ * "0-3,6" 형식의 목록의 각 번호로 set 을 호출한다.
+ * 번호의 개수를 리턴하고, 형식이 잘못되었거나 max 이상이면 -1 을 리턴한다.
+ */
+int place_parse_list(char *str, int max, void (*set)(int, void *), void *arg)
+{
+	char *p = str, *end;
+	long lo, hi, n, count = 0;
+
+	while (*p) {
+		lo = strtol(p, &end, 10);
+		if (end == p) {
+			return -1;
+		}
+		hi = lo;
+		if (*end == '-') {
+			p = end + 1;
+			hi = strtol(p, &end, 10);
+			if (end == p) {
+				return -1;
+			}
+		}
+		if (lo < 0 || hi < lo || hi >= max) {
+			return -1;
+		}
+		for (n = lo; n <= hi; n++, count++) {
+			set(n, arg);
+		}
+
+		if (*end == ',') {
+			end++;
+		} else if (*end != '\0') {
+			return -1;
+		}
+		p = end;
+	}
+
+	return count;
+}
+
+
+// place_parse_list 의 set 함수: CPU 집합, NUMA node mask
+void place_set_cpu(int n, void *arg)
+{
+	CPU_SET(n, (cpu_set_t *)arg);
+}
+
+
+void place_set_node(int n, void *arg)
+{
+	*(unsigned long *)arg |= 1UL << n;
+}
+
+
+/*
+ * place_apply
+ *
+ * 실행 위치를 현재 스레드에 적용한다.
+ * (Linux 에서 CPU 집합, nice, ionice, 메모리 정책은 스레드 단위이다)
+ */
+int place_apply(struct placement *pl)
+{
+	pid_t tid = syscall(SYS_gettid);
+
+	if ((pl->set & PL_CPU) &&
+		sched_setaffinity(0, sizeof(pl->cpus), &pl->cpus) < 0) {
+		fprintf(stderr, "place: cpu affinity: %s\n", strerror(errno));
+		return -1;
+	}
+	if ((pl->set & PL_NICE) && setpriority(PRIO_PROCESS, tid, pl->nice) < 0) {
+		fprintf(stderr, "place: nice: %s\n", strerror(errno));
+		return -1;
+	}
+	if ((pl->set & PL_IO) &&
+		syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+				(pl->io_class << IOPRIO_CLASS_SHIFT) | pl->io_level) < 0) {
+		fprintf(stderr, "place: ionice: %s\n", strerror(errno));
+		return -1;
+	}
+	if ((pl->set & PL_MEM) &&
+		syscall(SYS_set_mempolicy, MPOL_BIND_NODES, &pl->mems,
+				PL_MAXNODE + 1) < 0) {
+		fprintf(stderr, "place: numa policy: %s\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * place_print
+ *
+ * 실행 위치를 "cpus=0-3 nice=10 io=idle mem=0" 형식으로 출력한다.
+ * pid 가 0 이 아니면 CPU 집합, nice, ionice 는 그 프로세스의 실제 값을 읽는다.
+ */
+void place_print(FILE *fp, struct placement *pl, pid_t pid)
+{
+	static const char *io_names[] = { "default", "rt", "be", "idle" };
+	cpu_set_t cpus = pl->cpus;
+	int i, start, n, nice = pl->nice, ioprio = -1, first = 1;
+	int io_class = pl->io_class, io_level = pl->io_level;
+
+	if (pid > 0) {
+		if (sched_getaffinity(pid, sizeof(cpus), &cpus) < 0) {
+			CPU_ZERO(&cpus);
+		}
+		errno = 0;
+		nice = getpriority(PRIO_PROCESS, pid);
+		if (errno != 0) {
+			nice = pl->nice;
+		}
+		ioprio = syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, pid);
+		if (ioprio >= 0) {
+			io_class = ioprio >> IOPRIO_CLASS_SHIFT;
+			io_level = ioprio & ((1 << IOPRIO_CLASS_SHIFT) - 1);
+		}
+	}
+
+	// CPU 목록을 구간으로 출력
+	fprintf(fp, "cpus=");
+	if (pid == 0 && !(pl->set & PL_CPU)) {
+		fprintf(fp, "all");
+	} else {
+		n = CPU_COUNT(&cpus);
+		for (i = 0; i < CPU_SETSIZE && n > 0; i++) {
+			if (!CPU_ISSET(i, &cpus)) {
+				continue;
+			}
+			for (start = i; i + 1 < CPU_SETSIZE && CPU_ISSET(i + 1, &cpus); i++)
+				;
+			fprintf(fp, (start == i) ? "%s%d" : "%s%d-%d", first ? "" : ",",
+					start, i);
+			n -= i - start + 1;
+			first = 0;
+		}
+	}
+
+	fprintf(fp, " nice=%d", nice);
+	if (pid == 0 && !(pl->set & PL_IO)) {
+		fprintf(fp, " io=default");
+	} else if (io_class >= 0 && io_class <= 3) {
+		fprintf(fp, " io=%s", io_names[io_class]);
+		if (io_class == 1 || io_class == 2) {
+			fprintf(fp, ":%d", io_level);
+		}
+	}
+
+	fprintf(fp, " mem=");
+	if (!(pl->set & PL_MEM)) {
+		fprintf(fp, "default");
+	} else {
+		first = 1;
+		for (i = 0; i < PL_MAXNODE; i++) {
+			if (pl->mems & (1UL << i)) {
+				fprintf(fp, "%s%d", first ? "" : ",", i);
+				first = 0;
+			}
+		}
+	}
+}
+
+
+/*
+ * jobs [-v]
+ *
+ * 실행 중인 background job 을 출력한다.
+ * -v 이면 각 job 의 실행 위치와 CPU 시간, 경과 시간을 함께 출력한다.
+ */
+int list_jobs(int argc, char **argv)
+{
+	struct job *jp;
+	struct timespec now;
+	char path[64], buf[1024], *p;
+	unsigned long utime, stime;
+	double cpu, elapsed;
+	long ticks = sysconf(_SC_CLK_TCK);
+	int verbose = (argc > 1 && !strcmp(argv[1], "-v"));
+	int i, fd, n;
+	pid_t pids[2];
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	for (jp = job_list; jp != NULL; jp = jp->next) {
+		fprintf(sh_out, "[%d] %d Running  %s\n", jp->id, jp->pid, jp->cmd);
+		if (!verbose) {
+			continue;
+		}
+
+		// CPU 시간: /proc/<pid>/stat 의 utime, stime (파이프이면 합)
+		cpu = 0;
+		pids[0] = jp->pid;
+		pids[1] = jp->pipe_pid;
+		for (i = 0; i < 2; i++) {
+			if (pids[i] <= 0) {
+				continue;
+			}
+			snprintf(path, sizeof(path), "/proc/%d/stat", pids[i]);
+			fd = open(path, O_RDONLY | O_CLOEXEC);
+			if (fd < 0) {
+				continue;
+			}
+			n = read(fd, buf, sizeof(buf) - 1);
+			close(fd);
+			if (n <= 0) {
+				continue;
+			}
+			buf[n] = '\0';
+			// 명령 이름 (괄호) 뒤의 14, 15 번째 필드
+			p = strrchr(buf, ')');
+			if (p != NULL && sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u "
+							"%*u %*u %*u %lu %lu", &utime, &stime) == 2) {
+				cpu += (double)(utime + stime) / ticks;
+			}
+		}
+		elapsed = (now.tv_sec - jp->start.tv_sec) +
+			(now.tv_nsec - jp->start.tv_nsec) / 1e9;
+
+		fprintf(sh_out, "    ");
+		place_print(sh_out, &jp->place, jp->pid);
+		fprintf(sh_out, " cpu=%.2fs elapsed=%.1fs\n", cpu, elapsed);
+	}
+
+	return 0;
+}
+
+
+/*
+ * job_add / job_remove
+ *
+ * background job 목록에 추가 / 삭제한다.
+ * 목록이 비면 job 번호는 다시 1 부터 시작한다.
+ */
+void job_add(pid_t pid, pid_t pipe_pid, char *cmd)
+{
+	struct job *jp, **pp;
+
+	jp = malloc(sizeof(*jp));
+	if (jp == NULL) {
+		return;
+	}
+	jp->id = job_next_id++;
+	jp->pid = pid;
+	jp->pipe_pid = pipe_pid;
+	snprintf(jp->cmd, sizeof(jp->cmd), "%s", cmd);
+	jp->place = cmd_place;
+	clock_gettime(CLOCK_MONOTONIC, &jp->start);
+	jp->next = NULL;
+
+	for (pp = &job_list; *pp != NULL; pp = &(*pp)->next)
+		;
+	*pp = jp;
+}
+
+
+void job_remove(pid_t pid)
+{
+	struct job *jp, **pp;
+
+	for (pp = &job_list; (jp = *pp) != NULL; pp = &jp->next) {
+		if (jp->pid == pid) {
+			jp->pid = 0;
+		}
+		if (jp->pipe_pid == pid) {
+			jp->pipe_pid = 0;
+		}
+		// 파이프의 두 명령이 모두 끝나면 job 을 삭제
+		if (jp->pid <= 0 && jp->pipe_pid <= 0) {
+			*pp = jp->next;
+			free(jp);
+			break;
+		}
+	}
+
+	if (job_list == NULL) {
+		job_next_id = 1;
+	}
+}
+
+
+/*
+ * du [-d depth] [-h | -b] [-C] [-j threads] [-v] [path ...]
+ *
+ * 디렉터리 트리가 차지하는 디스크 공간 (allocated) 과 파일 크기의 합
+ * (apparent) 을 출력한다. 기본 단위는 KiB, -h 는 K/M/G, -b 는 바이트이다.
+ * -d 이면 깊이 depth 까지의 하위 디렉터리도 출력한다. (기본값 0)
+ *
+ * rm -r 과 같이 디렉터리마다 하나의 작업으로 thread pool 에서 병렬로
+ * 계산하며, openat / getdents64 / statx 를 디렉터리 fd 기준으로 사용한다.
+ * hardlink 파일은 (dev, ino) 로 한번만 계산한다.
+ * -C 이면 디렉터리의 합계와 하위 디렉터리 목록을 셸 안에 캐시하고,
+ * 디렉터리의 mtime 이 그대로이면 다시 읽지 않는다. (파일 추가/삭제는
+ * 디렉터리 mtime 을 바꾸지만 파일 내용 변경은 바꾸지 않으므로,
+ * 캐시를 쓰면 크기만 바뀐 파일은 반영되지 않는다)
+ */
+int disk_usage(int argc, char **argv)
+{
+	struct du_dir *root;
+	struct du_link *lp;
+	struct statx stx;
+	struct timespec start, end;
+	char *paths[] = { ".", NULL }, **pathv = paths;
+	char abuf[32], sbuf[32];
+	int i, j, nthreads = 0, unit = 1024, verbose = 0, ret = 0;
+	double sec;
+
+	du_max_depth = 0;
+	du_use_cache = 0;
+
+	// 옵션 처리
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (!strcmp(argv[i], "-d") && i + 1 < argc) {
+			du_max_depth = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+			nthreads = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-h")) {
+			unit = 0;
+		} else if (!strcmp(argv[i], "-b")) {
+			unit = 1;
+		} else if (!strcmp(argv[i], "-C")) {
+			du_use_cache = 1;
+		} else if (!strcmp(argv[i], "-v")) {
+			verbose = 1;
+		} else {
+			fprintf(sh_err, "Usage: %s [-d depth] [-h | -b] [-C] "
+					"[-j threads] [-v] [path ...]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (i < argc) {
+		pathv = argv + i;
+	}
+
+	if (pool_init(&du_pool, nthreads) != 0) {
+		fprintf(sh_err, "thread pool creation error\n");
+		return 1;
+	}
+
+	du_entries = du_cached = du_errors = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	du_start = time(NULL);
+
+	for (i = 0; pathv[i] != NULL; i++) {
+		if (statx(AT_FDCWD, pathv[i], AT_SYMLINK_NOFOLLOW,
+				  STATX_TYPE | STATX_SIZE | STATX_BLOCKS, &stx) < 0) {
+			fprintf(sh_err, "%s: %s\n", pathv[i], strerror(errno));
+			ret = 1;
+			continue;
+		}
+
+		// 디렉터리가 아니면 파일 자신의 크기
+		if (!S_ISDIR(stx.stx_mode)) {
+			du_result_add(pathv[i], stx.stx_size, stx.stx_blocks);
+			continue;
+		}
+
+		root = du_dir_new(NULL, pathv[i]);
+		if (root == NULL || pool_submit(&du_pool, du_dir_task, root) != 0) {
+			fprintf(sh_err, "out of memory\n");
+			free(root);
+			ret = 1;
+		}
+	}
+
+	pool_wait(&du_pool);
+	pool_destroy(&du_pool);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	// 경로 순서로 출력: allocated, apparent, 경로
+	qsort(du_results, du_nresults, sizeof(*du_results), du_result_cmp);
+	for (i = 0; i < du_nresults; i++) {
+		fprintf(sh_out, "%s\t%s\t%s\n",
+				du_format(du_results[i].blocks * 512, unit, abuf),
+				du_format(du_results[i].size, unit, sbuf),
+				du_results[i].path);
+		free(du_results[i].path);
+	}
+	du_nresults = 0;
+
+	// 이번 실행의 hardlink 집합을 비운다.
+	for (j = 0; j < DU_HASH_BUCKETS; j++) {
+		while ((lp = du_links[j]) != NULL) {
+			du_links[j] = lp->next;
+			free(lp);
+		}
+	}
+
+	if (verbose) {
+		fprintf(sh_err, "du: %ld entries in %.2f sec (%.0f entries/sec, "
+				"%d threads, %ld directories cached)\n",
+				(long)du_entries, sec, (sec > 0) ? du_entries / sec : 0.0,
+				du_pool.nthreads, (long)du_cached);
+	}
+	if (du_errors) {
+		fprintf(sh_err, "%ld errors\n", (long)du_errors);
+		ret = 1;
+	}
+
+	return ret;
+}
+
+
+/*
+ * du_dir_new
+ *
+ * 계산할 디렉터리 구조체를 만든다. 참조 개수는 자신의 scan 몫으로 1 이다.
+ */
+struct du_dir *du_dir_new(struct du_dir *parent, char *name)
+{
+	struct du_dir *dp;
+	size_t plen = parent ? strlen(parent->path) + 1 : 0;
+	size_t nlen = strlen(name);
+
+	dp = malloc(sizeof(*dp) + plen + nlen + 1);
+	if (dp == NULL) {
+		return NULL;
+	}
+
+	dp->fd = -1;
+	dp->parent = parent;
+	dp->depth = parent ? parent->depth + 1 : 0;
+	atomic_init(&dp->refs, 1);
+	atomic_init(&dp->size, 0);
+	atomic_init(&dp->blocks, 0);
+	if (parent) {
+		memcpy(dp->path, parent->path, plen - 1);
+		dp->path[plen - 1] = '/';
+	}
+	memcpy(dp->path + plen, name, nlen + 1);
+	dp->name = dp->path + plen;
+
+	return dp;
+}
+
+
+/*
+ * du_dir_release
+ *
+ * 참조 개수를 줄이고, 0 이 되면 (하위 트리 계산이 모두 끝나면)
+ * 합계를 부모에 더하고 출력 목록에 추가한다.
+ */
+void du_dir_release(struct du_dir *dp)
+{
+	struct du_dir *parent;
+	long long size, blocks;
+
+	while (dp != NULL && atomic_fetch_sub(&dp->refs, 1) == 1) {
+		parent = dp->parent;
+		size = atomic_load(&dp->size);
+		blocks = atomic_load(&dp->blocks);
+
+		if (dp->fd >= 0) {
+			close(dp->fd);
+		}
+		if (dp->depth <= du_max_depth) {
+			du_result_add(dp->path, size, blocks);
+		}
+		if (parent) {
+			atomic_fetch_add(&parent->size, size);
+			atomic_fetch_add(&parent->blocks, blocks);
+		}
+
+		free(dp);
+		dp = parent;
+	}
+}
+
+
+/*
+ * du_dir_task
+ *
+ * 하나의 디렉터리를 scan 하면서 파일의 크기를 더하고,
+ * 하위 디렉터리는 새 작업으로 thread pool 에 넣는다.
+ * 캐시를 사용하면 scan 결과를 캐시에 저장한다.
+ */
+void du_dir_task(void *arg)
+{
+	struct du_dir *dp = arg, *child;
+	struct dir_reader dr;
+	struct dirent64 *d_entry;
+	struct statx stx, dstx;
+	struct du_link *links = NULL, *lp;
+	char *subdirs = NULL, *p;
+	size_t sub_len = 0, sub_cap = 0, nlen;
+	long long size, blocks, link_size = 0, link_blocks = 0;
+	long nentries = 0;
+	int base = dp->parent ? dp->parent->fd : AT_FDCWD;
+	int nsubdirs = 0, is_dir, cacheable;
+
+	// 디렉터리 자신
+	if (statx(base, dp->name, AT_SYMLINK_NOFOLLOW, STATX_BASIC_STATS,
+			  &dstx) < 0) {
+		fprintf(sh_err, "%s: %s\n", dp->path, strerror(errno));
+		atomic_fetch_add(&du_errors, 1);
+		du_dir_release(dp);
+		return;
+	}
+	size = dstx.stx_size;
+	blocks = dstx.stx_blocks;
+
+	// 캐시가 유효하면 디렉터리를 읽지 않는다.
+	if (du_use_cache && du_dir_cached(dp, &dstx)) {
+		du_dir_release(dp);
+		return;
+	}
+
+	dp->fd = openat(base, dp->name,
+			O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (dp->fd < 0 || dir_reader_init(&dr, dp->fd) < 0) {
+		fprintf(sh_err, "directory (%s) open error: %s\n",
+				dp->path, strerror(errno));
+		atomic_fetch_add(&du_errors, 1);
+		du_dir_release(dp);
+		return;
+	}
+
+	// scan 직전에 변경된 디렉터리는 캐시하지 않는다. (mtime 해상도)
+	cacheable = du_use_cache && (du_start - dstx.stx_mtime.tv_sec) >= 2;
+
+	while ((d_entry = dir_reader_next(&dr)) != NULL) {
+		nentries++;
+		is_dir = (d_entry->d_type == DT_DIR);
+
+		if (!is_dir) {
+			if (statx(dp->fd, d_entry->d_name, AT_SYMLINK_NOFOLLOW |
+					  AT_STATX_DONT_SYNC, STATX_TYPE | STATX_NLINK |
+					  STATX_INO | STATX_SIZE | STATX_BLOCKS, &stx) < 0) {
+				fprintf(sh_err, "%s/%s: %s\n", dp->path, d_entry->d_name,
+						strerror(errno));
+				atomic_fetch_add(&du_errors, 1);
+				continue;
+			}
+			is_dir = S_ISDIR(stx.stx_mode);
+		}
+
+		if (!is_dir) {
+			if (stx.stx_nlink <= 1) {
+				size += stx.stx_size;
+				blocks += stx.stx_blocks;
+				continue;
+			}
+
+			// hardlink 파일은 처음 만났을 때만 더한다.
+			if (du_link_add(makedev(stx.stx_dev_major, stx.stx_dev_minor),
+							stx.stx_ino, stx.stx_size, stx.stx_blocks)) {
+				link_size += stx.stx_size;
+				link_blocks += stx.stx_blocks;
+			}
+			if (cacheable && (lp = malloc(sizeof(*lp))) != NULL) {
+				lp->dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+				lp->ino = stx.stx_ino;
+				lp->size = stx.stx_size;
+				lp->blocks = stx.stx_blocks;
+				lp->next = links;
+				links = lp;
+			}
+			continue;
+		}
+
+		// 하위 디렉터리는 새 작업으로 처리
+		if (cacheable) {
+			nlen = strlen(d_entry->d_name) + 1;
+			if (sub_len + nlen > sub_cap) {
+				sub_cap = sub_cap ? sub_cap * 2 : 4096;
+				p = realloc(subdirs, sub_cap);
+				if (p == NULL) {
+					cacheable = 0;
+				} else {
+					subdirs = p;
+				}
+			}
+			if (cacheable) {
+				memcpy(subdirs + sub_len, d_entry->d_name, nlen);
+				sub_len += nlen;
+				nsubdirs++;
+			}
+		}
+
+		child = du_dir_new(dp, d_entry->d_name);
+		if (child == NULL) {
+			atomic_fetch_add(&du_errors, 1);
+			continue;
+		}
+		atomic_fetch_add(&dp->refs, 1);
+		if (pool_submit(&du_pool, du_dir_task, child) != 0) {
+			free(child);
+			atomic_fetch_sub(&dp->refs, 1);
+			atomic_fetch_add(&du_errors, 1);
+		}
+	}
+
+	if (dr.error) {
+		fprintf(sh_err, "directory (%s) read error\n", dp->path);
+		atomic_fetch_add(&du_errors, 1);
+		cacheable = 0;
+	}
+	dir_reader_close(&dr);
+
+	atomic_fetch_add(&du_entries, nentries);
+	atomic_fetch_add(&dp->size, size + link_size);
+	atomic_fetch_add(&dp->blocks, blocks + link_blocks);
+
+	// hardlink 파일은 다음 실행에서 다시 중복 검사하므로 따로 저장한다.
+	if (cacheable) {
+		du_cache_store(&dstx, size, blocks, links, subdirs, nsubdirs);
+	} else {
+		while ((lp = links) != NULL) {
+			links = lp->next;
+			free(lp);
+		}
+		free(subdirs);
+	}
+
+	// 자신의 scan 몫 참조를 반환
+	du_dir_release(dp);
+}
+
+
+/*
+ * du_dir_cached
+ *
+ * 캐시에 mtime 이 같은 디렉터리가 있으면 캐시한 합계를 더하고
+ * 하위 디렉터리를 작업으로 넣은 후 1 을 리턴한다. 없으면 0 을 리턴한다.
+ */
+int du_dir_cached(struct du_dir *dp, struct statx *stx)
+{
+	struct du_cache *cp;
+	struct du_dir *child;
+	struct du_link *lp;
+	dev_t dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+	long long size, blocks;
+	char *name;
+	int i, base = dp->parent ? dp->parent->fd : AT_FDCWD;
+
+	pthread_mutex_lock(&du_lock);
+	for (cp = du_cache[stx->stx_ino % DU_HASH_BUCKETS]; cp; cp = cp->next) {
+		if (cp->dev == dev && cp->ino == stx->stx_ino) {
+			break;
+		}
+	}
+	if (cp == NULL || cp->mtime.tv_sec != stx->stx_mtime.tv_sec ||
+		cp->mtime.tv_nsec != stx->stx_mtime.tv_nsec) {
+		pthread_mutex_unlock(&du_lock);
+		return 0;
+	}
+
+	// 하위 디렉터리의 statx / openat 기준 fd (읽지 않으므로 O_PATH)
+	dp->fd = openat(base, dp->name,
+			O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (dp->fd < 0) {
+		pthread_mutex_unlock(&du_lock);
+		return 0;
+	}
+
+	size = cp->size;
+	blocks = cp->blocks;
+	for (lp = cp->links; lp != NULL; lp = lp->next) {
+		if (du_link_add(lp->dev, lp->ino, lp->size, lp->blocks)) {
+			size += lp->size;
+			blocks += lp->blocks;
+		}
+	}
+	atomic_fetch_add(&dp->size, size);
+	atomic_fetch_add(&dp->blocks, blocks);
+
+	for (i = 0, name = cp->subdirs; i < cp->nsubdirs;
+		 i++, name += strlen(name) + 1) {
+		child = du_dir_new(dp, name);
+		if (child == NULL) {
+			atomic_fetch_add(&du_errors, 1);
+			continue;
+		}
+		atomic_fetch_add(&dp->refs, 1);
+		if (pool_submit(&du_pool, du_dir_task, child) != 0) {
+			free(child);
+			atomic_fetch_sub(&dp->refs, 1);
+			atomic_fetch_add(&du_errors, 1);
+		}
+	}
+	pthread_mutex_unlock(&du_lock);
+
+	atomic_fetch_add(&du_cached, 1);
+
+	return 1;
+}
+
+
+/*
+ * du_link_add
+ *
+ * hardlink 파일을 이번 실행의 집합에 추가한다. 처음이면 1 을 리턴한다.
+ */
+int du_link_add(dev_t dev, ino_t ino, long long size, long long blocks)
+{
+	struct du_link *lp, **head = &du_links[ino % DU_HASH_BUCKETS];
+
+	pthread_mutex_lock(&du_link_lock);
+	for (lp = *head; lp != NULL; lp = lp->next) {
+		if (lp->dev == dev && lp->ino == ino) {
+			pthread_mutex_unlock(&du_link_lock);
+			return 0;
+		}
+	}
+	lp = malloc(sizeof(*lp));
+	if (lp != NULL) {
+		lp->dev = dev;
+		lp->ino = ino;
+		lp->size = size;
+		lp->blocks = blocks;
+		lp->next = *head;
+		*head = lp;
+	}
+	pthread_mutex_unlock(&du_link_lock);
+
+	return 1;
+}
+
+
+/*
+ * du_cache_store
+ *
+ * 디렉터리의 scan 결과를 캐시에 저장한다. (같은 디렉터리의 이전 결과는 교체)
+ * links, subdirs 의 소유권을 넘겨받는다.
+ */
+void du_cache_store(struct statx *stx, long long size, long long blocks,
+					struct du_link *links, char *subdirs, int nsubdirs)
+{
+	struct du_cache *cp, **pp;
+	struct du_link *lp;
+	dev_t dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+
+	pthread_mutex_lock(&du_lock);
+	for (pp = &du_cache[stx->stx_ino % DU_HASH_BUCKETS]; (cp = *pp) != NULL;
+		 pp = &cp->next) {
+		if (cp->dev == dev && cp->ino == stx->stx_ino) {
+			break;
+		}
+	}
+	if (cp == NULL) {
+		cp = calloc(1, sizeof(*cp));
+		if (cp == NULL) {
+			pthread_mutex_unlock(&du_lock);
+			while ((lp = links) != NULL) {
+				links = lp->next;
+				free(lp);
+			}
+			free(subdirs);
+			return;
+		}
+		cp->dev = dev;
+		cp->ino = stx->stx_ino;
+		*pp = cp;
+	} else {
+		while ((lp = cp->links) != NULL) {
+			cp->links = lp->next;
+			free(lp);
+		}
+		free(cp->subdirs);
+	}
+
+	cp->mtime.tv_sec = stx->stx_mtime.tv_sec;
+	cp->mtime.tv_nsec = stx->stx_mtime.tv_nsec;
+	cp->size = size;
+	cp->blocks = blocks;
+	cp->links = links;
+	cp->subdirs = subdirs;
+	cp->nsubdirs = nsubdirs;
+	pthread_mutex_unlock(&du_lock);
+}
+
+
+void du_result_add(char *path, long long size, long long blocks)
+{
+	struct du_result *np;
+
+	pthread_mutex_lock(&du_link_lock);
+	if (du_nresults == du_results_cap) {
+		du_results_cap = du_results_cap ? du_results_cap * 2 : 64;
+		np = realloc(du_results, sizeof(*np) * du_results_cap);
+		if (np == NULL) {
+			pthread_mutex_unlock(&du_link_lock);
+			return;
+		}
+		du_results = np;
+	}
+	du_results[du_nresults].path = strdup(path);
+	du_results[du_nresults].size = size;
+	du_results[du_nresults].blocks = blocks;
+	if (du_results[du_nresults].path != NULL) {
+		du_nresults++;
+	}
+	pthread_mutex_unlock(&du_link_lock);
+}
+
+
+int du_result_cmp(const void *a, const void *b)
+{
+	return strcmp(((struct du_result *)a)->path, ((struct du_result *)b)->path);
+}
+
+
+/*
+ * du_format
+ *
+ * 크기를 unit (1: 바이트, 1024: KiB 올림, 0: K/M/G/T) 로 buf 에 쓴다.
+ */
+char *du_format(long long bytes, int unit, char *buf)
+{
+	static const char suffix[] = "KMGTP";
+	double v = bytes;
+	int i;
+
+	if (unit == 1) {
+		sprintf(buf, "%lld", bytes);
+	} else if (unit == 1024) {
+		sprintf(buf, "%lld", (bytes + 1023) / 1024);
+	} else if (bytes < 1024) {
+		sprintf(buf, "%lld", bytes);
+	} else {
+		for (i = 0, v /= 1024; v >= 1024 && i < 4; i++) {
+			v /= 1024;
+		}
+		sprintf(buf, (v < 10) ? "%.1f%c" : "%.0f%c", v, suffix[i]);
+	}
+
+	return buf;
+}
+
+
+/*
+ * search_cmd
+ *
+ * search [-F] [-n] [-c] [-l] [-j threads] pattern [file ...]
+ *
+ * 패턴과 일치하는 줄을 출력한다. 파일은 mmap 하여 thread pool 로 병렬
+ * 검색하고 (큰 파일은 SEARCH_CHUNK 단위로 나눔) 결과는 인자 순서대로
+ * 출력한다. 파일이 없거나 정규 파일이 아니면 (파이프) 읽으면서 검색한다.
+ * 패턴에 . * + ? [...] ^ $ 가 있으면 간단한 정규식으로 처리하며 (-F 는
+ * 문자열), 정규식이 반드시 포함하는 문자열로 먼저 후보 줄을 찾는다.
+ * -n 은 줄 번호, -c 는 일치한 줄 수, -l 은 일치한 파일 이름을 출력한다.
+ * 일치하는 줄이 있으면 0, 없거나 에러가 있으면 1 을 리턴한다.
+ */
+int search_cmd(int argc, char **argv)
+{
+	struct search_task *ring, *t;
+	struct stat st;
+	char *map = NULL, **files;
+	size_t size = 0, off = 0, end;
+	long head = 0, tail = 0, count = 0, total = 0;
+	int i, fd, nfiles, window, literal = 0, nthreads = 0, error = 0;
+
+	search_flags = 0;
+
+	// 옵션 처리
+	for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+		if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+			nthreads = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-F")) {
+			literal = 1;
+		} else if (!strcmp(argv[i], "-n")) {
+			search_flags |= SF_NUMBER;
+		} else if (!strcmp(argv[i], "-c")) {
+			search_flags |= SF_COUNT;
+		} else if (!strcmp(argv[i], "-l")) {
+			search_flags |= SF_LIST;
+		} else {
+			break;
+		}
+	}
+	if (i >= argc) {
+		fprintf(sh_err, "Usage: %s [-F] [-n] [-c] [-l] [-j threads] "
+				"pattern [file ...]\n", argv[0]);
+		return 1;
+	}
+	if (search_compile(argv[i++], literal) != 0) {
+		fprintf(sh_err, "%s: invalid pattern\n", argv[0]);
+		return 1;
+	}
+
+	files = argv + i;
+	nfiles = argc - i;
+	if (nfiles > 1) {
+		search_flags |= SF_NAME;
+	}
+#if defined(__x86_64__)
+	search_avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+	// 파일이 없으면 sh_in (파이프) 을 검색한다.
+	if (nfiles == 0) {
+		count = search_stream(sh_in, "(standard input)");
+		if (search_flags & SF_COUNT) {
+			fprintf(sh_out, "%ld\n", count);
+		} else if ((search_flags & SF_LIST) && count > 0) {
+			fprintf(sh_out, "(standard input)\n");
+		}
+		return (count > 0) ? 0 : 1;
+	}
+
+	if (pool_init(&search_pool, nthreads) != 0) {
+		fprintf(sh_err, "thread pool creation error\n");
+		return 1;
+	}
+
+	// 출력을 기다리는 작업 수를 제한한다. (mmap 개수와 메모리)
+	window = search_pool.nthreads * 4;
+	ring = calloc(window, sizeof(*ring));
+	if (ring == NULL) {
+		pool_destroy(&search_pool);
+		fprintf(sh_err, "out of memory\n");
+		return 1;
+	}
+
+	i = 0;
+	while (1) {
+		// 다음 파일 (또는 파일의 다음 구간) 의 검색 작업을 추가한다.
+		while (tail - head < window && (map != NULL || i < nfiles)) {
+			t = &ring[tail % window];
+			memset(t, 0, sizeof(*t));
+
+			if (map == NULL) {
+				t->first = 1;
+				fd = open(files[i], O_RDONLY | O_CLOEXEC);
+				if (fd < 0 || fstat(fd, &st) < 0 || S_ISDIR(st.st_mode)) {
+					fprintf(sh_err, "%s: %s\n", files[i],
+							(fd < 0 || !S_ISDIR(st.st_mode)) ?
+							strerror(errno) : "Is a directory");
+					if (fd >= 0) {
+						close(fd);
+					}
+					error = 1;
+					i++;
+					continue;
+				}
+
+				// 정규 파일이 아니면 출력 차례에 읽으면서 검색한다.
+				if (!S_ISREG(st.st_mode) || st.st_size == 0) {
+					t->name = files[i++];
+					t->fd = S_ISREG(st.st_mode) ? (close(fd), -1) : fd;
+					t->last = 1;
+					t->done = 1;
+					tail++;
+					continue;
+				}
+
+				size = st.st_size;
+				map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+				close(fd);
+				if (map == MAP_FAILED) {
+					fprintf(sh_err, "%s: %s\n", files[i], strerror(errno));
+					map = NULL;
+					error = 1;
+					i++;
+					continue;
+				}
+				madvise(map, size, MADV_SEQUENTIAL);
+				off = 0;
+			}
+
+			// 줄 번호가 필요하면 나누지 않는다. 구간은 줄 경계에서 끝난다.
+			end = size;
+			if (!(search_flags & SF_NUMBER) && size - off > SEARCH_CHUNK) {
+				end = off + SEARCH_CHUNK;
+				while (end < size && map[end - 1] != '\n') {
+					end++;
+				}
+			}
+
+			t->name = files[i];
+			t->fd = -1;
+			t->data = map + off;
+			t->len = end - off;
+			if (end == size) {
+				t->last = 1;
+				t->map = map;
+				t->map_size = size;
+				map = NULL;
+				i++;
+			}
+			off = end;
+
+			if (pool_submit(&search_pool, search_task, t) != 0) {
+				search_task(t);
+			}
+			tail++;
+		}
+
+		if (head == tail) {
+			break;
+		}
+
+		// 인자 순서대로 결과를 출력한다.
+		t = &ring[head % window];
+		pthread_mutex_lock(&search_lock);
+		while (!t->done) {
+			pthread_cond_wait(&search_cond, &search_lock);
+		}
+		pthread_mutex_unlock(&search_lock);
+
+		if (t->first) {
+			count = 0;
+		}
+		if (t->fd >= 0) {
+			t->count = search_stream(t->fd, t->name);
+			close(t->fd);
+		} else {
+			fwrite(t->out, 1, t->out_len, sh_out);
+		}
+		count += t->count;
+
+		if (t->last) {
+			if (search_flags & SF_COUNT) {
+				if (search_flags & SF_NAME) {
+					fprintf(sh_out, "%s:", t->name);
+				}
+				fprintf(sh_out, "%ld\n", count);
+			} else if ((search_flags & SF_LIST) && count > 0) {
+				fprintf(sh_out, "%s\n", t->name);
+			}
+			total += count;
+			if (t->map != NULL) {
+				munmap(t->map, t->map_size);
+			}
+		}
+		free(t->out);
+		head++;
+	}
+
+	pool_wait(&search_pool);
+	pool_destroy(&search_pool);
+	free(ring);
+
+	return (total > 0 && !error) ? 0 : 1;
+}
+
+
+/*
+ * search_task
+ *
+ * thread pool 작업: mmap 한 구간을 검색하여 출력을 t->out 에 모은다.
+ */
+void search_task(void *arg)
+{
+	struct search_task *t = arg;
+	long lineno = 0;
+
+	t->count = search_buf(t->data, t->len, &lineno, t->name, t);
+
+	pthread_mutex_lock(&search_lock);
+	t->done = 1;
+	pthread_cond_broadcast(&search_cond);
+	pthread_mutex_unlock(&search_lock);
+}
+
+
+/*
+ * search_stream
+ *
+ * fd 를 끝까지 읽으면서 완전한 줄 단위로 검색하고 sh_out 으로 출력한다.
+ * 일치한 줄 수를 리턴한다. (-c, -l 출력은 호출한 쪽에서 한다.)
+ */
+long search_stream(int fd, char *name)
+{
+	struct search_task t;
+	size_t have = 0, cap = SEARCH_READ_SIZE, n;
+	char *buf, *nbuf, *last;
+	long lineno = 0, count = 0;
+	ssize_t ret;
+	int eof = 0;
+
+	buf = malloc(cap);
+	if (buf == NULL) {
+		fprintf(sh_err, "out of memory\n");
+		return 0;
+	}
+	memset(&t, 0, sizeof(t));
+
+	while (!eof) {
+		ret = read(fd, buf + have, cap - have);
+		if (ret < 0 && errno == EINTR) {
+			continue;
+		}
+		if (ret < 0) {
+			fprintf(sh_err, "%s: %s\n", name, strerror(errno));
+			break;
+		}
+		have += ret;
+		eof = (ret == 0);
+
+		// 마지막 줄바꿈까지 검색하고 나머지는 다음 읽기와 합친다.
+		last = memrchr(buf, '\n', have);
+		n = eof ? have : (last != NULL) ? (size_t)(last - buf + 1) : 0;
+		if (n == 0) {
+			if (have == cap) {
+				nbuf = realloc(buf, cap * 2);
+				if (nbuf == NULL) {
+					fprintf(sh_err, "out of memory\n");
+					break;
+				}
+				buf = nbuf;
+				cap *= 2;
+			}
+			continue;
+		}
+
+		t.out_len = 0;
+		count += search_buf(buf, n, &lineno, name, &t);
+		fwrite(t.out, 1, t.out_len, sh_out);
+		if ((search_flags & SF_LIST) && count > 0) {
+			break;
+		}
+
+		memmove(buf, buf + n, have - n);
+		have -= n;
+	}
+
+	free(buf);
+	free(t.out);
+	return count;
+}
+
+
+/*
+ * search_buf
+ *
+ * buf 에서 일치하는 줄을 찾아 출력을 t->out 에 추가하고 일치한 줄 수를
+ * 리턴한다. 문자열 (정규식이면 반드시 포함하는 문자열) 을 먼저 찾고
+ * 그 문자열이 있는 줄만 정규식과 비교한다.
+ * -n 이면 *lineno 는 buf 앞까지의 줄 수이며, buf 의 줄 수만큼 증가한다.
+ */
+long search_buf(const char *buf, size_t len, long *lineno, char *name,
+				struct search_task *t)
+{
+	const char *p = buf, *end = buf + len, *m, *ls, *le, *counted = buf;
+	char num[32];
+	long count = 0;
+
+	while (p < end) {
+		if (search_pat.litlen > 0) {
+			m = search_mem(p, end - p, search_pat.lit, search_pat.litlen);
+			if (m == NULL) {
+				break;
+			}
+		} else {
+			m = p;
+		}
+
+		// 일치한 위치를 포함하는 줄 [ls, le)
+		ls = memrchr(p, '\n', m - p);
+		ls = (ls != NULL) ? ls + 1 : p;
+		le = memchr(m, '\n', end - m);
+		if (le == NULL) {
+			le = end;
+		}
+		p = (le < end) ? le + 1 : end;
+
+		if (search_pat.regex && !search_regex(ls, le)) {
+			continue;
+		}
+		count++;
+
+		if (search_flags & SF_LIST) {
+			break;
+		}
+		if (search_flags & SF_COUNT) {
+			continue;
+		}
+		if (search_flags & SF_NAME) {
+			search_out(t, name, strlen(name));
+			search_out(t, ":", 1);
+		}
+		if (search_flags & SF_NUMBER) {
+			*lineno += search_count_lines(counted, ls);
+			counted = ls;
+			search_out(t, num, sprintf(num, "%ld:", *lineno + 1));
+		}
+		search_out(t, ls, le - ls);
+		search_out(t, "\n", 1);
+	}
+
+	if (search_flags & SF_NUMBER) {
+		*lineno += search_count_lines(counted, end);
+	}
+
+	return count;
+}
+
+
+/*
+ * search_out
+ *
+ * 검색 작업의 출력 버퍼에 data 를 추가한다.
+ */
+void search_out(struct search_task *t, const char *data, size_t len)
+{
+	size_t cap;
+	char *np;
+
+	if (t->out_len + len > t->out_cap) {
+		for (cap = t->out_cap ? t->out_cap : 4096;
+			 cap < t->out_len + len; cap *= 2)
+			;
+		np = realloc(t->out, cap);
+		if (np == NULL) {
+			return;
+		}
+		t->out = np;
+		t->out_cap = cap;
+	}
+	memcpy(t->out + t->out_len, data, len);
+	t->out_len += len;
+}
+
+
+/*
+ * search_count_lines
+ *
+ * [p, end) 의 줄바꿈 개수를 리턴한다.
+ */
+long search_count_lines(const char *p, const char *end)
+{
+	long n = 0;
+
+	while ((p = memchr(p, '\n', end - p)) != NULL) {
+		n++;
+		p++;
+	}
+	return n;
+}
+
+
+/*
+ * search_mem
+ *
+ * s 의 n 바이트에서 needle 이 처음 나오는 위치를 리턴한다. 없으면 NULL.
+ * 한 글자는 memchr, AVX2 가 있으면 needle 에서 드문 두 글자 (rare1, rare2)
+ * 를 32 위치씩 동시에 비교하여 후보만 memcmp 하고, 그 외에는 memmem 을
+ * 사용한다.
+ */
+const char *search_mem(const char *s, size_t n, const char *needle, size_t m)
+{
+	if (m == 1) {
+		return memchr(s, needle[0], n);
+	}
+#if defined(__x86_64__)
+	if (search_avx2) {
+		return search_mem_avx2(s, n, needle, m, search_pat.rare1,
+							   search_pat.rare2);
+	}
+#endif
+	return memmem(s, n, needle, m);
+}
+
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+const char *search_mem_avx2(const char *s, size_t n, const char *needle,
+							size_t m, int r1, int r2)
+{
+	const __m256i c1 = _mm256_set1_epi8(needle[r1]);
+	const __m256i c2 = _mm256_set1_epi8(needle[r2]);
+	__m256i b1, b2;
+	unsigned int mask;
+	size_t i;
+
+	for (i = 0; i + m + 31 <= n; i += 32) {
+		b1 = _mm256_loadu_si256((const __m256i *)(s + i + r1));
+		b2 = _mm256_loadu_si256((const __m256i *)(s + i + r2));
+		mask = _mm256_movemask_epi8(
+				_mm256_and_si256(_mm256_cmpeq_epi8(c1, b1),
+								 _mm256_cmpeq_epi8(c2, b2)));
+		while (mask != 0) {
+			if (!memcmp(s + i + __builtin_ctz(mask), needle, m)) {
+				return s + i + __builtin_ctz(mask);
+			}
+			mask &= mask - 1;
+		}
+	}
+
+	// 32 바이트가 안 되는 나머지
+	return (i < n) ? memmem(s + i, n - i, needle, m) : NULL;
+}
+#endif
+
+
+/*
+ * search_compile
+ *
+ * 패턴을 search_pat 으로 변환한다. literal 이거나 정규식 문자가 없으면
+ * 문자열 검색이다. 정규식은 문자, '.', [...] 와 반복 (*, +, ?),
+ * 앞뒤 고정 (^, $), '\' escape 를 지원한다.
+ * 잘못된 패턴이면 1 을 리턴한다.
+ */
+int search_compile(char *pattern, int literal)
+{
+	struct search_op *op;
+	int i, j, len = strlen(pattern), run, start;
+
+	memset(&search_pat, 0, sizeof(search_pat));
+
+	if (literal || strpbrk(pattern, ".*+?[^$\\") == NULL) {
+		memcpy(search_pat.lit, pattern, len);
+		search_pat.litlen = len;
+		search_rare_bytes();
+		return 0;
+	}
+
+	search_pat.regex = 1;
+	i = 0;
+	if (pattern[0] == '^') {
+		search_pat.bol = 1;
+		i++;
+	}
+	for (; i < len; i++) {
+		if (pattern[i] == '$' && i == len - 1) {
+			search_pat.eol = 1;
+			break;
+		}
+		// 반복은 바로 앞의 항목에 적용한다.
+		if (strchr("*+?", pattern[i]) != NULL) {
+			if (search_pat.nops == 0 ||
+				search_pat.ops[search_pat.nops - 1].rep != SR_ONE) {
+				return 1;
+			}
+			search_pat.ops[search_pat.nops - 1].rep =
+				(pattern[i] == '*') ? SR_STAR :
+				(pattern[i] == '+') ? SR_PLUS : SR_OPT;
+			continue;
+		}
+		if (search_pat.nops == SEARCH_MAXOPS) {
+			return 1;
+		}
+
+		op = &search_pat.ops[search_pat.nops++];
+		op->rep = SR_ONE;
+		if (pattern[i] == '\\' && i + 1 < len) {
+			op->type = GOP_CHAR;
+			op->c = pattern[++i];
+		} else if (pattern[i] == '.') {
+			op->type = GOP_ANY;
+		} else if (pattern[i] == '[') {
+			j = glob_class_end(pattern, i, len);
+			if (j < 0) {
+				return 1;
+			}
+			op->type = GOP_CLASS;
+			glob_class_set(pattern, i, j, op->cls);
+			i = j;
+		} else {
+			op->type = GOP_CHAR;
+			op->c = pattern[i];
+		}
+	}
+
+	// 반드시 포함하는 가장 긴 문자열: 한 번만 나오는 연속된 문자
+	// (+ 문자는 한 번 포함하고 끝난다.)
+	for (i = 0; i < search_pat.nops; i = j) {
+		for (j = i, run = 0; j < search_pat.nops &&
+			 search_pat.ops[j].type == GOP_CHAR &&
+			 search_pat.ops[j].rep != SR_STAR &&
+			 search_pat.ops[j].rep != SR_OPT; j++) {
+			run++;
+			if (search_pat.ops[j].rep == SR_PLUS) {
+				j++;
+				break;
+			}
+		}
+		if (run > search_pat.litlen) {
+			search_pat.litlen = run;
+			for (start = 0; start < run; start++) {
+				search_pat.lit[start] = search_pat.ops[i + start].c;
+			}
+		}
+		if (j == i) {
+			j++;
+		}
+	}
+
+	search_rare_bytes();
+	return 0;
+}
+
+
+/*
+ * search_rare_bytes
+ *
+ * search_pat.lit 에서 보통 텍스트에 드물게 나오는 두 글자의 위치를 고른다.
+ */
+void search_rare_bytes(void)
+{
+	int i, r1 = 0, r2;
+
+	for (i = 1; i < search_pat.litlen; i++) {
+		if (search_byte_rank(search_pat.lit[i]) <
+			search_byte_rank(search_pat.lit[r1])) {
+			r1 = i;
+		}
+	}
+	r2 = (r1 == 0) ? search_pat.litlen - 1 : 0;
+	for (i = 0; i < search_pat.litlen; i++) {
+		if (i != r1 && search_byte_rank(search_pat.lit[i]) <
+			search_byte_rank(search_pat.lit[r2])) {
+			r2 = i;
+		}
+	}
+
+	search_pat.rare1 = r1;
+	search_pat.rare2 = r2;
+}
+
+
+/*
+ * search_byte_rank
+ *
+ * 텍스트에서 c 가 나오는 대략적인 빈도. 클수록 자주 나온다.
+ */
+int search_byte_rank(unsigned char c)
+{
+	if (c == ' ' || c == '\n') {
+		return 255;
+	}
+	if (strchr("etaoinsrhl", c) != NULL) {
+		return 200;
+	}
+	if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')) {
+		return 150;
+	}
+	if (c >= 'A' && c <= 'Z') {
+		return 100;
+	}
+	if (c >= 0x20 && c < 0x7f) {
+		return 80;
+	}
+	return 10;
+}
+
+
+/*
+ * search_regex
+ *
+ * 줄 [s, end) 가 정규식과 일치하는지 검사한다.
+ */
+int search_regex(const char *s, const char *end)
+{
+	if (search_pat.bol) {
+		return search_match(search_pat.ops, search_pat.nops, s, end);
+	}
+	for (; s <= end; s++) {
+		if (search_match(search_pat.ops, search_pat.nops, s, end)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+/*
+ * search_match
+ *
+ * s 부터 정규식 항목 op[0..nops) 이 일치하는지 검사한다.
+ * 반복은 가장 길게 일치시킨 뒤 줄여가며 나머지를 비교한다.
+ */
+int search_match(struct search_op *op, int nops, const char *s,
+				 const char *end)
+{
+	long n, min;
+
+	for (; nops > 0 && op->rep == SR_ONE; op++, nops--, s++) {
+		if (s == end || !search_op_match(op, *s)) {
+			return 0;
+		}
+	}
+	if (nops == 0) {
+		return !search_pat.eol || s == end;
+	}
+
+	min = (op->rep == SR_PLUS);
+	for (n = 0; s + n < end && (op->rep != SR_OPT || n < 1) &&
+		 search_op_match(op, s[n]); n++)
+		;
+	for (; n >= min; n--) {
+		if (search_match(op + 1, nops - 1, s + n, end)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+/*
+ * search_op_match
+ *
+ * 문자 c 가 정규식 항목 하나와 일치하는지 검사한다.
+ */
+int search_op_match(struct search_op *op, unsigned char c)
+{
+	switch (op->type) {
+	case GOP_CHAR:
+		return c == op->c;
+	case GOP_CLASS:
+		return (op->cls[c >> 3] >> (c & 7)) & 1;
+	default:
+		return c != '\n';
+	}
+}
+
+
+/*
+ * cat_cmd
+ *
+ * 사용법: cat [file...]
+ * 파일들 (없거나 "-" 이면 sh_in) 의 내용을 차례로 sh_out 으로 보낸다.
+ * fork/exec 없이 셸에서 수행하며, 데이터는 cat_fd 가 커널 안에서 옮긴다.
+ * 출력 쪽 파이프가 닫히면 (EPIPE) 조용히 끝낸다.
+ */
+int cat_cmd(int argc, char **argv)
+{
+	char *name;
+	int i, fd, out_fd, ret = 0;
+
+	fflush(sh_out);
+	out_fd = fileno(sh_out);
+
+	for (i = (argc > 1) ? 1 : 0; i < argc; i++) {
+		name = (i == 0) ? "-" : argv[i];
+		if (!strcmp(name, "-")) {
+			fd = sh_in;
+		} else if ((fd = open(name, O_RDONLY | O_CLOEXEC)) < 0) {
+			fprintf(sh_err, "cat: %s: %s\n", name, strerror(errno));
+			ret = 1;
+			continue;
+		}
+
+		if (cat_fd(fd, out_fd) < 0) {
+			if (errno == EPIPE) {
+				if (fd != sh_in) {
+					close(fd);
+				}
+				return 1;
+			}
+			fprintf(sh_err, "cat: %s: %s\n", name, strerror(errno));
+			ret = 1;
+		}
+		if (fd != sh_in) {
+			close(fd);
+		}
+	}
+
+	return ret;
+}
+
+
+/*
+ * cat_fd
+ *
+ * in_fd 의 현재 위치부터 끝까지를 out_fd 로 보낸다. user space 복사가
+ * 없는 방법을 순서대로 시도한다.
+ *   1. sendfile: 입력이 일반 파일 (출력이 파이프, 파일, 소켓 등)
+ *   2. splice: 입력이나 출력이 파이프
+ *   3. read/write: 위 방법을 지원하지 않는 경우 (터미널 등)
+ * 성공하면 0, 에러면 -1 을 리턴한다.
+ */
+int cat_fd(int in_fd, int out_fd)
+{
+	struct stat in_st, out_st;
+	char buffer[COPY_BUF_SIZE];
+	ssize_t rd_count, wt_count, n;
+
+	if (fstat(in_fd, &in_st) < 0 || fstat(out_fd, &out_st) < 0) {
+		return -1;
+	}
+
+	// 파이프 버퍼를 키워서 읽는 쪽과의 context switch 를 줄인다.
+	if (S_ISFIFO(out_st.st_mode)) {
+		fcntl(out_fd, F_SETPIPE_SZ, CAT_PIPE_SIZE);
+	}
+
+	if (S_ISREG(in_st.st_mode)) {
+		while ((n = sendfile(out_fd, in_fd, NULL, COPY_CHUNK_SIZE)) > 0)
+			;
+		if (n == 0) {
+			return 0;
+		}
+		// O_APPEND 파일, 터미널 등은 read/write 로 다시 시도
+		if (errno != EINVAL && errno != ENOSYS) {
+			return -1;
+		}
+	} else if (S_ISFIFO(in_st.st_mode) || S_ISFIFO(out_st.st_mode)) {
+		while ((n = splice(in_fd, NULL, out_fd, NULL, COPY_CHUNK_SIZE, 0)) > 0)
+			;
+		if (n == 0) {
+			return 0;
+		}
+		if (errno != EINVAL && errno != ENOSYS) {
+			return -1;
+		}
+	}
+
+	// 터미널 입력은 한 줄씩 도착하는 대로 바로 출력한다.
+	while ((rd_count = read(in_fd, buffer, COPY_BUF_SIZE)) > 0) {
+		for (n = 0; n < rd_count; n += wt_count) {
+			wt_count = write(out_fd, buffer + n, rd_count - n);
+			if (wt_count <= 0) {
+				return -1;
+			}
+		}
+	}
+
+	return (rd_count < 0) ? -1 : 0;
+}
+
+
+/*
+ * wc_cmd
+ *
+ * 사용법: wc [-l] [-w] [-c] [-j threads] [file...]
+ * 줄, 단어, 바이트 수를 센다. 옵션이 없으면 세 가지 모두 출력한다.
+ * 정규 파일은 mmap 하여 WC_CHUNK 단위로 나누어 thread pool 에서 세고
+ * (-c 만 있으면 읽지 않고 파일 크기를 사용), 파이프나 터미널 (파일이
+ * 없거나 "-") 은 셸에서 읽으면서 센다. 결과는 인자 순서대로 출력한다.
+ * 단어는 coreutils wc 의 C locale 과 같이 공백으로 구분한 인쇄 문자열이다.
+ */
+int wc_cmd(int argc, char **argv)
+{
+	struct wc_file *files, *f;
+	struct wc_task *tasks = NULL, *t;
+	struct wc_count total = { 0, 0, 0 };
+	struct stat st;
+	char *stdin_name = "-";
+	size_t off;
+	long long size = 0;
+	int i, j, fd, nfiles, ntasks = 0, nthreads = 0, flags = 0, ret = 0, state;
+	int width = 1, min_width = 1;
+
+	// 옵션 처리
+	for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+		if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+			nthreads = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-l")) {
+			flags |= WF_LINES;
+		} else if (!strcmp(argv[i], "-w")) {
+			flags |= WF_WORDS;
+		} else if (!strcmp(argv[i], "-c")) {
+			flags |= WF_BYTES;
+		} else {
+			fprintf(sh_err, "Usage: %s [-l] [-w] [-c] [-j threads] [file ...]\n",
+					argv[0]);
+			return 1;
+		}
+	}
+	if (flags == 0) {
+		flags = WF_LINES | WF_WORDS | WF_BYTES;
+	}
+	wc_words = (flags & WF_WORDS) != 0;
+#if defined(__x86_64__)
+	wc_avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+	// 파일이 없으면 sh_in 하나를 이름 없이 센다.
+	nfiles = argc - i;
+	files = calloc(nfiles ? nfiles : 1, sizeof(*files));
+	if (files == NULL) {
+		fprintf(sh_err, "out of memory\n");
+		return 1;
+	}
+	if (nfiles == 0) {
+		files[0].fd = sh_in;
+		nfiles = 1;
+		stdin_name = NULL;
+	}
+
+	// 파일을 열고 정규 파일은 mmap 하여 작업 개수를 센다.
+	for (j = 0; j < nfiles; j++) {
+		f = &files[j];
+		f->name = (i < argc) ? argv[i + j] : stdin_name;
+		if (f->name == NULL || !strcmp(f->name, "-")) {
+			f->fd = sh_in;
+			f->stream = 1;
+			if (fstat(sh_in, &st) == 0 && S_ISREG(st.st_mode)) {
+				size += st.st_size;
+			} else {
+				min_width = 7;
+			}
+			continue;
+		}
+
+		fd = open(f->name, O_RDONLY | O_CLOEXEC);
+		if (fd < 0 || fstat(fd, &st) < 0 || S_ISDIR(st.st_mode)) {
+			fprintf(sh_err, "wc: %s: %s\n", f->name,
+					(fd < 0 || !S_ISDIR(st.st_mode)) ?
+					strerror(errno) : "Is a directory");
+			if (fd >= 0) {
+				close(fd);
+			}
+			f->error = 1;
+			ret = 1;
+			continue;
+		}
+		if (!S_ISREG(st.st_mode)) {
+			f->fd = fd;
+			f->stream = 1;
+			min_width = 7;
+			continue;
+		}
+
+		f->size = st.st_size;
+		size += st.st_size;
+		f->cnt.bytes = st.st_size;
+		if (flags != WF_BYTES && f->size > 0) {
+			f->map = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (f->map == MAP_FAILED) {
+				fprintf(sh_err, "wc: %s: %s\n", f->name, strerror(errno));
+				f->map = NULL;
+				f->error = 1;
+				ret = 1;
+			} else {
+				madvise(f->map, f->size, MADV_SEQUENTIAL);
+				ntasks += (f->size + WC_CHUNK - 1) / WC_CHUNK;
+			}
+		}
+		close(fd);
+	}
+
+	// 구간별 작업을 만들어 thread pool 에서 센다. (구간 하나면 직접)
+	if (ntasks > 0) {
+		tasks = calloc(ntasks, sizeof(*tasks));
+		if (tasks == NULL) {
+			fprintf(sh_err, "out of memory\n");
+			ret = 1;
+			ntasks = 0;
+		}
+	}
+	t = tasks;
+	for (j = 0; j < nfiles && tasks != NULL; j++) {
+		f = &files[j];
+		f->tasks = t;
+		for (off = 0; f->map != NULL && off < f->size; off += WC_CHUNK) {
+			t->data = f->map + off;
+			t->len = (f->size - off < WC_CHUNK) ? f->size - off : WC_CHUNK;
+			t++;
+			f->ntasks++;
+		}
+	}
+	if (ntasks > 1 && pool_init(&wc_pool, nthreads) == 0) {
+		for (j = 0; j < ntasks; j++) {
+			if (pool_submit(&wc_pool, wc_task, &tasks[j]) != 0) {
+				wc_task(&tasks[j]);
+			}
+		}
+	} else {
+		for (j = 0; j < ntasks; j++) {
+			wc_task(&tasks[j]);
+		}
+		ntasks = 0;
+	}
+
+	// 파이프, 터미널 등은 셸에서 읽는다. (thread pool 과 동시에)
+	for (j = 0; j < nfiles; j++) {
+		f = &files[j];
+		if (f->stream && wc_stream(f->fd, &f->cnt) < 0) {
+			fprintf(sh_err, "wc: %s: %s\n", f->name ? f->name : "-",
+					strerror(errno));
+			ret = 1;
+		}
+		if (f->stream && f->fd != sh_in) {
+			close(f->fd);
+		}
+	}
+	if (ntasks > 1) {
+		pool_wait(&wc_pool);
+		pool_destroy(&wc_pool);
+	}
+
+	// 구간별 결과를 합하고, 출력 폭을 정한다. (coreutils wc 와 같은 형식)
+	for (j = 0; j < nfiles; j++) {
+		f = &files[j];
+		state = WC_SPACE;
+		for (i = 0, t = f->tasks; i < f->ntasks; i++, t++) {
+			f->cnt.lines += t->cnt.lines;
+			f->cnt.words += t->cnt.words;
+			if (t->tail >= 0) {
+				// 앞 구간에서 이어지는 단어는 한 번만 센다.
+				if (state != WC_SPACE && t->lead) {
+					f->cnt.words--;
+				}
+				state = t->tail ? WC_SPACE : WC_PRINT;
+			}
+		}
+		if (f->map != NULL) {
+			munmap(f->map, f->size);
+		}
+		total.lines += f->cnt.lines;
+		total.words += f->cnt.words;
+		total.bytes += f->cnt.bytes;
+	}
+	for (; size >= 10; size /= 10) {
+		width++;
+	}
+	if (width < min_width) {
+		width = min_width;
+	}
+	// 파일 하나의 수 하나는 폭을 맞추지 않는다.
+	if (nfiles == 1 && (flags == WF_LINES || flags == WF_WORDS ||
+						flags == WF_BYTES)) {
+		width = 1;
+	}
+
+	for (j = 0; j < nfiles; j++) {
+		if (!files[j].error) {
+			wc_print(&files[j].cnt, flags, width, files[j].name);
+		}
+	}
+	if (nfiles > 1) {
+		wc_print(&total, flags, width, "total");
+	}
+
+	free(tasks);
+	free(files);
+	return ret;
+}
+
+
+/*
+ * wc_task
+ *
+ * thread pool 에서 구간 하나의 줄과 단어 수를 센다. 구간 앞이 공백이라고
+ * 보고 세며, 앞 구간과 이어지는지는 lead/tail 로 wc_cmd 가 맞춘다.
+ */
+void wc_task(void *arg)
+{
+	struct wc_task *t = arg;
+	const unsigned char *p = (const unsigned char *)t->data;
+	size_t i;
+	int sp;
+
+	sp = wc_scan(p, t->len, 1, &t->cnt);
+	for (i = 0; i < t->len && wc_class[p[i]] == 0; i++)
+		;
+	t->lead = (i < t->len && wc_class[p[i]] == WC_PRINT);
+	t->tail = (i < t->len) ? sp : -1;
+}
+
+
+/*
+ * wc_stream
+ *
+ * fd 를 끝까지 읽으면서 센다. 에러면 -1 을 리턴한다.
+ */
+int wc_stream(int fd, struct wc_count *cnt)
+{
+	char *buf;
+	ssize_t n;
+	int prev_space = 1;
+
+	buf = malloc(WC_READ_SIZE);
+	if (buf == NULL) {
+		return -1;
+	}
+	while ((n = read(fd, buf, WC_READ_SIZE)) > 0) {
+		prev_space = wc_scan((unsigned char *)buf, n, prev_space, cnt);
+		cnt->bytes += n;
+	}
+	free(buf);
+
+	return (n < 0) ? -1 : 0;
+}
+
+
+/*
+ * wc_scan
+ *
+ * p[0..n) 의 줄 수와 단어 시작 (마지막 공백/인쇄 문자가 공백인 위치의
+ * 인쇄 문자) 수를 cnt 에 더한다. prev_space 는 p 앞의 상태이며, 끝의
+ * 상태 (마지막 공백/인쇄 문자가 공백인지) 를 리턴한다.
+ */
+int wc_scan(const unsigned char *p, size_t n, int prev_space,
+			struct wc_count *cnt)
+{
+	long long lines = 0, words = 0;
+	size_t i = 0;
+	int c;
+
+	// 줄 수만 필요하면 '\n' 만 센다.
+	if (!wc_words) {
+#if defined(__x86_64__)
+		if (wc_avx2) {
+			i = wc_lines_avx2(p, n, &lines);
+		}
+#endif
+		for (; i < n; i++) {
+			lines += (p[i] == '\n');
+		}
+		cnt->lines += lines;
+		return prev_space;
+	}
+
+#if defined(__x86_64__)
+	if (wc_avx2 && n >= 32) {
+		i = wc_scan_avx2(p, n, &prev_space, cnt);
+	}
+#endif
+
+	// 32 바이트가 안 되는 나머지, AVX2 가 없는 경우
+	for (; i < n; i++) {
+		c = wc_class[p[i]];
+		lines += (p[i] == '\n');
+		if (c == WC_PRINT) {
+			words += prev_space;
+			prev_space = 0;
+		} else if (c == WC_SPACE) {
+			prev_space = 1;
+		}
+	}
+
+	cnt->lines += lines;
+	cnt->words += words;
+	return prev_space;
+}
+
+
+#if defined(__x86_64__)
+/*
+ * wc_scan_avx2
+ *
+ * 32 바이트씩 '\n', 공백 (' ', '\t'..'\r'), 인쇄 문자, 나머지의 bit mask 를
+ * 만들어 popcount 로 센다. 공백 다음 위치 (space << 1) 에서 나머지 문자가
+ * 이어지면 덧셈의 carry 로 그 다음 공백/인쇄 문자까지 옮기고, 거기가
+ * 인쇄 문자이면 단어 시작이다. 처리한 바이트 수를 리턴한다.
+ */
+__attribute__((target("avx2,popcnt")))
+size_t wc_scan_avx2(const unsigned char *p, size_t n, int *prev_space,
+					struct wc_count *cnt)
+{
+	const __m256i nl = _mm256_set1_epi8('\n');
+	const __m256i blank = _mm256_set1_epi8(' ');
+	const __m256i tab = _mm256_set1_epi8('\t');
+	const __m256i four = _mm256_set1_epi8('\r' - '\t');
+	const __m256i lo = _mm256_set1_epi8(' ');
+	const __m256i hi = _mm256_set1_epi8('~' + 1);
+	__m256i v, ctl;
+	unsigned long long space, print, other, next, reach;
+	unsigned long long carry = *prev_space;
+	long long lines = 0, words = 0;
+	size_t i;
+
+	for (i = 0; i + 32 <= n; i += 32) {
+		v = _mm256_loadu_si256((const __m256i *)(p + i));
+		// '\t' <= c <= '\r' 은 (c - '\t') 가 unsigned 로 4 이하
+		ctl = _mm256_sub_epi8(v, tab);
+		ctl = _mm256_cmpeq_epi8(_mm256_min_epu8(ctl, four), ctl);
+		space = (unsigned int)_mm256_movemask_epi8(
+				_mm256_or_si256(_mm256_cmpeq_epi8(v, blank), ctl));
+		// ' ' < c < 0x7f (0x80 이상은 signed 비교에서 음수)
+		print = (unsigned int)_mm256_movemask_epi8(
+				_mm256_and_si256(_mm256_cmpgt_epi8(v, lo),
+								 _mm256_cmpgt_epi8(hi, v)));
+		other = ~(space | print) & 0xffffffffULL;
+		lines += __builtin_popcount(
+				_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl)));
+
+		// reach: 공백 다음에서 나머지 문자를 건너 도착한 위치 (bit 32 는
+		// 다음 블록으로 넘어가는 상태)
+		next = (space << 1) | carry;
+		reach = ((other + (next & other)) & ~other) | (next & ~other);
+		words += __builtin_popcountll(reach & print);
+		carry = reach >> 32;
+	}
+
+	cnt->lines += lines;
+	cnt->words += words;
+	*prev_space = carry;
+	return i;
+}
+
+
+/*
+ * wc_lines_avx2
+ *
+ * '\n' 만 센다. 비교 결과 (-1) 를 byte 별 counter 에 빼서 모으고,
+ * 넘치기 전에 (255 블록마다) _mm256_sad_epu8 로 합한다.
+ * 처리한 바이트 수를 리턴한다.
+ */
+__attribute__((target("avx2")))
+size_t wc_lines_avx2(const unsigned char *p, size_t n, long long *lines)
+{
+	const __m256i nl = _mm256_set1_epi8('\n');
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i acc, sum = zero;
+	size_t i = 0, end;
+
+	while (i + 32 <= n) {
+		acc = zero;
+		// 128 바이트씩 (counter 당 4) 63 번까지
+		end = (n - i) / 128 > 63 ? i + 63 * 128 : i + (n - i) / 128 * 128;
+		for (; i < end; i += 128) {
+			acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(nl,
+					_mm256_loadu_si256((const __m256i *)(p + i))));
+			acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(nl,
+					_mm256_loadu_si256((const __m256i *)(p + i + 32))));
+			acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(nl,
+					_mm256_loadu_si256((const __m256i *)(p + i + 64))));
+			acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(nl,
+					_mm256_loadu_si256((const __m256i *)(p + i + 96))));
+		}
+		if (n - i < 128) {
+			for (; i + 32 <= n; i += 32) {
+				acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(nl,
+						_mm256_loadu_si256((const __m256i *)(p + i))));
+			}
+		}
+		sum = _mm256_add_epi64(sum, _mm256_sad_epu8(acc, zero));
+	}
+
+	*lines += _mm256_extract_epi64(sum, 0) + _mm256_extract_epi64(sum, 1) +
+			  _mm256_extract_epi64(sum, 2) + _mm256_extract_epi64(sum, 3);
+	return i;
+}
+#endif
+
+
+/*
+ * wc_print
+ *
+ * flags 에 해당하는 수를 width 폭으로 출력한다. name 이 NULL 이면
+ * 이름을 출력하지 않는다.
+ */
+void wc_print(struct wc_count *cnt, int flags, int width, char *name)
+{
+	const char *sep = "";
+
+	if (flags & WF_LINES) {
+		fprintf(sh_out, "%*lld", width, cnt->lines);
+		sep = " ";
+	}
+	if (flags & WF_WORDS) {
+		fprintf(sh_out, "%s%*lld", sep, width, cnt->words);
+		sep = " ";
+	}
+	if (flags & WF_BYTES) {
+		fprintf(sh_out, "%s%*lld", sep, width, cnt->bytes);
+	}
+	if (name != NULL) {
+		fprintf(sh_out, " %s", name);
+	}
+	fputc('\n', sh_out);
+}
+
+
+/*
+ * watch_cmd
+ *
+ * 사용법: watch [-n secs] [-d ms] [-c count] [-p path]... command [args...]
+ * 명령 (내장 또는 외부) 을 실행하고, -p 로 지정한 경로 (디렉터리는 하위
+ * 디렉터리 포함) 에 inotify 변경이 생기면 다시 실행한다. 변경이 이어지면
+ * 마지막 변경 후 -d ms (기본 100) 동안 조용할 때까지 기다린다.
+ * -p 가 없거나 inotify 를 사용할 수 없으면 -n 초 (기본 2) 마다 실행하고,
+ * -p 와 -n 을 함께 주면 변경이 없어도 -n 초마다 실행한다.
+ * 처음에는 전체 출력을, 이후에는 이전 출력과 달라진 줄만 출력한다.
+ * -c 번 실행하거나, 터미널에서 q 또는 Ctrl-C 를 누르면 끝난다.
+ * 마지막 실행의 종료 상태를 돌려준다.
+ */
+int watch_cmd(int argc, char **argv)
+{
+	struct watch_text prev = { 0 }, cur = { 0 };
+	struct termios orig, raw;
+	struct pollfd pfd[2];
+	void (*old_int)(int);
+	char *paths[WATCH_MAXPATHS], key;
+	int i, npaths = 0, interval = 0, debounce = WATCH_DEBOUNCE_MS;
+	int count = 0, runs = 0, ifd = -1, mfd, tty = 0, timeout, n, stop = 0;
+	int status = 0;
+
+	// 옵션 처리
+	for (i = 1; i < argc - 1 && argv[i][0] == '-'; i++) {
+		if (!strcmp(argv[i], "-n")) {
+			interval = atof(argv[++i]) * 1000;
+		} else if (!strcmp(argv[i], "-d")) {
+			debounce = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-c")) {
+			count = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-p") && npaths < WATCH_MAXPATHS) {
+			paths[npaths++] = argv[++i];
+		} else {
+			break;
+		}
+	}
+	if (i >= argc) {
+		fprintf(sh_err, "Usage: %s [-n secs] [-d ms] [-c count] [-p path]... "
+				"command [args ...]\n", argv[0]);
+		return 1;
+	}
+	argv += i;
+	argc -= i;
+
+	// 감시할 경로를 등록한다. 실패하면 주기 실행으로 대신한다.
+	if (npaths > 0) {
+		ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (ifd < 0) {
+			fprintf(sh_err, "watch: inotify: %s (using interval)\n",
+					strerror(errno));
+		}
+		for (i = 0; ifd >= 0 && i < npaths; i++) {
+			if (watch_add(ifd, paths[i]) < 0) {
+				fprintf(sh_err, "watch: %s: %s\n", paths[i], strerror(errno));
+			}
+		}
+		if (ifd >= 0 && watch_nwds == 0) {
+			close(ifd);
+			ifd = -1;
+		}
+	}
+	if (ifd < 0 && interval <= 0) {
+		interval = WATCH_INTERVAL_MS;
+	}
+
+	mfd = memfd_create("watch", MFD_CLOEXEC);
+	if (mfd < 0) {
+		fprintf(sh_err, "watch: %s\n", strerror(errno));
+		watch_release(ifd);
+		return 1;
+	}
+
+	// 터미널이면 q / Ctrl-C 를 바로 읽는다. (셸은 SIGINT 를 처리하지 않음)
+	if (isatty(sh_in) && tcgetattr(sh_in, &orig) == 0) {
+		raw = orig;
+		raw.c_lflag &= ~(ICANON | ECHO | ISIG);
+		raw.c_cc[VMIN] = 1;
+		raw.c_cc[VTIME] = 0;
+		tty = (tcsetattr(sh_in, TCSADRAIN, &raw) == 0);
+	}
+
+	while (!stop) {
+		// 실행하는 동안은 터미널을 원래 모드로 되돌린다. 셸은 SIGINT 를
+		// 무시하므로 Ctrl-C 는 실행 중인 자식만 종료하고, 그러면 watch 도 끝낸다.
+		if (tty) {
+			tcsetattr(sh_in, TCSADRAIN, &orig);
+		}
+		old_int = signal(SIGINT, SIG_IGN);
+		n = watch_run(argc, argv, mfd, &cur, &status);
+		signal(SIGINT, old_int);
+		if (tty) {
+			tcsetattr(sh_in, TCSADRAIN, &raw);
+		}
+		if (n < 0) {
+			fprintf(sh_err, "watch: %s\n", strerror(errno));
+			break;
+		}
+		if (status == 128 + SIGINT) {
+			stop = 1;
+		}
+		if (runs++ == 0) {
+			fwrite(cur.buf, 1, cur.len, sh_out);
+		} else {
+			watch_diff(&prev, &cur, argv[0]);
+		}
+		fflush(sh_out);
+		watch_text_free(&prev);
+		prev = cur;
+		memset(&cur, 0, sizeof(cur));
+		if (stop || (count > 0 && runs >= count)) {
+			break;
+		}
+
+		// 변경, 주기, 키 입력을 기다린다.
+		pfd[0].fd = ifd;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = tty ? sh_in : -1;
+		pfd[1].events = POLLIN;
+		timeout = (interval > 0) ? interval : -1;
+		while (1) {
+			n = poll(pfd, 2, timeout);
+			if (n < 0 && errno == EINTR) {
+				continue;
+			}
+			if (n <= 0) {
+				break;		// 주기 만료
+			}
+			if (pfd[1].revents) {
+				if (read(sh_in, &key, 1) != 1 || key == 'q' || key == 3) {
+					stop = 1;
+					break;
+				}
+				continue;
+			}
+			if (pfd[0].revents) {
+				// 변경이 멈출 때까지 이벤트를 모은다. (debounce)
+				watch_drain(ifd);
+				while (poll(pfd, 1, debounce) > 0) {
+					watch_drain(ifd);
+				}
+				break;
+			}
+		}
+	}
+
+	if (tty) {
+		tcsetattr(sh_in, TCSADRAIN, &orig);
+	}
+	watch_text_free(&prev);
+	watch_text_free(&cur);
+	close(mfd);
+	watch_release(ifd);
+
+	return status;
+}
+
+
+/*
+ * watch_add
+ *
+ * path 를 inotify 에 등록한다. 디렉터리이면 하위 디렉터리도 모두 등록한다.
+ * path 자체를 등록하지 못하면 -1 을 리턴한다.
+ */
+int watch_add(int ifd, char *path)
+{
+	struct dir_reader dr;
+	struct dirent64 *d_entry;
+	struct stat statbuf;
+	char sub[MAXPATH];
+	char **paths;
+	int wd, fd, cap;
+
+	wd = inotify_add_watch(ifd, path, WATCH_MASK);
+	if (wd < 0) {
+		return -1;
+	}
+
+	// wd 로 경로를 찾을 수 있도록 보관한다. (새 하위 디렉터리 등록)
+	if (wd >= watch_wd_cap) {
+		cap = (wd + 1) * 2;
+		paths = realloc(watch_wd_paths, cap * sizeof(char *));
+		if (paths == NULL) {
+			return 0;
+		}
+		memset(paths + watch_wd_cap, 0, (cap - watch_wd_cap) * sizeof(char *));
+		watch_wd_paths = paths;
+		watch_wd_cap = cap;
+	}
+	if (watch_wd_paths[wd] == NULL) {
+		watch_wd_paths[wd] = strdup(path);
+		watch_nwds++;
+	}
+
+	fd = open(path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0) {
+		return 0;		// 일반 파일
+	}
+	if (dir_reader_init(&dr, fd) < 0) {
+		close(fd);
+		return 0;
+	}
+	while ((d_entry = dir_reader_next(&dr)) != NULL) {
+		if (!strcmp(d_entry->d_name, ".") || !strcmp(d_entry->d_name, "..")) {
+			continue;
+		}
+		// d_type 을 알려주지 않는 파일 시스템이면 fstatat 으로 확인
+		if (d_entry->d_type == DT_UNKNOWN) {
+			if (fstatat(fd, d_entry->d_name, &statbuf, AT_SYMLINK_NOFOLLOW) < 0 ||
+				!S_ISDIR(statbuf.st_mode)) {
+				continue;
+			}
+		} else if (d_entry->d_type != DT_DIR) {
+			continue;
+		}
+		if (snprintf(sub, MAXPATH, "%s/%s", path, d_entry->d_name) < MAXPATH) {
+			watch_add(ifd, sub);
+		}
+	}
+	dir_reader_close(&dr);
+
+	return 0;
+}
+
+
+/*
+ * watch_drain
+ *
+ * 쌓인 inotify 이벤트를 모두 읽는다. 새로 생긴 디렉터리는 등록하고,
+ * 지워진 watch 의 경로는 해제한다.
+ */
+void watch_drain(int ifd)
+{
+	char buf[WATCH_EVBUF_SIZE] __attribute__((aligned(8)));
+	char sub[MAXPATH];
+	struct inotify_event *ev;
+	ssize_t n, off;
+
+	while ((n = read(ifd, buf, sizeof(buf))) > 0) {
+		for (off = 0; off < n; off += sizeof(*ev) + ev->len) {
+			ev = (struct inotify_event *)(buf + off);
+			if (ev->wd < 0 || ev->wd >= watch_wd_cap ||
+				watch_wd_paths[ev->wd] == NULL) {
+				continue;
+			}
+			if ((ev->mask & IN_ISDIR) && (ev->mask & (IN_CREATE | IN_MOVED_TO)) &&
+				ev->len > 0 && snprintf(sub, MAXPATH, "%s/%s",
+						watch_wd_paths[ev->wd], ev->name) < MAXPATH) {
+				watch_add(ifd, sub);
+			}
+			if (ev->mask & IN_IGNORED) {
+				free(watch_wd_paths[ev->wd]);
+				watch_wd_paths[ev->wd] = NULL;
+				watch_nwds--;
+			}
+		}
+	}
+}
+
+
+/*
+ * watch_release
+ *
+ * inotify fd 와 보관한 경로를 해제한다.
+ */
+void watch_release(int ifd)
+{
+	int i;
+
+	if (ifd >= 0) {
+		close(ifd);
+	}
+	for (i = 0; i < watch_wd_cap; i++) {
+		free(watch_wd_paths[i]);
+	}
+	free(watch_wd_paths);
+	watch_wd_paths = NULL;
+	watch_wd_cap = 0;
+	watch_nwds = 0;
+}
+
+
+/*
+ * watch_run
+ *
+ * 명령을 한 번 실행하여 표준 출력을 mfd (memfd) 에 받고, 줄로 나누어
+ * text 에 저장한다. 내장 명령은 셸에서, 외부 명령은 자식에서 실행한다.
+ * 명령의 종료 상태는 *status 에 넣는다. (셸의 last_status 와 같은 형식)
+ */
+int watch_run(int argc, char **argv, int mfd, struct watch_text *text,
+			  int *status)
+{
+	FILE *saved_out = sh_out, *saved_err = sh_err;
+	int saved_in = sh_in, saved_status = last_status, fd;
+	struct stat st;
+	pid_t pid;
+
+	if (ftruncate(mfd, 0) < 0 || lseek(mfd, 0, SEEK_SET) < 0) {
+		return -1;
+	}
+
+	if (find_builtin(argv[0]) != NULL) {
+		fd = dup(mfd);
+		last_status = 1;
+		if (fd >= 0 && open_builtin_io(NULL, 0, -1, fd) == 0) {
+			builtin_cmd(argc, argv);
+			close_builtin_io();
+		}
+		*status = last_status;
+		sh_in = saved_in;
+		sh_out = saved_out;
+		sh_err = saved_err;
+		last_status = saved_status;
+	} else {
+		*status = 127;
+		pid = spawn_cmd(argv, -1, mfd, NULL, 0);
+		if (pid > 0 && wait_cmd(pid, status, 0) > 0) {
+			*status = WIFEXITED(*status) ? WEXITSTATUS(*status) :
+				128 + WTERMSIG(*status);
+		}
+	}
+
+	// 출력을 읽어서 줄로 나눈다.
+	if (fstat(mfd, &st) < 0) {
+		return -1;
+	}
+	text->len = st.st_size;
+	text->buf = malloc(text->len + 1);
+	if (text->buf == NULL ||
+		pread(mfd, text->buf, text->len, 0) != (ssize_t)text->len) {
+		return -1;
+	}
+	return watch_text_split(text);
+}
+
+
+/*
+ * watch_text_split
+ *
+ * text->buf 를 줄 단위로 나누고 줄마다 hash 를 계산한다.
+ */
+int watch_text_split(struct watch_text *text)
+{
+	char *p = text->buf, *end = text->buf + text->len, *nl;
+	unsigned int h;
+	int i, n = 0;
+
+	for (nl = p; nl < end && (nl = memchr(nl, '\n', end - nl)) != NULL; nl++) {
+		n++;
+	}
+	if (text->len > 0 && end[-1] != '\n') {
+		n++;
+	}
+
+	text->line = malloc((n + 1) * sizeof(char *));
+	text->llen = malloc((n + 1) * sizeof(int));
+	text->hash = malloc((n + 1) * sizeof(unsigned int));
+	if (text->line == NULL || text->llen == NULL || text->hash == NULL) {
+		return -1;
+	}
+
+	// 줄 길이는 '\n' 을 포함한다.
+	for (i = 0; i < n; i++) {
+		nl = memchr(p, '\n', end - p);
+		nl = (nl != NULL) ? nl + 1 : end;
+		text->line[i] = p;
+		text->llen[i] = nl - p;
+		for (h = 2166136261u; p < nl; p++) {
+			h = (h ^ (unsigned char)*p) * 16777619u;
+		}
+		text->hash[i] = h;
+	}
+	text->nlines = n;
+
+	return 0;
+}
+
+
+/*
+ * watch_text_free
+ */
+void watch_text_free(struct watch_text *text)
+{
+	free(text->buf);
+	free(text->line);
+	free(text->llen);
+	free(text->hash);
+	memset(text, 0, sizeof(*text));
+}
+
+
+/*
+ * watch_diff
+ *
+ * 이전 출력 a 와 새 출력 b 가 다르면 시각과 변경 줄 수를 출력한 뒤,
+ * 지워진 줄은 '-', 추가된 줄은 '+' 를 붙여 출력한다.
+ * 앞뒤의 같은 줄을 제외한 나머지에 Myers diff (O(ND)) 를 적용하며,
+ * 차이가 WATCH_MAXDIFF 줄을 넘으면 나머지 전체를 바뀐 것으로 출력한다.
+ */
+void watch_diff(struct watch_text *a, struct watch_text *b, char *name)
+{
+	int pre = 0, suf = 0, n, m, max, d, k, x, y, px, found = -1, nedits = 0;
+	int *v = NULL, *trace = NULL, *edits = NULL, *row, ndel = 0, nins = 0, i, valid;
+	struct tm tm;
+	time_t now;
+
+	// 앞뒤의 같은 줄
+	while (pre < a->nlines && pre < b->nlines && watch_line_eq(a, pre, b, pre)) {
+		pre++;
+	}
+	while (suf < a->nlines - pre && suf < b->nlines - pre &&
+		   watch_line_eq(a, a->nlines - 1 - suf, b, b->nlines - 1 - suf)) {
+		suf++;
+	}
+	n = a->nlines - pre - suf;
+	m = b->nlines - pre - suf;
+	if (n == 0 && m == 0) {
+		return;		// 변경 없음
+	}
+
+	// v[k]: 대각선 k 에서 d 번 편집으로 도달한 가장 먼 x (-1 은 격자 밖)
+	// trace: d 단계마다 v[-d..d] 를 보관 (역추적용, d*d 위치부터)
+	max = (n + m < WATCH_MAXDIFF) ? n + m : WATCH_MAXDIFF;
+	v = malloc((2 * max + 3) * sizeof(int));
+	trace = malloc((size_t)(max + 1) * (max + 1) * sizeof(int));
+	edits = malloc((max + 1) * sizeof(int));
+	if (v != NULL && trace != NULL && edits != NULL) {
+		v += max + 1;
+		v[1] = 0;
+		for (d = 0; d <= max && found < 0; d++) {
+			for (k = -d; k <= d; k += 2) {
+				if (k == -d || (k != d && v[k - 1] < v[k + 1])) {
+					x = v[k + 1];			// 아래로: b 의 줄 추가
+					valid = (x >= 0);
+				} else {
+					x = v[k - 1] + 1;		// 오른쪽: a 의 줄 삭제
+					valid = (v[k - 1] >= 0);
+				}
+				y = x - k;
+				valid = valid && y >= 0 && x <= n && y <= m;
+				while (valid && x < n && y < m &&
+					   watch_line_eq(a, pre + x, b, pre + y)) {
+					x++;
+					y++;
+				}
+				v[k] = valid ? x : -1;
+				trace[d * d + d + k] = v[k];
+				if (valid && x == n && y == m) {
+					found = d;
+					break;
+				}
+			}
+		}
+		v -= max + 1;
+	}
+
+	// (n, m) 에서 거꾸로 편집을 찾는다.
+	if (found >= 0) {
+		x = n;
+		y = m;
+		for (d = found; d > 0; d--) {
+			row = trace + (d - 1) * (d - 1) + (d - 1);
+			k = x - y;
+			if (k == -d || (k != d && row[k - 1] < row[k + 1])) {
+				px = row[k + 1];
+				edits[nedits++] = pre + px - (k + 1) + 1;		// b 의 줄 추가
+				y = px - (k + 1);
+				x = px;
+				nins++;
+			} else {
+				px = row[k - 1];
+				edits[nedits++] = -(pre + px + 1);				// a 의 줄 삭제
+				y = px - (k - 1);
+				x = px;
+				ndel++;
+			}
+		}
+	} else {
+		ndel = n;
+		nins = m;
+	}
+
+	time(&now);
+	localtime_r(&now, &tm);
+	fprintf(sh_out, "--- %02d:%02d:%02d %s: -%d +%d\n", tm.tm_hour, tm.tm_min,
+			tm.tm_sec, name, ndel, nins);
+
+	if (found >= 0) {
+		for (i = nedits - 1; i >= 0; i--) {
+			if (edits[i] < 0) {
+				fputc('-', sh_out);
+				watch_put_line(a, -edits[i] - 1);
+			} else {
+				fputc('+', sh_out);
+				watch_put_line(b, edits[i] - 1);
+			}
+		}
+	} else {
+		for (i = pre; i < pre + n; i++) {
+			fputc('-', sh_out);
+			watch_put_line(a, i);
+		}
+		for (i = pre; i < pre + m; i++) {
+			fputc('+', sh_out);
+			watch_put_line(b, i);
+		}
+	}
+
+	free(v);
+	free(trace);
+	free(edits);
+}
+
+
+/*
+ * watch_line_eq
+ *
+ * a 의 i 번째 줄과 b 의 j 번째 줄이 같으면 1 을 리턴한다.
+ */
+int watch_line_eq(struct watch_text *a, int i, struct watch_text *b, int j)
+{
+	return a->hash[i] == b->hash[j] && a->llen[i] == b->llen[j] &&
+		   !memcmp(a->line[i], b->line[j], a->llen[i]);
+}
+
+
+/*
+ * watch_put_line
+ *
+ * text 의 i 번째 줄을 출력한다. (마지막 줄에 '\n' 이 없으면 붙임)
+ */
+void watch_put_line(struct watch_text *text, int i)
+{
+	fwrite(text->line[i], 1, text->llen[i], sh_out);
+	if (text->llen[i] == 0 || text->line[i][text->llen[i] - 1] != '\n') {
+		fputc('\n', sh_out);
+	}
+}
+
+
+/*
+ * joblog_cmd
+ *
+ * 사용법: joblog                           capture 상태와 job 별 출력 크기
+ *         joblog on [-b bytes] [-s dir]    이후 background job 의 출력을 받음
+ *         joblog off
+ *         joblog [-f] id                   job 의 출력 (-f: 끝날 때까지 따라감)
+ *
+ * capture 하는 job 은 stdout, stderr 가 파이프로 연결되고, 출력 스레드가
+ * epoll 로 모든 파이프를 읽어 job 별 ring (-b, 기본 64KB) 에 최근 출력을
+ * 보관한다. job 은 파이프에 막히지 않고 메모리는 ring 크기로 제한되며,
+ * ring 을 넘은 오래된 출력은 버린다. -s 이면 전체 출력을 dir/job-<id>-<pid>.log
+ * 에도 저장한다.
+ */
+int joblog_cmd(int argc, char **argv)
+{
+	struct joblog *jl, *found = NULL;
+	char *dir = NULL;
+	long long size = joblog_size;
+	int i, follow = 0, id;
+
+	if (argc == 1) {
+		fprintf(sh_out, "joblog: %s, ring %zu bytes", joblog_on ? "on" : "off",
+				joblog_size);
+		if (joblog_dir != NULL) {
+			fprintf(sh_out, ", spill %s", joblog_dir);
+		}
+		fputc('\n', sh_out);
+		pthread_mutex_lock(&joblog_lock);
+		for (jl = joblog_list; jl != NULL; jl = jl->next) {
+			fprintf(sh_out, "[%d] %d %-7s %llu bytes, %llu dropped  %s\n",
+					jl->id, jl->pid, (jl->fd >= 0) ? "Running" : "Done",
+					jl->total, (jl->total > jl->size) ? jl->total - jl->size : 0,
+					jl->cmd);
+		}
+		pthread_mutex_unlock(&joblog_lock);
+		return 0;
+	}
+
+	if (!strcmp(argv[1], "on")) {
+		for (i = 2; i < argc - 1; i++) {
+			if (!strcmp(argv[i], "-b")) {
+				size = atoll(argv[++i]);
+			} else if (!strcmp(argv[i], "-s")) {
+				dir = argv[++i];
+			} else {
+				break;
+			}
+		}
+		if (i < argc || size <= 0) {
+			fprintf(sh_err, "Usage: %s on [-b bytes] [-s dir]\n", argv[0]);
+			return 1;
+		}
+		// server mode 의 자식은 zygote 가 실행하므로 파이프를 넘길 수 없다.
+		if (server_mode) {
+			fprintf(sh_err, "joblog: not available in server mode\n");
+			return 1;
+		}
+		if (joblog_start() < 0) {
+			fprintf(sh_err, "joblog: %s\n", strerror(errno));
+			return 1;
+		}
+		joblog_size = size;
+		free(joblog_dir);
+		joblog_dir = (dir != NULL) ? strdup(dir) : NULL;
+		joblog_on = 1;
+		return 0;
+	}
+	if (!strcmp(argv[1], "off")) {
+		joblog_on = 0;
+		return 0;
+	}
+
+	i = 1;
+	if (!strcmp(argv[1], "-f")) {
+		follow = 1;
+		i++;
+	}
+	if (i != argc - 1) {
+		fprintf(sh_err, "Usage: %s [on [-b bytes] [-s dir] | off | [-f] id]\n",
+				argv[0]);
+		return 1;
+	}
+	id = atoi(argv[i] + (argv[i][0] == '%'));
+
+	// 같은 번호가 다시 쓰였으면 가장 최근 job
+	pthread_mutex_lock(&joblog_lock);
+	for (jl = joblog_list; jl != NULL; jl = jl->next) {
+		if (jl->id == id) {
+			found = jl;
+		}
+	}
+	pthread_mutex_unlock(&joblog_lock);
+	if (found == NULL) {
+		fprintf(sh_err, "joblog: %s: no such job\n", argv[i]);
+		return 1;
+	}
+
+	return joblog_show(found, follow);
+}
+
 
 /*
- * 
- * 내장 명령 처리 함수들
- * argc, argv를 인자로 받는다.
- * 
+ * joblog_start
+ *
+ * 출력 스레드를 처음 한 번 시작한다.
  */
-int list_files(int argc, char **argv)
+int joblog_start(void)
 {
-	char *dirname, current_dir[] = ".";
-	char pathname[MAXPATH];
-	DIR *dp;
-	struct dirent *d_entry;
-	int lflag = 0;
-	struct stat statbuf;
+	if (joblog_epfd >= 0) {
+		return 0;
+	}
 
-	// 명령 인자 개수를 확인
-	if (argc == 1) {
-		dirname = current_dir;
-	} else if (argc == 2) {
-		dirname = argv[1];
-	} else {
-		fprintf(stderr, "Usage: %s [dir name]\n", argv[0]);
-		return 1;
+	joblog_epfd = epoll_create1(EPOLL_CLOEXEC);
+	joblog_evfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (joblog_epfd < 0 || joblog_evfd < 0 ||
+		(errno = pthread_create(&joblog_tid, NULL, joblog_thr_fn, NULL)) != 0) {
+		if (joblog_epfd >= 0) {
+			close(joblog_epfd);
+		}
+		if (joblog_evfd >= 0) {
+			close(joblog_evfd);
+		}
+		joblog_epfd = joblog_evfd = -1;
+		return -1;
 	}
+	pthread_detach(joblog_tid);
 
-	// 명령어 종류 확인 ls / ll
-	if (!strcmp(argv[0], "ll")) {
-		lflag = 1;
+	return 0;
+}
+
+
+/*
+ * joblog_attach
+ *
+ * job 의 출력 파이프 (읽기) fd 를 출력 스레드에 등록한다. fd 는 닫아 준다.
+ * 같은 번호의 끝난 출력과 JOBLOG_KEEP 개를 넘는 오래된 끝난 출력은 버린다.
+ */
+void joblog_attach(int id, pid_t pid, char *cmd, int fd)
+{
+	struct joblog *jl, *old, **pp;
+	struct epoll_event ev;
+	char path[MAXPATH];
+	int ndone = 0;
+
+	jl = calloc(1, sizeof(*jl));
+	if (jl == NULL) {
+		close(fd);
+		return;
 	}
+	jl->id = id;
+	jl->pid = pid;
+	snprintf(jl->cmd, sizeof(jl->cmd), "%s", cmd);
+	jl->size = joblog_size;
+	jl->fd = fd;
+	jl->spill_fd = -1;
+	if (joblog_dir != NULL) {
+		snprintf(path, sizeof(path), "%s/job-%d-%d.log", joblog_dir, id, pid);
+		jl->spill_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+							DEFAULT_FILE_MODE);
+		if (jl->spill_fd < 0) {
+			fprintf(stderr, "joblog: %s: %s\n", path, strerror(errno));
+		}
+	}
+	fcntl(fd, F_SETFL, O_NONBLOCK);
 
-	dp = opendir(dirname);
-	if (dp == NULL) {
-		fprintf(stderr, "directory open error\n");
-		return 1;
+	// 끝난 출력만 해제한다. (출력 스레드는 끝난 출력을 다시 쓰지 않음)
+	pthread_mutex_lock(&joblog_lock);
+	for (old = joblog_list; old != NULL; old = old->next) {
+		if (old->fd < 0) {
+			ndone++;
+		}
+	}
+	for (pp = &joblog_list; (old = *pp) != NULL; ) {
+		if (old->fd < 0 && (old->id == id || ndone > JOBLOG_KEEP)) {
+			*pp = old->next;
+			free(old->ring);
+			free(old);
+			ndone--;
+		} else {
+			pp = &old->next;
+		}
+	}
+	*pp = jl;
+	pthread_mutex_unlock(&joblog_lock);
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = jl;
+	if (epoll_ctl(joblog_epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		// 읽지 못하면 끝난 것으로 처리한다. (job 은 EPIPE 를 받음)
+		pthread_mutex_lock(&joblog_lock);
+		close(jl->fd);
+		jl->fd = -1;
+		pthread_mutex_unlock(&joblog_lock);
+		if (jl->spill_fd >= 0) {
+			close(jl->spill_fd);
+		}
 	}
+}
 
-	d_entry = readdir(dp);
-	while (d_entry != NULL) {
-		// ".", ".." 제외
-		//if (d_entry->d_name[0] != '.') {
-		if (strcmp(d_entry->d_name, ".") &&
-			strcmp(d_entry->d_name, "..")) {
-			if (lflag == 0) {	// ls 명령
-				printf("%s\n", d_entry->d_name);
-			} else {			// ll 명령
-				sprintf(pathname, "%s/%s", dirname, d_entry->d_name);
-				if (stat(pathname, &statbuf)) {
-					fprintf(stderr, "file information error\n");
-					closedir(dp);
-					return 1;
+
+/*
+ * joblog_close
+ *
+ * 등록하지 않은 capture 파이프를 닫는다.
+ */
+void joblog_close(int *fds)
+{
+	if (fds[0] >= 0) {
+		close(fds[0]);
+	}
+	if (fds[1] >= 0) {
+		close(fds[1]);
+	}
+}
+
+
+/*
+ * joblog_thr_fn
+ *
+ * 출력 스레드: 모든 job 의 파이프를 epoll 로 기다려 읽고 ring 에 넣는다.
+ * 한 번에 JOBLOG_READ_SIZE 만 읽어 출력이 많은 job 이 다른 job 을 막지 않는다.
+ */
+void *joblog_thr_fn(void *arg)
+{
+	struct epoll_event ev[JOBLOG_MAXEVENTS];
+	struct joblog *jl;
+	char *buf = malloc(JOBLOG_READ_SIZE);
+	ssize_t len, n, off;
+	int i, nev;
+
+	(void)arg;
+
+	while (buf != NULL) {
+		nev = epoll_wait(joblog_epfd, ev, JOBLOG_MAXEVENTS, -1);
+		if (nev < 0 && errno != EINTR) {
+			break;
+		}
+		for (i = 0; i < nev; i++) {
+			jl = ev[i].data.ptr;
+			len = read(jl->fd, buf, JOBLOG_READ_SIZE);
+			if (len < 0 && (errno == EAGAIN || errno == EINTR)) {
+				continue;
+			}
+
+			// spill 파일에 실패하면 그 job 은 ring 만 사용한다.
+			for (off = 0; len > 0 && jl->spill_fd >= 0 && off < len; off += n) {
+				n = write(jl->spill_fd, buf + off, len - off);
+				if (n <= 0) {
+					close(jl->spill_fd);
+					jl->spill_fd = -1;
 				}
-				print_long_format(d_entry->d_name, &statbuf);
 			}
+			if (len <= 0) {
+				epoll_ctl(joblog_epfd, EPOLL_CTL_DEL, jl->fd, NULL);
+				if (jl->spill_fd >= 0) {
+					close(jl->spill_fd);
+					jl->spill_fd = -1;
+				}
+			}
+
+			pthread_mutex_lock(&joblog_lock);
+			if (len > 0) {
+				joblog_put(jl, buf, len);
+			} else {
+				close(jl->fd);
+				jl->fd = -1;
+			}
+			if (jl == joblog_follow) {
+				eventfd_write(joblog_evfd, 1);
+			}
+			pthread_mutex_unlock(&joblog_lock);
 		}
-		d_entry = readdir(dp);
 	}
+	free(buf);
 
-	closedir(dp);
+	return NULL;
+}
+
+
+/*
+ * joblog_put
+ *
+ * ring 에 data 를 넣는다. (joblog_lock 을 가진 상태)
+ * ring 은 처음 출력이 올 때 할당하며, 넘친 오래된 출력은 덮어쓴다.
+ */
+void joblog_put(struct joblog *jl, const char *data, size_t len)
+{
+	size_t pos, n;
+
+	if (jl->ring == NULL && (jl->ring = malloc(jl->size)) == NULL) {
+		jl->total += len;
+		return;
+	}
+	if (len > jl->size) {
+		data += len - jl->size;
+		jl->total += len - jl->size;
+		len = jl->size;
+	}
+
+	pos = jl->total % jl->size;
+	n = (len < jl->size - pos) ? len : jl->size - pos;
+	memcpy(jl->ring + pos, data, n);
+	memcpy(jl->ring, data + n, len - n);
+	jl->total += len;
+}
+
+
+/*
+ * joblog_copy
+ *
+ * ring 의 from 위치부터 최대 max 바이트를 buf 로 복사하고 크기를 리턴한다.
+ * (joblog_lock 을 가진 상태, from 은 ring 에 남아 있는 위치)
+ */
+size_t joblog_copy(struct joblog *jl, unsigned long long from, char *buf,
+				   size_t max)
+{
+	size_t len, pos, n;
+
+	if (jl->ring == NULL || from >= jl->total) {
+		return 0;
+	}
+	len = jl->total - from;
+	if (len > max) {
+		len = max;
+	}
+
+	pos = from % jl->size;
+	n = (len < jl->size - pos) ? len : jl->size - pos;
+	memcpy(buf, jl->ring + pos, n);
+	memcpy(buf + n, jl->ring, len - n);
+
+	return len;
+}
+
+
+/*
+ * joblog_show
+ *
+ * job 의 ring 에 남은 출력을 출력한다. follow 이면 job 의 출력이 끝날 때까지
+ * (터미널에서는 q / Ctrl-C 까지) 새 출력을 이어서 출력한다.
+ */
+int joblog_show(struct joblog *jl, int follow)
+{
+	struct termios orig, raw;
+	struct pollfd pfd[2];
+	unsigned long long pos = 0, start;
+	eventfd_t cnt;
+	size_t len;
+	char *buf, key;
+	int done, tty = 0, n;
+
+	buf = malloc(JOBLOG_READ_SIZE);
+	if (buf == NULL) {
+		fprintf(sh_err, "joblog: %s\n", strerror(errno));
+		return 1;
+	}
+
+	if (follow) {
+		if (isatty(sh_in) && tcgetattr(sh_in, &orig) == 0) {
+			raw = orig;
+			raw.c_lflag &= ~(ICANON | ECHO | ISIG);
+			raw.c_cc[VMIN] = 1;
+			raw.c_cc[VTIME] = 0;
+			tty = (tcsetattr(sh_in, TCSADRAIN, &raw) == 0);
+		}
+		pthread_mutex_lock(&joblog_lock);
+		joblog_follow = jl;
+		pthread_mutex_unlock(&joblog_lock);
+		eventfd_read(joblog_evfd, &cnt);
+	}
+
+	while (1) {
+		// 읽는 동안 덮어쓴 출력은 건너뛴다.
+		pthread_mutex_lock(&joblog_lock);
+		start = (jl->total > jl->size) ? jl->total - jl->size : 0;
+		if (pos < start) {
+			fflush(sh_out);
+			fprintf(sh_err, "joblog: [%d] %llu bytes dropped\n", jl->id,
+					start - pos);
+			pos = start;
+		}
+		len = joblog_copy(jl, pos, buf, JOBLOG_READ_SIZE);
+		done = (jl->fd < 0);
+		pthread_mutex_unlock(&joblog_lock);
+
+		if (len > 0) {
+			pos += len;
+			if (fwrite(buf, 1, len, sh_out) != len) {
+				break;		// EPIPE
+			}
+			continue;
+		}
+		if (!follow || done || fflush(sh_out) == EOF) {
+			break;
+		}
+
+		// 새 출력 (출력 스레드가 eventfd 로 알림) 이나 키 입력을 기다린다.
+		pfd[0].fd = joblog_evfd;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = tty ? sh_in : -1;
+		pfd[1].events = POLLIN;
+		n = poll(pfd, 2, -1);
+		if (n < 0 && errno != EINTR) {
+			break;
+		}
+		if (n > 0 && pfd[1].revents &&
+			(read(sh_in, &key, 1) != 1 || key == 'q' || key == 3)) {
+			break;
+		}
+		if (n > 0 && pfd[0].revents) {
+			eventfd_read(joblog_evfd, &cnt);
+		}
+	}
+	fflush(sh_out);
+
+	if (follow) {
+		pthread_mutex_lock(&joblog_lock);
+		joblog_follow = NULL;
+		pthread_mutex_unlock(&joblog_lock);
+		if (tty) {
+			tcsetattr(sh_in, TCSADRAIN, &orig);
+		}
+	}
+	free(buf);
 
 	return 0;
 }
 
 
-void print_long_format(char *filename, struct stat *statbuf)
+/*
+ * copy_fd_data
+ *
+ * in_fd 의 데이터를 현재 위치부터 끝까지 out_fd 로 복사한다.
+ * 가능한 가장 빠른 방법을 순서대로 시도한다.
+ *   1. reflink (FICLONE): 같은 파일 시스템에서 데이터 블록을 공유 (복사 없음)
+ *   2. copy_file_range: 커널 내부 복사 (user space 복사 없음)
+ *   3. read/write: 위 방법을 지원하지 않는 경우
+ * 복사한 바이트 수를 리턴하고, 에러면 -1 을 리턴한다.
+ */
+off_t copy_fd_data(int in_fd, int out_fd)
 {
-	char timestr[30];
+	struct stat statbuf;
+	char buffer[COPY_BUF_SIZE];
+	off_t total = 0;
+	ssize_t rd_count, wt_count, n;
 
-	// 디렉터리 / 파일
-	if (S_ISDIR(statbuf->st_mode)) {
-		printf("d");
-	} else {
-		printf("-");
+	if (fstat(in_fd, &statbuf) < 0) {
+		return -1;
 	}
 
-	// 파일 접근 모드
-	printf("%c%c%c%c%c%c%c%c%c ", 
-		(statbuf->st_mode & S_IRUSR) ? 'r' : '-',
-		(statbuf->st_mode & S_IWUSR) ? 'w' : '-',
-		(statbuf->st_mode & S_IXUSR) ? 'x' : '-',
-		(statbuf->st_mode & S_IRGRP) ? 'r' : '-',
-		(statbuf->st_mode & S_IWGRP) ? 'w' : '-',
-		(statbuf->st_mode & S_IXGRP) ? 'x' : '-',
-		(statbuf->st_mode & S_IROTH) ? 'r' : '-',
-		(statbuf->st_mode & S_IWOTH) ? 'w' : '-',
-		(statbuf->st_mode & S_IXOTH) ? 'x' : '-');
+	// /proc 파일처럼 크기가 0 으로 보이는 파일은 read/write 로 복사
+	if (S_ISREG(statbuf.st_mode) && statbuf.st_size > 0) {
+		if (lseek(in_fd, 0, SEEK_CUR) == 0 &&
+			ioctl(out_fd, FICLONE, in_fd) == 0) {
+			return statbuf.st_size;
+		}
 
-	// 하드 링크 개수
-	printf("%2d ", statbuf->st_nlink);
+		while ((n = copy_file_range(in_fd, NULL, out_fd, NULL,
+						COPY_CHUNK_SIZE, 0)) > 0) {
+			total += n;
+			copy_report(n);
+		}
+		if (n == 0) {
+			return total;
+		}
 
-	// 사용자 id와 그룹 id
-	printf("%4d ", statbuf->st_uid);
-	printf("%4d ", statbuf->st_gid);
+		// 이미 일부를 복사했으면 에러, 아니면 read/write 로 다시 시도
+		if (total > 0 || (errno != EXDEV && errno != EINVAL &&
+			errno != ENOSYS && errno != EOPNOTSUPP && errno != EBADF)) {
+			return -1;
+		}
+	}
 
-	// 파일 크기
-	printf("%10d ", (int) statbuf->st_size);
+	// 버퍼를 이용하여 소스 파일을 읽어서 목적 파일에 기록한다.
+	while ((rd_count = read(in_fd, buffer, COPY_BUF_SIZE)) > 0) {
+		for (n = 0; n < rd_count; n += wt_count) {
+			wt_count = write(out_fd, buffer + n, rd_count - n);
+			if (wt_count <= 0) {
+				return -1;
+			}
+		}
+		total += rd_count;
+		copy_report(rd_count);
+	}
 
-	// 파일 수정 시간
-	ctime_r(&statbuf->st_mtime, timestr);
-	timestr[16] = 0;
-	printf("%s ", (char *) &(timestr[4]));
+	return (rd_count < 0) ? -1 : total;
+}
 
-	// 파일 이름
-	printf("%s\n", filename);
 
-	return;
+/*
+ * copy_report
+ *
+ * 복사 도중에 n 바이트를 더 복사했음을 copy_progress 에 알린다.
+ * (큰 파일을 복사하는 동안에도 dcp_monitor 가 처리량을 잴 수 있도록)
+ */
+void copy_report(off_t n)
+{
+	if (copy_progress != NULL) {
+		atomic_fetch_add_explicit(copy_progress, n, memory_order_relaxed);
+	}
 }
 
 
-int copy_file(int argc, char **argv)
+/*
+ * copy_fd_bulk
+ *
+ * bulk 복사 모드 (-B). 큰 백업 복사가 다른 서비스의 page cache 를
+ * 밀어내지 않도록 복사한다.
+ *   1. O_DIRECT: 정렬된 큰 버퍼로 page cache 를 거치지 않고 읽고 쓴다.
+ *      마지막 블록은 정렬 크기까지 채워서 쓰고 ftruncate 로 줄인다.
+ *   2. O_DIRECT 를 지원하지 않으면 buffered read/write 를 하면서 쓰기
+ *      커서 뒤의 구간을 sync_file_range 로 내려 보내고 DONTNEED 로 버린다.
+ *      소스는 복사를 시작하기 전에 cache 에 없던 구간만 버린다 (원래 hot 인
+ *      데이터는 그대로 둔다). readahead 가 미리 읽은 page 와 구분하기 위해
+ *      시작할 때 chunk 별 상태를 한 번에 기록해 둔다.
+ * 복사한 바이트 수를 리턴하고, 에러면 -1 을 리턴한다.
+ */
+off_t copy_fd_bulk(int in_fd, int out_fd)
 {
-#if 0
-	char *in_file, *out_file;
-	FILE *in, *out;	
-	int c;
+	struct stat statbuf;
+	char *buf, *hot = NULL;
+	off_t total = 0, synced = 0, off;
+	ssize_t rd_count, wt_count, len, n;
+	int direct, ret = 0;
 
-	if (argc != 3) {
-		fprintf(stderr, "Usage: %s <src_file> <dst_file>\n", argv[0]);
-		return 1;
+	if (fstat(in_fd, &statbuf) < 0) {
+		return -1;
+	}
+	if (!S_ISREG(statbuf.st_mode)) {
+		return copy_fd_data(in_fd, out_fd);
+	}
+	if ((errno = posix_memalign((void **)&buf, BULK_ALIGN, BULK_BUF_SIZE))) {
+		return -1;
 	}
 
-	in_file = argv[1];
-	out_file = argv[2];
+	// 두 파일 모두 O_DIRECT 를 받아들일 때만 direct I/O 로 복사
+	direct = (lseek(in_fd, 0, SEEK_CUR) == 0 && bulk_set_direct(in_fd, 1) == 0);
+	if (direct && bulk_set_direct(out_fd, 1) < 0) {
+		bulk_set_direct(in_fd, 0);
+		direct = 0;
+	}
+	posix_fadvise(in_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
 
-	if ( (in = fopen(in_file,"r")) == NULL) {
-		fprintf(stderr,"Cannot open %s for reading\n",in_file);
-		return 1;
+	for (;;) {
+		if (!direct && hot == NULL &&
+			(hot = bulk_hot_map(in_fd, statbuf.st_size)) == NULL) {
+			ret = -1;
+			break;
+		}
+		rd_count = read(in_fd, buf, BULK_BUF_SIZE);
+		if (rd_count < 0 && errno == EINVAL && direct) {
+			// 이 파일 시스템은 O_DIRECT read 를 지원하지 않음
+			bulk_set_direct(in_fd, 0);
+			bulk_set_direct(out_fd, 0);
+			direct = 0;
+			continue;
+		}
+		if (rd_count <= 0) {
+			ret = rd_count;
+			break;
+		}
+
+		// O_DIRECT 의 마지막 블록은 정렬 크기까지 0 으로 채운다.
+		len = rd_count;
+		if (direct && (len & (BULK_ALIGN - 1))) {
+			len = (len + BULK_ALIGN - 1) & ~(off_t)(BULK_ALIGN - 1);
+			memset(buf + rd_count, 0, len - rd_count);
+		}
+		for (n = 0; n < len; n += wt_count) {
+			wt_count = write(out_fd, buf + n, len - n);
+			if (wt_count < 0 && errno == EINVAL && direct && n == 0) {
+				// O_DIRECT write 를 받지 않으면 buffered 로 다시 쓴다.
+				// (이 chunk 도 buffered 로 끝내므로 cache 상태를 지금 기록)
+				bulk_set_direct(in_fd, 0);
+				bulk_set_direct(out_fd, 0);
+				direct = 0;
+				len = rd_count;
+				wt_count = 0;
+				hot = bulk_hot_map(in_fd, statbuf.st_size);
+				if (hot == NULL) {
+					ret = -1;
+					goto out;
+				}
+				continue;
+			}
+			if (wt_count <= 0) {
+				ret = -1;
+				goto out;
+			}
+		}
+		total += rd_count;
+		copy_report(rd_count);
+
+		if (len != rd_count) {
+			// 채운 부분을 잘라낸다. 뒤에 데이터가 더 있으면 buffered 로 계속
+			if (ftruncate(out_fd, total) < 0 || lseek(out_fd, total, SEEK_SET) < 0) {
+				ret = -1;
+				break;
+			}
+			bulk_set_direct(in_fd, 0);
+			bulk_set_direct(out_fd, 0);
+			direct = 0;
+			continue;
+		}
+		if (direct) {
+			continue;
+		}
+
+		// 방금 쓴 구간은 writeback 을 시작하고, 그 이전 구간은 끝나기를
+		// 기다려서 cache 에서 버린다.
+		sync_file_range(out_fd, total - rd_count, rd_count, SYNC_FILE_RANGE_WRITE);
+		if (total - rd_count > synced) {
+			bulk_drop_out(out_fd, synced, total - rd_count - synced);
+			synced = total - rd_count;
+		}
+		off = (total - rd_count) / BULK_BUF_SIZE;
+		if (off <= statbuf.st_size / BULK_BUF_SIZE && !hot[off]) {
+			posix_fadvise(in_fd, total - rd_count, rd_count, POSIX_FADV_DONTNEED);
+		}
 	}
-	if ( (out = fopen(out_file,"w")) == NULL) {
-		fprintf(stderr,"Cannot open %s for writing\n",out_file);
-		return 1;
+
+	if (ret == 0 && total > synced) {
+		bulk_drop_out(out_fd, synced, total - synced);
 	}
+out:
+	free(hot);
+	free(buf);
+	return (ret < 0) ? -1 : total;
+}
 
-	while ( (c = getc(in)) != EOF)
-		putc(c,out);
 
-	fclose(in);
-	fclose(out);
-#else
-	
-	char *in_file, *out_file;
-    int in_fd, out_fd, rd_count, wt_count;
-    char buffer[BUF_SIZE];
- 
-	if (argc != 3) {
-		fprintf(stderr, "Usage: %s <src_file> <dst_file>\n", argv[0]);
-		return 1;
+/*
+ * bulk_hot_map
+ *
+ * 소스의 chunk 별 cache 상태를 기록한 배열을 할당하여 리턴한다.
+ * (1 이면 hot, 알 수 없으면 hot) 할당하지 못하면 NULL 을 리턴한다.
+ */
+char *bulk_hot_map(int fd, off_t size)
+{
+	char *hot;
+	off_t off;
+
+	hot = malloc(size / BULK_BUF_SIZE + 1);
+	if (hot == NULL) {
+		return NULL;
+	}
+	for (off = 0; off <= size; off += BULK_BUF_SIZE) {
+		hot[off / BULK_BUF_SIZE] = bulk_resident(fd, off, BULK_BUF_SIZE);
 	}
 
-	in_file = argv[1];
-	out_file = argv[2];
- 
-	// 소스 파일을 열고, 목적 파일을 생성한다.
-	in_fd = open(in_file, O_RDONLY);
-	if (in_fd < 0) {
-		fprintf(stderr, "source file (%s) open error\n", in_file);
-		return 1;
+	return hot;
+}
+
+
+/*
+ * bulk_set_direct
+ *
+ * fd 의 O_DIRECT 를 켜거나 끈다. 지원하지 않으면 -1 을 리턴한다.
+ */
+int bulk_set_direct(int fd, int on)
+{
+	int flags = fcntl(fd, F_GETFL);
+
+	if (flags < 0) {
+		return -1;
 	}
+	flags = on ? (flags | O_DIRECT) : (flags & ~O_DIRECT);
+	return fcntl(fd, F_SETFL, flags);
+}
 
-	out_fd = creat(out_file, DEFAULT_FILE_MODE);
-	if (out_fd < 0) {
-		fprintf(stderr, "destination file (%s) creation error\n", out_file);
-		return 1;
+
+/*
+ * bulk_resident
+ *
+ * fd 의 [off, off + len) 구간의 page 가 반 이상 page cache 에 있으면 1 을
+ * 리턴한다. 앞 구간을 읽을 때 readahead 로 들어온 page 는 구간의 앞부분
+ * 일부뿐이므로 hot 으로 보지 않는다. off 는 page 크기의 배수여야 한다.
+ */
+int bulk_resident(int fd, off_t off, size_t len)
+{
+	unsigned char vec[BULK_BUF_SIZE / BULK_ALIGN];
+	size_t i, npages;
+	long pagesize = sysconf(_SC_PAGESIZE);
+	void *p;
+	int ret = 0, resident = 0;
+
+	npages = (len + pagesize - 1) / pagesize;
+	if (npages > sizeof(vec)) {
+		npages = sizeof(vec);
 	}
- 
-    // 버퍼를 이용하여 소스 파일을 읽어서 목적 파일에 기록한다.
-	// 소스 파일의 끝까지 반복한다.
-	while (1) {
-		// 소스 파일에서 데이터 블록(버퍼) 읽기
-		rd_count = read(in_fd, buffer, BUF_SIZE);
+	p = mmap(NULL, npages * pagesize, PROT_READ, MAP_SHARED, fd, off);
+	if (p == MAP_FAILED) {
+		return 1;	// 알 수 없으면 cache 에 있다고 보고 버리지 않는다.
+	}
+	if (mincore(p, npages * pagesize, vec) < 0) {
+		ret = 1;
+	}
+	for (i = 0; i < npages; i++) {
+		resident += vec[i] & 1;
+	}
+	if (resident * 2 > (int)npages) {
+		ret = 1;
+	}
+	munmap(p, npages * pagesize);
+	return ret;
+}
 
-		// read error 혹은 파일의 끝이면 loop를 종료한다.
-		if (rd_count <= 0) {
-			break;
-		}
 
-		// 목적 파일에 데이터 쓰기
-		wt_count = write(out_fd, buffer, rd_count);
+/*
+ * bulk_drop_out
+ *
+ * 목적 파일의 [off, off + len) 구간이 디스크에 기록될 때까지 기다린 후
+ * page cache 에서 버린다.
+ */
+void bulk_drop_out(int fd, off_t off, off_t len)
+{
+	sync_file_range(fd, off, len, SYNC_FILE_RANGE_WAIT_BEFORE |
+					SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+	posix_fadvise(fd, off, len, POSIX_FADV_DONTNEED);
+}
+
 
-		// write error이면 파일 복사 실패
-		if (wt_count <= 0) {
-			fprintf(stderr, "write error\n");
-			return 1;
+/*
+ * copy_fd_verify
+ *
+ * 검증 모드 (-V) 의 복사. read/write 로 복사하면서 소스의 CRC32C 를 계산하고,
+ * 복사 후 목적 파일을 디스크에 기록하고 page cache 에서 버린 뒤 다시 읽어
+ * CRC32C 를 계산하여 비교한다. (verify_read_back) 짧은 write 와 파일 크기도
+ * 검사하며, 파일별 결과를 sh_out 으로 출력한다.
+ * 일반 파일이 아닌 목적 (장치, 파이프) 은 다시 읽을 수 없으므로 크기만 검사한다.
+ * 복사 에러나 불일치이면 1 을 리턴한다.
+ */
+int copy_fd_verify(char *in_file, int in_fd, int out_fd)
+{
+	struct stat statbuf;
+	char buffer[COPY_BUF_SIZE];
+	unsigned int src_crc = 0, dst_crc = 0;
+	off_t total = 0, written = 0, size = -1;
+	ssize_t rd_count, wt_count, n;
+	int bad, reg;
+
+	while ((rd_count = read(in_fd, buffer, COPY_BUF_SIZE)) > 0) {
+		src_crc = crc32c(src_crc, buffer, rd_count);
+		for (n = 0; n < rd_count; n += wt_count) {
+			wt_count = write(out_fd, buffer + n, rd_count - n);
+			if (wt_count <= 0) {
+				break;
+			}
+			written += wt_count;
 		}
-    }
- 
-	// read error이면 파일 복사 실패
+		total += rd_count;
+		copy_report(rd_count);
+		if (n < rd_count) {
+			rd_count = -1;
+			break;
+		}
+	}
 	if (rd_count < 0) {
-		fprintf(stderr, "read error\n");
-		return 1;
+		fprintf(sh_err, "copy (%s) error: %s\n", in_file, strerror(errno));
 	}
 
-	// 소스와 목적 파일을 닫는다.
-    close(in_fd);
-    close(out_fd);
-#endif
+	// 디스크에서 다시 읽은 데이터가 읽은 데이터와 같고, 크기도 같아야 한다.
+	reg = (fstat(out_fd, &statbuf) == 0 && S_ISREG(statbuf.st_mode));
+	if (reg && rd_count >= 0 && verify_read_back(out_fd, &dst_crc, &size) < 0) {
+		fprintf(sh_err, "verify (%s) read back error: %s\n", in_file,
+				strerror(errno));
+	}
+	bad = (rd_count < 0 || written != total ||
+		   (reg && (size != total || src_crc != dst_crc)));
+
+	verify_files++;
+	verify_bytes += total;
+	if (bad) {
+		verify_bad++;
+		fprintf(sh_out, "MISMATCH %08x %08x %lld %s\n", src_crc, dst_crc,
+				(long long)total, in_file);
+	} else if (copy_verbose) {
+		fprintf(sh_out, "OK       %08x %lld %s\n", src_crc,
+				(long long)total, in_file);
+	}
 
-	return 0;
+	return bad;
 }
 
 
-int remove_file(int argc, char **argv)
+/*
+ * verify_read_back
+ *
+ * 목적 파일을 디스크에 기록하고 (fdatasync) page cache 에서 버린 뒤
+ * 처음부터 다시 읽어 CRC32C 와 크기를 구한다. out_fd 는 쓰기 전용이므로
+ * /proc/self/fd 로 다시 연다. 실패하면 -1 을 리턴한다.
+ */
+int verify_read_back(int out_fd, unsigned int *crc, off_t *size)
 {
-	char *filename;
-	int ret;
-
-	if (argc != 2) {
-		fprintf(stderr, "Usage: %s <file_name>\n", argv[0]);
-		return 1;
+	char path[64], buffer[COPY_BUF_SIZE];
+	ssize_t rd_count;
+	int fd;
+
+	*crc = 0;
+	*size = 0;
+	if (fdatasync(out_fd) < 0) {
+		return -1;
 	}
+	posix_fadvise(out_fd, 0, 0, POSIX_FADV_DONTNEED);
 
-	filename = argv[1];
-
-	//ret = remove(filename);
-	ret = unlink(filename);
-	if (ret != 0) {
-		fprintf(stderr, "remove file error\n");
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", out_fd);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return -1;
 	}
+	while ((rd_count = read(fd, buffer, COPY_BUF_SIZE)) > 0) {
+		*crc = crc32c(*crc, buffer, rd_count);
+		*size += rd_count;
+	}
+	close(fd);
 
-	return ret;
+	return (rd_count < 0) ? -1 : 0;
 }
 
 
-int move_file(int argc, char **argv)
+/*
+ * verify_report
+ *
+ * 검증 모드의 전체 결과를 fp 로 출력하고 통계를 초기화한다.
+ */
+void verify_report(FILE *fp, int cmd_ret)
 {
-	char *old_file, *new_file;
-	int ret;
+	fprintf(fp, "verified %ld files, %lld bytes (crc32c%s): %ld mismatch%s\n",
+			(long)verify_files, (long long)verify_bytes,
+			crc32c_hw ? " sse4.2" : "", (long)verify_bad,
+			(cmd_ret != 0) ? ", copy errors" : "");
+	verify_files = verify_bad = 0;
+	verify_bytes = 0;
+}
 
-	if (argc != 3) {
-		fprintf(stderr, "Usage: %s <old_file> <new_file>\n", argv[0]);
-		return 1;
-	}
 
-	old_file = argv[1];
-	new_file = argv[2];
+/*
+ * crc32c_init
+ *
+ * CRC32C (Castagnoli) 계산을 준비한다. SSE4.2 crc32 명령이 있으면
+ * 사용하고, 없으면 테이블을 만든다. 복사 스레드를 만들기 전에 호출한다.
+ */
+void crc32c_init(void)
+{
+	unsigned int i, j, c;
 
-	ret = rename(old_file, new_file);
-	if (ret != 0) {
-		fprintf(stderr, "move file error\n");
+#if defined(__x86_64__)
+	crc32c_hw = __builtin_cpu_supports("sse4.2");
+#endif
+	if (crc32c_hw || crc32c_table[1] != 0) {
+		return;
+	}
+	for (i = 0; i < 256; i++) {
+		for (c = i, j = 0; j < 8; j++) {
+			c = (c & 1) ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+		}
+		crc32c_table[i] = c;
 	}
-
-	return ret;
 }
 
 
-int change_directory(int argc, char **argv)
+/*
+ * crc32c
+ *
+ * crc 에 buf 의 len 바이트를 더한 CRC32C 를 리턴한다. (처음에는 crc = 0)
+ */
+unsigned int crc32c(unsigned int crc, const void *buf, size_t len)
 {
-	char *dirname;
-	int ret;
+	const unsigned char *p = buf;
 
-	if (argc != 2) {
-		fprintf(stderr, "Usage: %s <dir_name>\n", argv[0]);
-		return 1;
+#if defined(__x86_64__)
+	if (crc32c_hw) {
+		return crc32c_sse42(crc, buf, len);
 	}
-
-	dirname = argv[1];
-
-	ret = chdir(dirname);
-	if (ret != 0) {
-		fprintf(stderr, "change directory error\n");
+#endif
+	crc = ~crc;
+	while (len-- > 0) {
+		crc = crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
 	}
-
-	return ret;
+	return ~crc;
 }
 
 
-int print_working_directory(void)
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+unsigned int crc32c_sse42(unsigned int crc, const void *buf, size_t len)
 {
-	char *cwd;
+	const unsigned char *p = buf;
+	unsigned long long c = ~crc, v;
 
-	cwd = getcwd(NULL, 0);
-	if (cwd == 0) {
-		fprintf(stderr, "get current working directory error\n");
-		return 1;
+	// 8 바이트씩 crc32 명령으로 계산하고 나머지는 1 바이트씩
+	for (; len >= 8; len -= 8, p += 8) {
+		memcpy(&v, p, 8);
+		c = _mm_crc32_u64(c, v);
 	}
-
-	fprintf(stderr, "%s\n", cwd);
-
-	return 0;
+	for (; len > 0; len--) {
+		c = _mm_crc32_u8(c, *p++);
+	}
+	return ~(unsigned int)c;
 }
+#endif
 
 
-int make_directory(int argc, char **argv)
+/*
+ * thread pool
+ *
+ * 고정된 개수의 worker 스레드가 작업 스택에서 작업을 꺼내 수행한다.
+ * 작업은 다른 작업을 추가할 수 있으며 (디렉터리 재귀 처리),
+ * 나중에 넣은 작업을 먼저 수행하여 (LIFO) 깊이 우선으로 진행하므로
+ * 동시에 열려 있는 디렉터리 fd 개수가 트리 깊이 정도로 제한된다.
+ */
+int pool_init(struct thread_pool *pool, int nthreads)
 {
-	char *dirname;
-	int ret;
+	int i;
 
-	if (argc != 2) {
-		fprintf(stderr, "Usage: %s <dir_name>\n", argv[0]);
-		return 1;
+	if (nthreads <= 0) {
+		nthreads = pool_default_threads();
+	}
+	if (nthreads > MAXPOOL) {
+		nthreads = MAXPOOL;
 	}
 
-	dirname = argv[1];
+	pool->head = NULL;
+	pool->pending = 0;
+	pool->shutdown = 0;
+	pool->nthreads = 0;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
 
-	ret = mkdir(dirname, DEFAULT_DIR_MODE);
-	if (ret != 0) {
-		fprintf(stderr, "make directory error\n");
+	// 디렉터리 fd 를 많이 사용하므로 fd 제한을 최대로 올린다.
+	raise_nofile_limit();
+
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&pool->tid[i], NULL, pool_worker, pool) != 0) {
+			break;
+		}
+		pool->nthreads++;
 	}
 
-	return ret;
+	if (pool->nthreads == 0) {
+		pool_destroy(pool);
+		return -1;
+	}
+
+	return 0;
 }
 
 
-int remove_directory(int argc, char **argv)
+int pool_submit(struct thread_pool *pool, void (*func)(void *), void *arg)
 {
-	char *dirname;
-	int ret;
+	struct pool_task *task;
 
-	if (argc != 2) {
-		fprintf(stderr, "Usage: %s <dir_name>\n", argv[0]);
-		return 1;
+	task = malloc(sizeof(*task));
+	if (task == NULL) {
+		return -1;
 	}
+	task->func = func;
+	task->arg = arg;
 
-	dirname = argv[1];
-
-	ret = rmdir(dirname);
-	if (ret != 0) {
-		fprintf(stderr, "remove directory error\n");
-	}
+	pthread_mutex_lock(&pool->lock);
+	task->next = pool->head;
+	pool->head = task;
+	pool->pending++;
+	pthread_cond_signal(&pool->work_cond);
+	pthread_mutex_unlock(&pool->lock);
 
-	return ret;
+	return 0;
 }
 
 
-/* 
- * copy_directory
+/*
+ * pool_wait
  *
- * source와 destination 디렉터리를 입력 받는다.
- * source의 각 파일에 대해 디렉터리가 아닌 경우, thread를 생성하여
- *   destination 디렉터리에 같은 이름으로 복사한다.
- * MAXTHREAD 만큼의 thread 만 생성하고 join하는 것을 반복한다.
+ * 추가된 작업 (작업이 추가한 작업 포함) 이 모두 끝날 때까지 기다린다.
  */
-int copy_directory(int argc, char **argv)
+void pool_wait(struct thread_pool *pool)
 {
-	char *src_dirname, *dst_dirname;
-	DIR *dp, *tmp_dp;
-	struct dirent *d_entry;
-	//struct stat statbuf;
-	pthread_t tid[MAXTHREAD];
-	int i, ret;
-
-	// 명령 인자 개수를 확인
-	if (argc != 3) {
-		fprintf(stderr, "Usage: %s <src_dir> <dst_dir>\n", argv[0]);
-		return 1;
+	pthread_mutex_lock(&pool->lock);
+	while (pool->pending > 0) {
+		pthread_cond_wait(&pool->done_cond, &pool->lock);
 	}
-	src_dirname = argv[1];
-	dst_dirname = argv[2];
+	pthread_mutex_unlock(&pool->lock);
+}
 
-	// source 디렉터리 열기
-	dp = opendir(src_dirname);
-	if (dp == NULL) {
-		fprintf(stderr, "directory <%s> open error\n", src_dirname);
-		return 1;
-	}
 
-	// destination 디렉터리 열기
-	tmp_dp = opendir(dst_dirname);
-	if (tmp_dp == NULL) {
-		// destination 디렉터리 생성
-		ret = mkdir(dst_dirname, DEFAULT_DIR_MODE);
-		if (ret != 0) {
-			fprintf(stderr, "directory <%s> creation error\n", dst_dirname);
-			closedir(dp);
-			return 1;
-		}
-	} else {
-		closedir(tmp_dp);
-	}
+void pool_destroy(struct thread_pool *pool)
+{
+	int i;
 
-	// 스레드를 생성하여 모든 파일 복사
-	i = 0;	// 스레드 번호 초기화
-	d_entry = readdir(dp);
-	while (d_entry != NULL) {
-		// 소스 파일 확인
-		sprintf(src_path[i], "%s/%s", src_dirname, d_entry->d_name);
-#if 0
-		if (stat(src_path[i], &statbuf)) {
-			fprintf(stderr, "file (%s) access error\n", src_path[i]);
+	pthread_mutex_lock(&pool->lock);
+	pool->shutdown = 1;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->lock);
 
-			// 다음 파일 이름 읽기
-			d_entry = readdir(dp);
-			continue;
-		}
+	for (i = 0; i < pool->nthreads; i++) {
+		pthread_join(pool->tid[i], NULL);
+	}
 
-		// 디렉터리는 무시
-		if (S_ISDIR(statbuf.st_mode)) {
-			// 다음 파일 이름 읽기
-			d_entry = readdir(dp);
-			continue;
-		}
-#else
-		// 디렉터리는 무시
-		if (d_entry->d_type == DT_DIR) {
-			// 다음 파일 이름 읽기
-			d_entry = readdir(dp);
-			continue;
-		}
-#endif
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_cond_destroy(&pool->done_cond);
+}
 
-		// destination 경로 이름 완성
-		sprintf(dst_path[i], "%s/%s", dst_dirname, d_entry->d_name);
 
-		// 파일 복사 스레드 생성
-		ret = pthread_create(&tid[i], NULL, dcp_thr_fn, (void *)i);
-		if (ret != 0) {
-			fprintf(stderr, "thread creation error\n");
+void *pool_worker(void *arg)
+{
+	struct thread_pool *pool = arg;
+	struct pool_task *task;
 
-			// 다음 파일 이름 읽기
-			d_entry = readdir(dp);
-			continue;
+	while (1) {
+		pthread_mutex_lock(&pool->lock);
+		while (pool->head == NULL && !pool->shutdown) {
+			pthread_cond_wait(&pool->work_cond, &pool->lock);
 		}
-
-		// MAXTHREAD 이면, 종료 기다림
-		if (i == (MAXTHREAD - 1)) {
-			for (i = 0; i < MAXTHREAD; i++) {
-				ret = pthread_join(tid[i], (void *)NULL);
-				if (ret != 0) {
-					fprintf(stderr, "thread join error\n");
-				}
-			}
-			// thread 번호 초기화
-			i = 0;
-		} else {
-			// thread 번호 증가
-			i++;
+		if (pool->head == NULL) {
+			// shutdown 이고 남은 작업이 없음
+			pthread_mutex_unlock(&pool->lock);
+			break;
 		}
+		task = pool->head;
+		pool->head = task->next;
+		pthread_mutex_unlock(&pool->lock);
 
-		// 다음 파일 이름 읽기
-		d_entry = readdir(dp);
-	}
+		task->func(task->arg);
+		free(task);
 
-	// 마지막 스레드를 기다림
-	if (i != 0) {
-		for (i--; i >= 0; i--) {
-			ret = pthread_join(tid[i], (void *)NULL);
-			if (ret != 0) {
-				fprintf(stderr, "thread join error\n");
-			}
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->pending == 0) {
+			pthread_cond_broadcast(&pool->done_cond);
 		}
+		pthread_mutex_unlock(&pool->lock);
 	}
 
-	closedir(dp);
-
-	return 0;
+	return NULL;
 }
 
 
-void *dcp_thr_fn(void *thr_num)
+/*
+ * pool_default_threads
+ *
+ * 기본 worker 개수: 파일 시스템 작업은 I/O 대기가 많으므로 CPU 개수의 2 배.
+ */
+int pool_default_threads(void)
 {
-	char *in_file, *out_file;
-    int in_fd, out_fd, rd_count, wt_count;
-    char buffer[BUF_SIZE];
- 
-	printf("Thread[%d]: copy \"%s\" into \"%s\"\n", (int)thr_num, 
-			src_path[(int)thr_num], dst_path[(int)thr_num]);
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
 
-	in_file = src_path[(int)thr_num];
-	out_file = dst_path[(int)thr_num];
+	if (ncpu < 2) {
+		ncpu = 2;
+	}
+	return (ncpu * 2 > MAXPOOL) ? MAXPOOL : ncpu * 2;
+}
 
-	// 소스 파일을 열고, 목적 파일을 생성한다.
-	in_fd = open(in_file, O_RDONLY);
-	if (in_fd < 0) {
-		fprintf(stderr, "source file (%s) open error\n", in_file);
-		pthread_exit(0);
+
+void raise_nofile_limit(void)
+{
+	struct rlimit rl;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
 	}
+}
 
-	out_fd = creat(out_file, DEFAULT_FILE_MODE);
-	if (out_fd < 0) {
-		fprintf(stderr, "destination file (%s) creation error\n", out_file);
-		pthread_exit(0);
+
+/*
+ * dir_reader
+ *
+ * opendir/readdir 대신 getdents64 로 큰 버퍼 단위로 디렉터리를 읽는다.
+ * fd 는 호출한 쪽이 소유하며, ".", ".." 은 건너뛴다.
+ */
+int dir_reader_init(struct dir_reader *dr, int fd)
+{
+	dr->buf = malloc(DIRBUF_SIZE);
+	if (dr->buf == NULL) {
+		return -1;
 	}
- 
-    // 버퍼를 이용하여 소스 파일을 읽어서 목적 파일에 기록한다.
-	// 소스 파일의 끝까지 반복한다.
-	while (1) {
-		// 소스 파일에서 데이터 블록(버퍼) 읽기
-		rd_count = read(in_fd, buffer, BUF_SIZE);
+	dr->fd = fd;
+	dr->pos = dr->len = 0;
+	dr->error = 0;
 
-		// read error 혹은 파일의 끝이면 loop를 종료한다.
-		if (rd_count <= 0) {
-			break;
+	return 0;
+}
+
+
+struct dirent64 *dir_reader_next(struct dir_reader *dr)
+{
+	struct dirent64 *d_entry;
+	ssize_t n;
+
+	while (1) {
+		if (dr->pos >= dr->len) {
+			n = getdents64(dr->fd, dr->buf, DIRBUF_SIZE);
+			if (n <= 0) {
+				if (n < 0) {
+					dr->error = errno;
+				}
+				return NULL;
+			}
+			dr->len = n;
+			dr->pos = 0;
 		}
 
-		// 목적 파일에 데이터 쓰기
-		wt_count = write(out_fd, buffer, rd_count);
+		d_entry = (struct dirent64 *)(dr->buf + dr->pos);
+		dr->pos += d_entry->d_reclen;
 
-		// write error이면 파일 복사 실패
-		if (wt_count <= 0) {
-			fprintf(stderr, "write error\n");
-			pthread_exit(0);
+		if (d_entry->d_name[0] == '.' && (d_entry->d_name[1] == '\0' ||
+			(d_entry->d_name[1] == '.' && d_entry->d_name[2] == '\0'))) {
+			continue;
 		}
-    }
- 
-	// read error이면 파일 복사 실패
-	if (rd_count < 0) {
-		fprintf(stderr, "read error\n");
-		pthread_exit(0);
+		return d_entry;
 	}
+}
 
-	// 소스와 목적 파일을 닫는다.
-    close(in_fd);
-    close(out_fd);
 
-	pthread_exit(0);
+void dir_reader_close(struct dir_reader *dr)
+{
+	free(dr->buf);
+	dr->buf = NULL;
 }
 
 
-
 /*
  * myshell_error
  *
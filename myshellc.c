@@ -0,0 +1,95 @@
+/*
+ * myshellc - myshell server mode client
+ *
+ * 사용법: myshellc [-s socket] command...
+ *
+ * "myshell -s socket" 으로 실행 중인 셸에 명령 라인들을 차례로 보낸다.
+ * 명령은 이 프로세스의 stdin/stdout/stderr 와 작업 디렉터리에서 실행되며,
+ * 마지막 명령의 종료 상태로 종료한다.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define SERVER_SOCKET	"/tmp/myshell.sock"
+
+
+int main(int argc, char **argv)
+{
+	struct sockaddr_un addr;
+	char cbuf[CMSG_SPACE(sizeof(int) * 4)];
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	char *path = getenv("MYSHELL_SOCKET");
+	int fds[4] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO, -1 };
+	int sock, status = 0, i = 1, n;
+
+	if (argc > 2 && !strcmp(argv[1], "-s")) {
+		path = argv[2];
+		i = 3;
+	}
+	if (path == NULL) {
+		path = SERVER_SOCKET;
+	}
+	if (i >= argc) {
+		fprintf(stderr, "usage: %s [-s socket] command...\n", argv[0]);
+		return 2;
+	}
+
+	sock = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return 2;
+	}
+
+	fds[3] = open(".", O_PATH | O_DIRECTORY);
+	if (fds[3] < 0) {
+		perror(".");
+		return 2;
+	}
+
+	for (; i < argc; i++) {
+		// 명령 라인과 함께 stdin, stdout, stderr, 작업 디렉터리를 보낸다.
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base = argv[i];
+		iov.iov_len = strlen(argv[i]);
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = cbuf;
+		msg.msg_controllen = sizeof(cbuf);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+		if (sendmsg(sock, &msg, MSG_NOSIGNAL) < 0) {
+			if (errno == EPIPE || errno == ECONNRESET) {
+				// quit 으로 셸이 연결을 끝냄
+				break;
+			}
+			fprintf(stderr, "myshellc: connection lost\n");
+			return 2;
+		}
+		n = recv(sock, &status, sizeof(status), 0);
+		if (n == 0 || (n < 0 && errno == ECONNRESET)) {
+			break;
+		}
+		if (n != sizeof(status)) {
+			fprintf(stderr, "myshellc: connection lost\n");
+			return 2;
+		}
+	}
+
+	return status;
+}